@@ -0,0 +1,526 @@
+// Micro benchmarks for the synth building blocks, results as JSON.
+//
+//   benchmark [--out=results.json] [--min-time=0.2] [--max-voices=512] [--simd=scalar|sse2|avx2|avx512]
+//
+// Every case reports ns per sample (per voice for the single voice cases) and voices per core,
+// how many of that voice one core could render in realtime at 44.1kHz. Parser cases report the
+// input's size in bytes and MB/s instead.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../src/synthEngine.h"
+#include "../src/midiFile.h"
+
+const unsigned int BENCH_SAMPLE_RATE = 44100;
+
+struct BenchResult {
+	std::string mName;
+	int mVoices;
+	double mNsPerSample;
+	double mVoicesPerCore;
+	long long mSamples;
+	// Throughput cases only, bytes of input per pass and 10^6 bytes per second
+	long long mBytes;
+	double mMegabytesPerSecond;
+};
+
+// Keeps results alive so the optimiser can't drop the work
+volatile float gSink = 0.0f;
+
+// Call aBody(n) with growing n until aMinSeconds have been spent in one call, aBody renders n
+// samples. Returns ns per sample and the sample count of the timed call.
+template<class F>
+double measure(F aBody, double aMinSeconds, long long& aSamples) {
+	long long n = 64;
+	while (true) {
+		auto start = std::chrono::steady_clock::now();
+		aBody(n);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (seconds >= aMinSeconds || n >= (1LL << 40)) {
+			aSamples = n;
+			return seconds * 1e9 / (double)n;
+		}
+		// Aim a little past the target so the next call is usually the last
+		double scale = (seconds > 0.0) ? 1.2 * aMinSeconds / seconds : 16.0;
+		n = (long long)((double)n * std::min(std::max(scale, 2.0), 16.0));
+	}
+}
+
+class Bench {
+private:
+	std::vector<BenchResult> mResults;
+	double mMinTime;
+
+public:
+	Bench(double aMinTime) {
+		mMinTime = aMinTime;
+	}
+
+	// aBody(n) renders n samples of aVoices voices
+	template<class F>
+	void run(const std::string& aName, int aVoices, F aBody) {
+		BenchResult r;
+		r.mName = aName;
+		r.mVoices = aVoices;
+		r.mNsPerSample = measure(aBody, mMinTime, r.mSamples);
+		double budget = 1e9 / (double)BENCH_SAMPLE_RATE;
+		r.mVoicesPerCore = (r.mNsPerSample > 0.0) ? aVoices * budget / r.mNsPerSample : 0.0;
+		r.mBytes = 0;
+		r.mMegabytesPerSecond = 0.0;
+		mResults.push_back(r);
+
+		std::cerr << aName << " voices=" << aVoices << " " << r.mNsPerSample << " ns/sample, "
+			<< r.mVoicesPerCore << " voices/core" << std::endl;
+	}
+
+	// aBody(n) makes n passes over aBytes of input
+	template<class F>
+	void runThroughput(const std::string& aName, long long aBytes, F aBody) {
+		BenchResult r;
+		r.mName = aName;
+		r.mVoices = 0;
+		r.mVoicesPerCore = 0.0;
+		r.mBytes = aBytes;
+		const double nsPerPass = measure(aBody, mMinTime, r.mSamples);
+		r.mNsPerSample = 0.0;
+		r.mMegabytesPerSecond = (nsPerPass > 0.0) ? (double)aBytes * 1e3 / nsPerPass : 0.0;
+		mResults.push_back(r);
+
+		std::cerr << aName << " bytes=" << aBytes << " " << r.mMegabytesPerSecond << " MB/s" << std::endl;
+	}
+
+	std::string json(SimdLevel aSimd) const {
+		std::ostringstream out;
+		out << "{\n";
+		out << "  \"sample_rate\": " << BENCH_SAMPLE_RATE << ",\n";
+		out << "  \"simd\": \"" << CpuFeatures::name(aSimd) << "\",\n";
+		out << "  \"results\": [\n";
+		for (size_t i = 0; i < mResults.size(); i++) {
+			const BenchResult& r = mResults[i];
+			out << "    { \"name\": \"" << r.mName << "\"";
+			if (r.mBytes > 0) {
+				out << ", \"bytes\": " << r.mBytes
+					<< ", \"mb_per_s\": " << r.mMegabytesPerSecond
+					<< ", \"passes\": " << r.mSamples;
+			} else {
+				out << ", \"voices\": " << r.mVoices
+					<< ", \"ns_per_sample\": " << r.mNsPerSample
+					<< ", \"voices_per_core\": " << r.mVoicesPerCore
+					<< ", \"samples\": " << r.mSamples;
+			}
+			out << " }" << ((i + 1 < mResults.size()) ? "," : "") << "\n";
+		}
+		out << "  ]\n}\n";
+		return out.str();
+	}
+};
+
+const char* waveName(Synth::WaveForm aWave) {
+	switch (aWave) {
+	case Synth::OSC_SINE: return "sine";
+	case Synth::OSC_SQUARE: return "square";
+	case Synth::OSC_TRIANGLE: return "triangle";
+	case Synth::OSC_SAW_LIM: return "saw_lim";
+	case Synth::OSC_SAW: return "saw";
+	case Synth::OSC_NOISE: return "noise";
+	case Synth::OSC_PULSE: return "pulse";
+	case Synth::OSC_NOISE_PINK: return "noise_pink";
+	case Synth::OSC_NOISE_BROWN: return "noise_brown";
+	case Synth::OSC_FBM: return "fbm";
+	default: return "unknown";
+	}
+}
+
+void benchOscillators(Bench& aBench) {
+	const double step = 1.0 / BENCH_SAMPLE_RATE;
+	for (int w = Synth::OSC_SINE; w <= Synth::OSC_FBM; w++) {
+		Synth::WaveForm wave = (Synth::WaveForm)w;
+
+		aBench.run(std::string("osc/") + waveName(wave), 1, [&](long long n) {
+			double acc = 0.0;
+			for (long long i = 0; i < n; i++) {
+				acc += Synth::osc((double)i * step, 440.0, wave, 5.0, 0.001);
+			}
+			gSink = (float)acc;
+		});
+
+		aBench.run(std::string("oscillator/") + waveName(wave), 1, [&](long long n) {
+			Oscillator osc;
+			osc.start(440.0, BENCH_SAMPLE_RATE, wave, 5.0, 0.001);
+			float block[RENDER_CHUNK] = {};
+			for (long long i = 0; i < n; i += RENDER_CHUNK) {
+				osc.renderAdd(block, RENDER_CHUNK, 1.0f);
+			}
+			gSink = block[0];
+		});
+	}
+}
+
+void benchEnvelopes(Bench& aBench) {
+	const double step = 1.0 / BENCH_SAMPLE_RATE;
+	EnvelopeADSR settings;
+	settings.mAttackTime = 0.05;
+	settings.mDecayTime = 1.0;
+	settings.mSustainAmp = 0.95;
+	settings.mReleaseTime = 0.1;
+
+	aBench.run("envelope/get_amp", 1, [&](long long n) {
+		// Held for half the run then released, so every stage is visited
+		double timeOff = (double)(n / 2) * step;
+		double acc = 0.0;
+		for (long long i = 0; i < n; i++) {
+			double t = (double)i * step;
+			acc += settings.getAmp(t, 0.0, (t < timeOff) ? -1.0 : timeOff);
+		}
+		gSink = (float)acc;
+	});
+
+	aBench.run("envelope/voice", 1, [&](long long n) {
+		VoiceEnvelope env;
+		env.noteOn(settings, BENCH_SAMPLE_RATE);
+		float gain[RENDER_CHUNK];
+		for (long long i = 0; i < n; i += RENDER_CHUNK) {
+			if (i >= n / 2) {
+				env.noteOff();
+			}
+			if (env.idle()) {
+				env.noteOn(settings, BENCH_SAMPLE_RATE);
+			}
+			env.render(gain, RENDER_CHUNK);
+		}
+		gSink = gain[0];
+	});
+}
+
+void benchInstrument(Bench& aBench, const std::string& aName, const Instrument& aInstrument) {
+	aBench.run("instrument/" + aName, 1, [&](long long n) {
+		const int frames = 512;
+		std::vector<float> block(frames, 0.0f);
+		BlockTime time;
+		time.mTimeStep = 1.0 / BENCH_SAMPLE_RATE;
+		time.mSampleRate = BENCH_SAMPLE_RATE;
+
+		DelayLinePool delayLines(1, VOICE_DELAY_LENGTH);
+		Note note;
+		note.mId = 0;
+		note.mChannel = 1;
+		note.mActive = true;
+		note.mDelay = delayLines.line(0);
+		aInstrument.start(note, BENCH_SAMPLE_RATE);
+
+		for (long long i = 0; i < n; i += frames) {
+			time.mFrame = i;
+			time.mTime = (double)i * time.mTimeStep;
+			bool finished = false;
+			aInstrument.render(block.data(), frames, time, note, finished);
+			if (finished) {
+				// Percussive instruments die away, keep a voice sounding for the whole run
+				aInstrument.start(note, BENCH_SAMPLE_RATE);
+			}
+		}
+		gSink = block[0];
+	});
+}
+
+void benchOutput(Bench& aBench, SimdLevel aSimd) {
+	const WavFormat formats[] = { WAV_PCM16, WAV_PCM24, WAV_PCM32, WAV_FLOAT32 };
+	const char* names[] = { "pcm16", "pcm24", "pcm32", "float32" };
+	for (int f = 0; f < 4; f++) {
+		for (int dither = 0; dither < 2; dither++) {
+			if (dither && (formats[f] == WAV_PCM32 || formats[f] == WAV_FLOAT32)) {
+				continue;
+			}
+			aBench.run(std::string("output/") + names[f] + (dither ? "_dither" : ""), 1, [&](long long n) {
+				const int frames = 512;
+				std::vector<float> block(frames);
+				for (int i = 0; i < frames; i++) {
+					block[i] = std::sin(i * 0.05f) * 1.2f;
+				}
+				SampleConverter converter(formats[f], dither != 0);
+				converter.setSimdLevel(aSimd);
+				std::vector<char> out;
+				for (long long i = 0; i < n; i += frames) {
+					converter.convert(block.data(), frames, out);
+				}
+				gSink = (float)out[0];
+			});
+		}
+	}
+}
+
+// FILTER_LANES voices' filters sweeping across a block, per sample per voice
+void benchFilters(Bench& aBench, SimdLevel aSimd) {
+	aBench.run("filter/lanes", FILTER_LANES, [&](long long n) {
+		const int frames = 512;
+		alignas(64) float block[FILTER_LANES * frames];
+		for (int i = 0; i < FILTER_LANES * frames; i++) {
+			block[i] = std::sin(i * 0.01f);
+		}
+		FilterKernel kernel = filterKernelFor(aSimd);
+		FilterLanes lanes;
+		SvfState state[FILTER_LANES];
+		float mix[3];
+		SvfCoefficients::mix(FILTER_LOWPASS, 2.0, mix);
+		for (long long i = 0; i < n; i += frames) {
+			double cutoff = 200.0 + (double)((i / frames) % 64) * 100.0;
+			SvfCoefficients to[FILTER_LANES];
+			for (int l = 0; l < FILTER_LANES; l++) {
+				to[l] = SvfCoefficients::make(cutoff + l * 10.0, 2.0, BENCH_SAMPLE_RATE);
+				lanes.load(l, state[l], to[l], mix, frames);
+			}
+			kernel(lanes, block, frames);
+			for (int l = 0; l < FILTER_LANES; l++) {
+				lanes.store(l, state[l], to[l]);
+			}
+		}
+		gSink = block[0];
+	});
+}
+
+// Stereo mix bus effects over 512 frame blocks, the convolution with a 3 second IR of decaying noise
+void benchEffects(Bench& aBench) {
+	const int frames = 512;
+	auto run = [&](const std::string& aName, Effect& aEffect) {
+		aBench.run(aName, 1, [&](long long n) {
+			std::vector<float> left(frames), right(frames);
+			for (long long i = 0; i < n; i += frames) {
+				for (int f = 0; f < frames; f++) {
+					left[f] = std::sin((float)(i + f) * 0.03f);
+					right[f] = left[f];
+				}
+				aEffect.process(left.data(), right.data(), frames);
+			}
+			gSink = left[0];
+		});
+	};
+
+	ChorusEffect chorus(BENCH_SAMPLE_RATE);
+	run("effect/chorus", chorus);
+	FlangerEffect flanger(BENCH_SAMPLE_RATE);
+	run("effect/flanger", flanger);
+	TempoDelay delay(BENCH_SAMPLE_RATE, DELAY_PING_PONG);
+	run("effect/delay_pingpong", delay);
+
+	FdnReverb fdn(BENCH_SAMPLE_RATE, 2.0);
+	run("reverb/fdn", fdn);
+
+	WavData ir;
+	ir.mSampleRate = (unsigned int)BENCH_SAMPLE_RATE;
+	ir.mChannels = 2;
+	NoiseGenerator noise;
+	for (int i = 0; i < (int)BENCH_SAMPLE_RATE * 3; i++) {
+		float decay = std::exp(-(float)i / (float)BENCH_SAMPLE_RATE * 2.3f);
+		ir.mSamples.push_back(decay * noise.white());
+		ir.mSamples.push_back(decay * noise.white());
+	}
+	ConvolutionReverb convolution;
+	convolution.setup(ir, BENCH_SAMPLE_RATE);
+	run("reverb/convolution", convolution);
+}
+
+// An engine with aVoices notes held on aChannel (harmonica by default). Note ids have to differ,
+// so they count down from 1760Hz and the largest voice counts reach well below audible pitches.
+std::unique_ptr<SynthEngine> heldEngine(int aVoices, VoiceRenderer aRenderer, SimdLevel aSimd, int aChannel = 1) {
+	std::unique_ptr<SynthEngine> engine = std::make_unique<SynthEngine>(BENCH_SAMPLE_RATE, aVoices);
+	engine->setVoiceRenderer(aRenderer);
+	engine->setSimdLevel(aSimd);
+	for (int v = 0; v < aVoices; v++) {
+		while (!engine->noteOn(36 - v, aChannel, 0.0)) {
+			engine->drainEvents();
+		}
+	}
+	engine->drainEvents();
+	return engine;
+}
+
+void benchEngine(Bench& aBench, int aMaxVoices, SimdLevel aSimd) {
+	const double step = 1.0 / BENCH_SAMPLE_RATE;
+	const int frames = 512;
+	for (int voices = 1; voices <= aMaxVoices; voices *= 2) {
+		std::unique_ptr<SynthEngine> engine = heldEngine(voices, RENDER_VOICE_POOL, aSimd);
+		aBench.run("engine/make_noise", voices, [&](long long n) {
+			double acc = 0.0;
+			for (long long i = 0; i < n; i++) {
+				acc += engine->makeNoise(0, (double)i * step);
+			}
+			gSink = (float)acc;
+		});
+
+		for (int r = RENDER_VOICE_POOL; r <= RENDER_VOICE_BANK; r++) {
+			engine = heldEngine(voices, (VoiceRenderer)r, aSimd);
+			aBench.run((r == RENDER_VOICE_POOL) ? "engine/process" : "engine/process_bank", voices, [&](long long n) {
+				std::vector<float> block(frames, 0.0f);
+				BlockTime time;
+				time.mTimeStep = step;
+				time.mSampleRate = BENCH_SAMPLE_RATE;
+				for (long long i = 0; i < n; i += frames) {
+					time.mFrame = i;
+					time.mTime = (double)i * step;
+					engine->process(block.data(), frames, 1, time);
+				}
+				gSink = block[0];
+			});
+		}
+
+		// Plucked strings on channel 3. They die away after their ring time, so the engine is
+		// replucked whenever voices have finished
+		engine = heldEngine(voices, RENDER_VOICE_POOL, aSimd, 3);
+		aBench.run("engine/process_pluck", voices, [&](long long n) {
+			std::vector<float> block(frames, 0.0f);
+			BlockTime time;
+			time.mTimeStep = step;
+			time.mSampleRate = BENCH_SAMPLE_RATE;
+			for (long long i = 0; i < n; i += frames) {
+				time.mFrame = i;
+				time.mTime = (double)i * step;
+				engine->process(block.data(), frames, 1, time);
+				if (engine->activeNotes() < voices) {
+					engine = heldEngine(voices, RENDER_VOICE_POOL, aSimd, 3);
+				}
+			}
+			gSink = block[0];
+		});
+
+		// Filter sweeps on channel 4, every voice through the lane filters
+		engine = heldEngine(voices, RENDER_VOICE_POOL, aSimd, 4);
+		aBench.run("engine/process_sweep", voices, [&](long long n) {
+			std::vector<float> block(frames, 0.0f);
+			BlockTime time;
+			time.mTimeStep = step;
+			time.mSampleRate = BENCH_SAMPLE_RATE;
+			for (long long i = 0; i < n; i += frames) {
+				time.mFrame = i;
+				time.mTime = (double)i * step;
+				engine->process(block.data(), frames, 1, time);
+			}
+			gSink = block[0];
+		});
+	}
+}
+
+// 32 voices over channels 1 to 4, each channel through its own bus with a chorus and a delay
+// into a master FDN reverb, stereo. Run on 1 and 4 threads, so the four branches can overlap
+void benchGraph(Bench& aBench, SimdLevel aSimd) {
+	const double step = 1.0 / BENCH_SAMPLE_RATE;
+	const int frames = 512;
+	for (int threads = 1; threads <= 4; threads *= 4) {
+		std::unique_ptr<SynthEngine> engine = std::make_unique<SynthEngine>(BENCH_SAMPLE_RATE, 32);
+		engine->setSimdLevel(aSimd);
+		engine->setRenderThreads(threads);
+		AudioGraph graph = AudioGraph::standard();
+		for (int channel = 1; channel <= 4; channel++) {
+			int source = graph.addSource("channel", 1u << channel);
+			int bus = graph.addBus("bus");
+			graph.connect(source, bus);
+			graph.addEffect(bus, std::make_shared<ChorusEffect>(BENCH_SAMPLE_RATE));
+			graph.addEffect(bus, std::make_shared<TempoDelay>(BENCH_SAMPLE_RATE));
+			graph.connect(bus, graph.output());
+		}
+		graph.addEffect(graph.output(), std::make_shared<FdnReverb>(BENCH_SAMPLE_RATE, 2.0));
+		engine->setGraph(graph);
+		for (int v = 0; v < 32; v++) {
+			engine->noteOn(36 - v, 1 + v % 4, 0.0);
+		}
+
+		aBench.run((threads == 1) ? "graph/branches" : "graph/branches_threaded", 32, [&](long long n) {
+			std::vector<float> block(2 * frames, 0.0f);
+			BlockTime time;
+			time.mTimeStep = step;
+			time.mSampleRate = BENCH_SAMPLE_RATE;
+			for (long long i = 0; i < n; i += frames) {
+				time.mFrame = i;
+				time.mTime = (double)i * step;
+				engine->process(block.data(), frames, 2, time);
+			}
+			gSink = block[0];
+		});
+	}
+}
+
+// Type 1 file of aTracks tracks of aNotes notes each, running status throughout
+std::vector<uint8_t> makeMidi(int aTracks, int aNotes) {
+	std::vector<uint8_t> file = { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1, 0, (uint8_t)aTracks, 0x01, 0xe0 };
+	for (int t = 0; t < aTracks; t++) {
+		std::vector<uint8_t> track = { 0x00, 0xff, 0x51, 0x03, 0x07, 0xa1, 0x20, 0x00, (uint8_t)(0x90 | t) };
+		for (int i = 0; i < aNotes; i++) {
+			const uint8_t key = (uint8_t)(36 + (i * 7 + t * 5) % 48);
+			// On after 1 + t ticks, off 240 (two byte delta) later
+			track.insert(track.end(), { (uint8_t)(1 + t), key, 100, 0x81, 0x70, key, 0 });
+		}
+		track.insert(track.end(), { 0x00, 0xff, 0x2f, 0x00 });
+		const uint32_t length = (uint32_t)track.size();
+		file.insert(file.end(), { 'M', 'T', 'r', 'k', (uint8_t)(length >> 24), (uint8_t)(length >> 16), (uint8_t)(length >> 8), (uint8_t)length });
+		file.insert(file.end(), track.begin(), track.end());
+	}
+	return file;
+}
+
+// A whole file into a sequencer per pass
+void benchMidi(Bench& aBench) {
+	const std::vector<uint8_t> file = makeMidi(16, 20000);
+	Sequencer sequencer(BENCH_SAMPLE_RATE);
+	aBench.runThroughput("midi/parse", (long long)file.size(), [&](long long n) {
+		for (long long i = 0; i < n; i++) {
+			sequencer.clear();
+			MidiFile::parse(file.data(), file.size(), sequencer);
+		}
+		gSink = (float)sequencer.events().size();
+	});
+}
+
+int main(int argc, char* argv[]) {
+	std::string outPath;
+	double minTime = 0.2;
+	int maxVoices = 512;
+	SimdLevel simd = CpuFeatures::detect();
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg.rfind("--out=", 0) == 0) {
+			outPath = arg.substr(6);
+		} else if (arg.rfind("--min-time=", 0) == 0) {
+			minTime = std::max(0.001, std::atof(arg.c_str() + 11));
+		} else if (arg.rfind("--max-voices=", 0) == 0) {
+			maxVoices = std::max(1, std::atoi(arg.c_str() + 13));
+		} else if (arg.rfind("--simd=", 0) == 0) {
+			if (!CpuFeatures::parse(arg.c_str() + 7, simd)) {
+				std::cerr << "Unknown instruction set " << arg.c_str() + 7 << std::endl;
+				return 1;
+			}
+		}
+	}
+
+	Bench bench(minTime);
+	benchOscillators(bench);
+	benchEnvelopes(bench);
+	benchInstrument(bench, "bell", BellInstrument::describe());
+	benchInstrument(bench, "harmonica", HarmonicaInstrument::describe());
+	benchInstrument(bench, "pluck", PluckInstrument::describe());
+	benchOutput(bench, simd);
+	benchFilters(bench, simd);
+	benchEffects(bench);
+	benchEngine(bench, maxVoices, simd);
+	benchGraph(bench, simd);
+	benchMidi(bench);
+
+	std::string json = bench.json(simd);
+	if (outPath.empty()) {
+		std::cout << json;
+	} else {
+		std::ofstream out(outPath);
+		if (!out.is_open()) {
+			std::cerr << "Could not open " << outPath << std::endl;
+			return 1;
+		}
+		out << json;
+	}
+	return 0;
+}
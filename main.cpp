@@ -1,10 +1,359 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
-#include "src/noiseMaker.h"
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 #include "src/synthEngine.h"
+#include "src/offlineRenderer.h"
+#include "src/midiFile.h"
+#include "src/audioSink.h"
+#include "src/alsaSink.h"
 
-int main() {
-    std::unique_ptr<SynthEngine> engine = std::make_unique<SynthEngine>();
-    return 0;
+// Output for --render: a .wav path, "-" for raw PCM on stdout, "raw:<path>" for raw PCM into a
+// file or named pipe, "null" to throw the audio away, or "alsa[:device]" to play it
+std::unique_ptr<AudioSink> makeSink(const std::string& aSpec, WavFormat aFormat, bool aDither) {
+    if (aSpec == "-") {
+        return std::make_unique<RawSink>("-", aFormat, aDither);
+    }
+    if (aSpec.rfind("raw:", 0) == 0) {
+        return std::make_unique<RawSink>(aSpec.substr(4), aFormat, aDither);
+    }
+    if (aSpec == "null") {
+        return std::make_unique<NullSink>();
+    }
+    if (aSpec == "alsa" || aSpec.rfind("alsa:", 0) == 0) {
+#ifdef SYNTH_ALSA
+        return std::make_unique<AlsaSink>(aSpec == "alsa" ? "default" : aSpec.substr(5), aFormat, aDither);
+#else
+        std::cerr << "Built without ALSA, define SYNTH_ALSA and link with -lasound" << std::endl;
+        return nullptr;
+#endif
+    }
+    return std::make_unique<WavSink>(aSpec, aFormat, aDither);
+}
+
+// Name for --format, returns false if it isn't one
+bool parseFormat(const std::string& aName, WavFormat& aFormat) {
+    if (aName == "pcm16") {
+        aFormat = WAV_PCM16;
+    } else if (aName == "pcm24") {
+        aFormat = WAV_PCM24;
+    } else if (aName == "pcm32") {
+        aFormat = WAV_PCM32;
+    } else if (aName == "float") {
+        aFormat = WAV_FLOAT32;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Name for --bus-filter, returns false if it isn't one
+bool parseFilterMode(const std::string& aName, FilterMode& aMode) {
+    if (aName == "lowpass") {
+        aMode = FILTER_LOWPASS;
+    } else if (aName == "highpass") {
+        aMode = FILTER_HIGHPASS;
+    } else if (aName == "bandpass") {
+        aMode = FILTER_BANDPASS;
+    } else if (aName == "notch") {
+        aMode = FILTER_NOTCH;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parseDelayMode(const std::string& aName, DelayMode& aMode) {
+    if (aName == "mono") {
+        aMode = DELAY_MONO;
+    } else if (aName == "stereo") {
+        aMode = DELAY_STEREO;
+    } else if (aName == "pingpong") {
+        aMode = DELAY_PING_PONG;
+    } else {
+        return false;
+    }
+    return true;
 }
 
+int main(int argc, char* argv[]) {
+    // Options: --voices=N polyphony, --simd[=scalar|sse2|avx2|avx512] use the SIMD voice bank,
+    // --threads=N render voices on N threads, --pin keep render threads on their own cores,
+    // --stats print block timings on exit, --stats-file=<path> append them to a file every second,
+    // --channels=N output channels (2 for stereo), --pan=<channel>:<-1..1> place a channel in stereo,
+    // --format=pcm16|pcm24|pcm32|float output sample format (--float is --format=float),
+    // --dither triangular dither for 16 and 24 bit output, --seed=N noise seed,
+    // --bus-filter=<lowpass|highpass|bandpass|notch>:<hz>[:<q>] filter the whole mix,
+    // --chorus, --flanger, --delay=<mono|stereo|pingpong>[:<beats>] echo synced to --tempo=<bpm>,
+    // --reverb=fdn[:<seconds>] or --reverb=<impulse.wav> reverb on the mix, --reverb-mix=<wet gain>.
+    // Effects run in that order. --channel-fx=<channel>:<chorus|flanger|delay> gives a channel its
+    // own bus with that effect before the mix. --loop=<count>[:<start>:<end>] plays the script
+    // (or seconds start to end of it) count times, 0 for ever. --play=<script> plays a script
+    // along with the keyboard. A script may be a MIDI file, --midi-map=<1-16>:<channel|off> picks the
+    // engine channel for a MIDI channel. --record=<out.mid> saves the notes played, from the keyboard
+    // or a script, as a MIDI file
+    int voices = DEFAULT_POLYPHONY;
+    int channels = 1;
+    std::vector<std::pair<int, float>> pans;
+    int threads = 1;
+    bool pin = false;
+    bool stats = false;
+    std::string statsPath;
+    bool simd = false;
+    SimdLevel simdLevel = CpuFeatures::detect();
+    WavFormat format = WAV_PCM16;
+    bool dither = false;
+    uint32_t seed = 1;
+    FilterMode busFilter = FILTER_OFF;
+    double busCutoff = 1000.0;
+    double busResonance = 0.707;
+    bool chorus = false;
+    bool flanger = false;
+    bool delay = false;
+    DelayMode delayMode = DELAY_STEREO;
+    double delayBeats = 0.75;
+    double tempo = 120.0;
+    std::string reverb;
+    float reverbMix = 0.3f;
+    std::vector<std::pair<int, std::string>> channelEffects;
+    bool loop = false;
+    int loopCount = 0;
+    double loopStart = 0.0;
+    double loopEnd = -1.0;
+    std::string playPath;
+    MidiLoadOptions midiOptions;
+    std::string recordPath;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--float") {
+            format = WAV_FLOAT32;
+        } else if (arg.rfind("--format=", 0) == 0) {
+            if (!parseFormat(arg.substr(9), format)) {
+                std::cerr << "Unknown sample format " << arg.substr(9) << std::endl;
+                return 1;
+            }
+        } else if (arg == "--dither") {
+            dither = true;
+        } else if (arg.rfind("--seed=", 0) == 0) {
+            seed = (uint32_t)std::strtoul(arg.c_str() + 7, nullptr, 10);
+        } else if (arg.rfind("--bus-filter=", 0) == 0) {
+            std::string spec = arg.substr(13);
+            size_t colon = spec.find(':');
+            if (colon == std::string::npos || !parseFilterMode(spec.substr(0, colon), busFilter)) {
+                std::cerr << "Expected --bus-filter=<lowpass|highpass|bandpass|notch>:<hz>[:<q>]" << std::endl;
+                return 1;
+            }
+            busCutoff = std::atof(spec.c_str() + colon + 1);
+            size_t q = spec.find(':', colon + 1);
+            if (q != std::string::npos) {
+                busResonance = std::atof(spec.c_str() + q + 1);
+            }
+        } else if (arg == "--chorus") {
+            chorus = true;
+        } else if (arg == "--flanger") {
+            flanger = true;
+        } else if (arg.rfind("--delay=", 0) == 0) {
+            std::string spec = arg.substr(8);
+            size_t colon = spec.find(':');
+            if (!parseDelayMode(spec.substr(0, colon), delayMode)) {
+                std::cerr << "Expected --delay=<mono|stereo|pingpong>[:<beats>]" << std::endl;
+                return 1;
+            }
+            if (colon != std::string::npos) {
+                delayBeats = std::atof(spec.c_str() + colon + 1);
+            }
+            delay = true;
+        } else if (arg.rfind("--channel-fx=", 0) == 0) {
+            std::string spec = arg.substr(13);
+            size_t colon = spec.find(':');
+            std::string effect = (colon == std::string::npos) ? "" : spec.substr(colon + 1);
+            if (effect != "chorus" && effect != "flanger" && effect != "delay") {
+                std::cerr << "Expected --channel-fx=<channel>:<chorus|flanger|delay>" << std::endl;
+                return 1;
+            }
+            channelEffects.push_back({ std::atoi(spec.c_str()), effect });
+        } else if (arg.rfind("--loop=", 0) == 0) {
+            loop = true;
+            loopCount = std::max(0, std::atoi(arg.c_str() + 7));
+            size_t colon = arg.find(':');
+            if (colon != std::string::npos) {
+                loopStart = std::atof(arg.c_str() + colon + 1);
+                size_t end = arg.find(':', colon + 1);
+                if (end == std::string::npos) {
+                    std::cerr << "Expected --loop=<count>[:<start>:<end>]" << std::endl;
+                    return 1;
+                }
+                loopEnd = std::atof(arg.c_str() + end + 1);
+            }
+        } else if (arg.rfind("--midi-map=", 0) == 0) {
+            std::string spec = arg.substr(11);
+            size_t colon = spec.find(':');
+            int midiChannel = std::atoi(spec.c_str());
+            if (colon == std::string::npos || midiChannel < 1 || midiChannel > MIDI_CHANNELS) {
+                std::cerr << "Expected --midi-map=<1-16>:<channel|off>" << std::endl;
+                return 1;
+            }
+            std::string target = spec.substr(colon + 1);
+            midiOptions.mChannelMap[midiChannel - 1] = (target == "off") ? -1 : std::atoi(target.c_str());
+        } else if (arg.rfind("--record=", 0) == 0) {
+            recordPath = arg.substr(9);
+        } else if (arg.rfind("--play=", 0) == 0) {
+            playPath = arg.substr(7);
+        } else if (arg.rfind("--tempo=", 0) == 0) {
+            tempo = std::max(1.0, std::atof(arg.c_str() + 8));
+        } else if (arg.rfind("--reverb=", 0) == 0) {
+            reverb = arg.substr(9);
+        } else if (arg.rfind("--reverb-mix=", 0) == 0) {
+            reverbMix = (float)std::atof(arg.c_str() + 13);
+        } else if (arg.rfind("--voices=", 0) == 0) {
+            voices = std::max(1, std::atoi(arg.c_str() + 9));
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            threads = std::max(1, std::atoi(arg.c_str() + 10));
+        } else if (arg.rfind("--channels=", 0) == 0) {
+            channels = std::max(1, std::atoi(arg.c_str() + 11));
+        } else if (arg.rfind("--pan=", 0) == 0) {
+            std::string spec = arg.substr(6);
+            size_t colon = spec.find(':');
+            if (colon == std::string::npos) {
+                std::cerr << "Expected --pan=<channel>:<pan>" << std::endl;
+                return 1;
+            }
+            pans.push_back({ std::atoi(spec.c_str()), (float)std::atof(spec.c_str() + colon + 1) });
+        } else if (arg == "--pin") {
+            pin = true;
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (arg.rfind("--stats-file=", 0) == 0) {
+            statsPath = arg.substr(13);
+        } else if (arg == "--simd") {
+            simd = true;
+        } else if (arg.rfind("--simd=", 0) == 0) {
+            simd = true;
+            if (!CpuFeatures::parse(arg.c_str() + 7, simdLevel)) {
+                std::cerr << "Unknown instruction set " << arg.c_str() + 7 << std::endl;
+                return 1;
+            }
+        }
+    }
 
+    std::unique_ptr<SynthEngine> engine = std::make_unique<SynthEngine>(44100, voices);
+    engine->setNoiseSeed(seed);
+    engine->setBusFilter(busFilter, busCutoff, busResonance);
+    if (!channelEffects.empty()) {
+        // Each channel's voices through its own bus, side by side into the output
+        AudioGraph graph = engine->graph();
+        for (const std::pair<int, std::string>& c : channelEffects) {
+            std::string name = "channel " + std::to_string(c.first);
+            int source = graph.addSource(name, 1u << (c.first & 31));
+            int bus = graph.addBus(name + " " + c.second);
+            graph.connect(source, bus);
+            graph.connect(bus, graph.output());
+            if (c.second == "chorus") {
+                graph.addEffect(bus, std::make_shared<ChorusEffect>(44100.0));
+            } else if (c.second == "flanger") {
+                graph.addEffect(bus, std::make_shared<FlangerEffect>(44100.0));
+            } else {
+                graph.addEffect(bus, std::make_shared<TempoDelay>(44100.0, DELAY_STEREO, delayBeats, tempo));
+            }
+        }
+        engine->setGraph(graph);
+    }
+    if (chorus) {
+        engine->addEffect(std::make_unique<ChorusEffect>(44100.0));
+    }
+    if (flanger) {
+        engine->addEffect(std::make_unique<FlangerEffect>(44100.0));
+    }
+    if (delay) {
+        engine->addEffect(std::make_unique<TempoDelay>(44100.0, delayMode, delayBeats, tempo));
+    }
+    if (reverb == "fdn" || reverb.rfind("fdn:", 0) == 0) {
+        double decay = (reverb.size() > 4) ? std::atof(reverb.c_str() + 4) : 2.0;
+        engine->addEffect(std::make_unique<FdnReverb>(44100.0, decay, 1.0, 0.3, reverbMix));
+    } else if (!reverb.empty()) {
+        std::unique_ptr<ConvolutionReverb> convolution = std::make_unique<ConvolutionReverb>(reverbMix);
+        if (!convolution->load(reverb, 44100.0)) {
+            std::cerr << "Could not read impulse response " << reverb << std::endl;
+            return 1;
+        }
+        engine->addEffect(std::move(convolution));
+    }
+    for (const std::pair<int, float>& p : pans) {
+        engine->setPan(p.first, p.second);
+    }
+    if (threads > 1) {
+        engine->setRenderThreads(threads, pin);
+        std::cerr << "Rendering voices on " << engine->renderThreads() << " threads" << std::endl;
+    }
+    if (simd) {
+        engine->setVoiceRenderer(RENDER_VOICE_BANK);
+        engine->setSimdLevel(simdLevel);
+        std::cerr << "SIMD voice bank using " << CpuFeatures::name(engine->simdLevel()) << std::endl;
+    }
+
+    std::unique_ptr<DeadlineDumper> dumper;
+    if (!statsPath.empty()) {
+        dumper = std::make_unique<DeadlineDumper>(engine->monitor(), statsPath);
+        if (!dumper->isOpen()) {
+            std::cerr << "Could not open " << statsPath << std::endl;
+            return 1;
+        }
+    }
+
+    // Script or MIDI file for --render or --play, looped over the whole of it unless given a range
+    const bool render = argc >= 4 && std::string(argv[1]) == "--render";
+    const std::string scriptPath = render ? argv[2] : playPath;
+    Sequencer sequencer(44100);
+    if (!scriptPath.empty()) {
+        if (MidiFile::isMidi(scriptPath)) {
+            if (!MidiFile::load(scriptPath, sequencer, midiOptions)) {
+                std::cerr << "Could not read MIDI file " << scriptPath << std::endl;
+                return 1;
+            }
+        } else if (!sequencer.loadScript(scriptPath)) {
+            std::cerr << "Could not read script " << scriptPath << std::endl;
+            return 1;
+        }
+        if (loop) {
+            if (loopEnd < 0.0) {
+                loopEnd = (double)sequencer.length() / 44100.0;
+            }
+            sequencer.setLoop(loopStart, loopEnd, loopCount);
+        }
+    }
+
+    // Written as it goes, so the file is whole even if keyboard play is ended with Ctrl+C
+    MidiRecorder recorder(44100);
+    if (!recordPath.empty()) {
+        engine->setRecorder(&recorder);
+        if (!recorder.start(recordPath)) {
+            std::cerr << "Could not open " << recordPath << std::endl;
+            return 1;
+        }
+    }
+
+    // Offline bounce: main --render <script> <out> [--float] [options], see makeSink for <out>
+    if (render) {
+        std::unique_ptr<AudioSink> sink = makeSink(argv[3], format, dither);
+        if (!sink) {
+            return 1;
+        }
+        OfflineRenderer renderer(*engine, 44100, channels);
+        RenderStats result = renderer.render(sequencer, *sink, 1.0 + engine->tailTime());
+        recorder.stop();
+        if (recorder.dropped() > 0) {
+            std::cerr << "Recording dropped " << recorder.dropped() << " events" << std::endl;
+        }
+        if (stats) {
+            engine->monitor().snapshot().print(std::cerr);
+        }
+        return (result.mFrames > 0) ? 0 : 1;
+    }
+
+    engine->run(scriptPath.empty() ? nullptr : &sequencer);
+    return 0;
+}
@@ -0,0 +1,119 @@
+#ifndef ALSASINK_H
+#define ALSASINK_H
+
+#include <cerrno>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "audioSink.h"
+
+// Linux playback through ALSA (PipeWire and PulseAudio both provide an ALSA "default" device).
+// Needs libasound, so it is only built with SYNTH_ALSA defined and -lasound.
+#ifdef SYNTH_ALSA
+#include <alsa/asoundlib.h>
+
+class AlsaSink : public AudioSink {
+private:
+	std::string mDevice;
+	snd_pcm_t* mPcm;
+	unsigned int mChannels;
+	SampleConverter mConverter;
+	std::vector<char> mScratch;
+	long long mUnderruns;
+
+	snd_pcm_format_t pcmFormat() const {
+		switch (mConverter.format()) {
+		case WAV_PCM24: return SND_PCM_FORMAT_S24_3LE;
+		case WAV_PCM32: return SND_PCM_FORMAT_S32_LE;
+		case WAV_FLOAT32: return SND_PCM_FORMAT_FLOAT_LE;
+		case WAV_PCM16: default: return SND_PCM_FORMAT_S16_LE;
+		}
+	}
+
+public:
+	AlsaSink(const std::string& aDevice = "default", WavFormat aFormat = WAV_PCM16, bool aDither = false)
+		: mDevice(aDevice), mConverter(aFormat, aDither) {
+		mPcm = nullptr;
+		mChannels = 1;
+		mUnderruns = 0;
+	}
+
+	~AlsaSink() {
+		close();
+	}
+
+	bool open(unsigned int aSampleRate, unsigned int aChannels, unsigned int aBlockFrames) {
+		close();
+		mChannels = aChannels;
+		mScratch.assign((size_t)aBlockFrames * aChannels * mConverter.bytesPerSample(), 0);
+
+		int err = snd_pcm_open(&mPcm, mDevice.c_str(), SND_PCM_STREAM_PLAYBACK, 0);
+		if (err < 0) {
+			std::cerr << "ALSA: could not open " << mDevice << ": " << snd_strerror(err) << std::endl;
+			mPcm = nullptr;
+			return false;
+		}
+
+		// Let the device buffer about four blocks
+		unsigned int latencyUs = (unsigned int)(4.0 * aBlockFrames * 1000000.0 / aSampleRate);
+		err = snd_pcm_set_params(mPcm, pcmFormat(), SND_PCM_ACCESS_RW_INTERLEAVED, aChannels, aSampleRate, 1, latencyUs);
+		if (err < 0) {
+			std::cerr << "ALSA: " << snd_strerror(err) << std::endl;
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	bool write(const float* aSamples, int aFrames) {
+		if (mPcm == nullptr) {
+			return false;
+		}
+
+		mConverter.convert(aSamples, (size_t)aFrames * mChannels, mScratch);
+
+		const char* data = mScratch.data();
+		const size_t frameBytes = (size_t)mChannels * mConverter.bytesPerSample();
+		int left = aFrames;
+		while (left > 0) {
+			snd_pcm_sframes_t written = snd_pcm_writei(mPcm, data, left);
+			if (written < 0) {
+				// Underrun or suspend, recover and carry on with the rest of the block
+				if (written == -EPIPE) {
+					mUnderruns++;
+				}
+				if (snd_pcm_recover(mPcm, (int)written, 1) < 0) {
+					return false;
+				}
+				continue;
+			}
+			data += written * frameBytes;
+			left -= (int)written;
+		}
+		return true;
+	}
+
+	void close() {
+		if (mPcm != nullptr) {
+			snd_pcm_drain(mPcm);
+			snd_pcm_close(mPcm);
+			mPcm = nullptr;
+		}
+	}
+
+	bool realtime() const {
+		return true;
+	}
+
+	long long underruns() const {
+		return mUnderruns;
+	}
+
+	const char* name() const {
+		return "alsa";
+	}
+};
+#endif
+
+#endif
@@ -0,0 +1,502 @@
+#ifndef AUDIOGRAPH_H
+#define AUDIOGRAPH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "effect.h"
+#include "filter.h"
+#include "threadPool.h"
+
+// Instrument channels a source can take, one bit each in GraphNode::mChannels, and the most
+// sources a plan can have
+const int GRAPH_CHANNELS = 32;
+
+enum GraphNodeType {
+	// Voices of a set of instrument channels
+	GRAPH_SOURCE = 0,
+	// Sum of its inputs times their send gains, then the node gain, filter and effects in order
+	GRAPH_BUS,
+};
+
+// Signal from node mFrom into a bus, at mGain
+struct GraphSend {
+	int mFrom;
+	float mGain;
+};
+
+struct GraphNode {
+	GraphNodeType mType;
+	std::string mName;
+	// Sources: bit c takes channel c. No bits takes every channel no other source has
+	uint32_t mChannels;
+	// Buses only
+	std::vector<GraphSend> mInputs;
+	float mGain;
+	// Shared with the plans the node is compiled into, so state carries over when one is swapped
+	std::shared_ptr<StereoFilter> mFilter;
+	std::vector<std::shared_ptr<Effect>> mEffects;
+};
+
+// Editable description of the mix: instrument sources into buses, buses into other buses through
+// effect chains, and one bus as the output. Nothing here runs audio, GraphPlan::compile() turns
+// it into something that can. Edit it on one control thread.
+class AudioGraph {
+private:
+	std::vector<GraphNode> mNodes;
+	int mOutput;
+
+	int add(GraphNodeType aType, const std::string& aName, uint32_t aChannels, float aGain) {
+		GraphNode node;
+		node.mType = aType;
+		node.mName = aName;
+		node.mChannels = aChannels;
+		node.mGain = aGain;
+		mNodes.push_back(node);
+		return (int)mNodes.size() - 1;
+	}
+
+public:
+	AudioGraph() {
+		mOutput = -1;
+	}
+
+	// Every channel into one "master" bus, the output
+	static AudioGraph standard() {
+		AudioGraph graph;
+		int voices = graph.addSource("voices", 0);
+		int master = graph.addBus("master");
+		graph.connect(voices, master);
+		graph.setOutput(master);
+		return graph;
+	}
+
+	// Node indices are handed out in order and never change
+	int addSource(const std::string& aName, uint32_t aChannels) {
+		return add(GRAPH_SOURCE, aName, aChannels, 1.0f);
+	}
+
+	int addBus(const std::string& aName, float aGain = 1.0f) {
+		return add(GRAPH_BUS, aName, 0, aGain);
+	}
+
+	// Send aFrom into bus aTo at aGain, a node can feed any number of buses
+	void connect(int aFrom, int aTo, float aGain = 1.0f) {
+		if (valid(aFrom) && valid(aTo)) {
+			mNodes[aTo].mInputs.push_back({ aFrom, aGain });
+		}
+	}
+
+	// Remove every send from aFrom to aTo
+	void disconnect(int aFrom, int aTo) {
+		if (valid(aTo)) {
+			std::vector<GraphSend>& inputs = mNodes[aTo].mInputs;
+			inputs.erase(std::remove_if(inputs.begin(), inputs.end(), [&](const GraphSend& s) { return s.mFrom == aFrom; }), inputs.end());
+		}
+	}
+
+	void addEffect(int aNode, std::shared_ptr<Effect> aEffect) {
+		if (valid(aNode) && aEffect) {
+			mNodes[aNode].mEffects.push_back(std::move(aEffect));
+		}
+	}
+
+	// Null for none
+	void setFilter(int aNode, std::shared_ptr<StereoFilter> aFilter) {
+		if (valid(aNode)) {
+			mNodes[aNode].mFilter = std::move(aFilter);
+		}
+	}
+
+	void setGain(int aNode, float aGain) {
+		if (valid(aNode)) {
+			mNodes[aNode].mGain = aGain;
+		}
+	}
+
+	void setOutput(int aNode) {
+		mOutput = aNode;
+	}
+
+	int output() const {
+		return mOutput;
+	}
+
+	// First node called aName, -1 if there isn't one
+	int find(const std::string& aName) const {
+		for (int i = 0; i < size(); i++) {
+			if (mNodes[i].mName == aName) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	bool valid(int aNode) const {
+		return aNode >= 0 && aNode < size();
+	}
+
+	int size() const {
+		return (int)mNodes.size();
+	}
+
+	const GraphNode& node(int aNode) const {
+		return mNodes[aNode];
+	}
+
+	// Seconds the output rings on after the sources stop, effect tails add up along each path.
+	// Only meaningful for graphs that compile
+	double tailTime() const {
+		std::vector<double> tails(mNodes.size(), -1.0);
+		return valid(mOutput) ? tailOf(mOutput, tails, 0) : 0.0;
+	}
+
+private:
+	double tailOf(int aNode, std::vector<double>& aTails, int aDepth) const {
+		if (aTails[aNode] >= 0.0 || aDepth > size()) {
+			return std::max(0.0, aTails[aNode]);
+		}
+		double inputs = 0.0;
+		for (const GraphSend& send : mNodes[aNode].mInputs) {
+			inputs = std::max(inputs, tailOf(send.mFrom, aTails, aDepth + 1));
+		}
+		double own = 0.0;
+		for (const std::shared_ptr<Effect>& effect : mNodes[aNode].mEffects) {
+			own += effect->tailTime();
+		}
+		aTails[aNode] = inputs + own;
+		return aTails[aNode];
+	}
+};
+
+// An AudioGraph flattened for the audio thread. Nodes that can't reach the output are dropped,
+// the rest are sorted into levels where every node only reads nodes of earlier levels, so the
+// nodes of one level can run at the same time. Each node writes one stereo buffer, and a buffer
+// goes back to be reused once the last level that reads it is done. Everything is allocated in
+// compile(), process() only runs it.
+class GraphPlan {
+public:
+	struct Input {
+		int mSlot;
+		float mGain;
+	};
+
+	struct Step {
+		GraphNodeType mType;
+		// Source index for sources, the graph node otherwise
+		int mSource;
+		int mNode;
+		int mSlot;
+		int mFirstInput;
+		int mInputCount;
+		float mGain;
+		std::shared_ptr<StereoFilter> mFilter;
+		std::vector<std::shared_ptr<Effect>> mEffects;
+	};
+
+private:
+	std::vector<Step> mSteps;
+	// Level l is mSteps[mLevels[l], mLevels[l + 1])
+	std::vector<int> mLevels;
+	std::vector<Input> mInputs;
+	// mSlots buffers of a left and a right mFrames
+	std::vector<float> mBuffers;
+	int mSlots;
+	int mFrames;
+	int mOutputSlot;
+	int mSources;
+	// Source index per channel, -1 for channels nothing plays
+	int mChannelSource[GRAPH_CHANNELS];
+
+	float* left(int aSlot) {
+		return &mBuffers[(size_t)aSlot * 2 * mFrames];
+	}
+
+	float* right(int aSlot) {
+		return &mBuffers[(size_t)aSlot * 2 * mFrames + mFrames];
+	}
+
+	// Worth handing to another thread: a source that has voices to render, or a bus with effects
+	bool heavy(const Step& aStep, const int* aSourceVoices) const {
+		return (aStep.mType == GRAPH_SOURCE) ? aSourceVoices[aStep.mSource] > 0 : !aStep.mEffects.empty();
+	}
+
+	template<class F>
+	void runStep(const Step& aStep, bool aStereo, int aFrames, bool aThreaded, F& aRenderSource) {
+		float* outLeft = left(aStep.mSlot);
+		float* outRight = aStereo ? right(aStep.mSlot) : nullptr;
+		const int sides = aStereo ? 2 : 1;
+
+		if (aStep.mType == GRAPH_SOURCE) {
+			for (int side = 0; side < sides; side++) {
+				float* out = (side == 0) ? outLeft : outRight;
+				std::fill(out, out + aFrames, 0.0f);
+			}
+			aRenderSource(aStep.mSource, outLeft, outRight, aFrames, aThreaded);
+			return;
+		}
+
+		// The first input is copied rather than added to silence, so a plain chain is exact
+		for (int side = 0; side < sides; side++) {
+			float* out = (side == 0) ? outLeft : outRight;
+			if (aStep.mInputCount == 0) {
+				std::fill(out, out + aFrames, 0.0f);
+			}
+			for (int k = 0; k < aStep.mInputCount; k++) {
+				const Input& input = mInputs[aStep.mFirstInput + k];
+				const float* in = (side == 0) ? left(input.mSlot) : right(input.mSlot);
+				const float gain = input.mGain;
+				if (k == 0 && gain == 1.0f) {
+					std::copy(in, in + aFrames, out);
+				} else if (k == 0) {
+					for (int i = 0; i < aFrames; i++) {
+						out[i] = in[i] * gain;
+					}
+				} else {
+					for (int i = 0; i < aFrames; i++) {
+						out[i] += in[i] * gain;
+					}
+				}
+			}
+			if (aStep.mGain != 1.0f) {
+				for (int i = 0; i < aFrames; i++) {
+					out[i] *= aStep.mGain;
+				}
+			}
+		}
+		if (aStep.mFilter && aStep.mFilter->enabled()) {
+			aStep.mFilter->process(outLeft, outRight, aFrames);
+		}
+		for (const std::shared_ptr<Effect>& effect : aStep.mEffects) {
+			effect->process(outLeft, outRight, aFrames);
+		}
+	}
+
+public:
+	GraphPlan() {
+		mSlots = 0;
+		mFrames = 0;
+		mOutputSlot = -1;
+		mSources = 0;
+		std::fill(mChannelSource, mChannelSource + GRAPH_CHANNELS, -1);
+	}
+
+	// Build the plan for aGraph processing up to aFrames at a time. False if the output isn't a
+	// bus, a send names a node that doesn't exist, the buses feed back into themselves or the
+	// output hears more than GRAPH_CHANNELS sources
+	bool compile(const AudioGraph& aGraph, int aFrames) {
+		const int nodes = aGraph.size();
+		if (!aGraph.valid(aGraph.output()) || aGraph.node(aGraph.output()).mType != GRAPH_BUS) {
+			return false;
+		}
+		for (int i = 0; i < nodes; i++) {
+			for (const GraphSend& send : aGraph.node(i).mInputs) {
+				if (!aGraph.valid(send.mFrom)) {
+					return false;
+				}
+			}
+		}
+
+		// Nodes the output hears, walking back from it
+		std::vector<char> needed(nodes, 0);
+		std::vector<int> stack(1, aGraph.output());
+		needed[aGraph.output()] = 1;
+		while (!stack.empty()) {
+			const GraphNode& node = aGraph.node(stack.back());
+			stack.pop_back();
+			if (node.mType != GRAPH_BUS) {
+				continue;
+			}
+			for (const GraphSend& send : node.mInputs) {
+				if (!needed[send.mFrom]) {
+					needed[send.mFrom] = 1;
+					stack.push_back(send.mFrom);
+				}
+			}
+		}
+
+		// Level of a node is one more than its deepest input, found by repeated relaxation.
+		// A level can't reach the node count unless there is a cycle
+		std::vector<int> level(nodes, 0);
+		for (bool changed = true; changed;) {
+			changed = false;
+			for (int i = 0; i < nodes; i++) {
+				if (!needed[i] || aGraph.node(i).mType != GRAPH_BUS) {
+					continue;
+				}
+				for (const GraphSend& send : aGraph.node(i).mInputs) {
+					if (level[send.mFrom] + 1 > level[i]) {
+						level[i] = level[send.mFrom] + 1;
+						if (level[i] >= nodes) {
+							return false;
+						}
+						changed = true;
+					}
+				}
+			}
+		}
+
+		// Steps ordered by level, then by node
+		std::vector<int> order;
+		for (int i = 0; i < nodes; i++) {
+			if (needed[i]) {
+				order.push_back(i);
+			}
+		}
+		std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return level[a] < level[b]; });
+		const int levels = level[order.back()] + 1;
+		int sources = 0;
+		for (int i : order) {
+			sources += (aGraph.node(i).mType == GRAPH_SOURCE) ? 1 : 0;
+		}
+		if (sources > GRAPH_CHANNELS) {
+			return false;
+		}
+
+		// Last level each node is read in, the output is read after everything
+		std::vector<int> lastRead(nodes, -1);
+		for (int i : order) {
+			for (const GraphSend& send : aGraph.node(i).mInputs) {
+				if (aGraph.node(i).mType == GRAPH_BUS) {
+					lastRead[send.mFrom] = std::max(lastRead[send.mFrom], level[i]);
+				}
+			}
+		}
+		lastRead[aGraph.output()] = levels;
+
+		mSteps.clear();
+		mInputs.clear();
+		mLevels.assign(1, 0);
+		mSources = 0;
+		std::fill(mChannelSource, mChannelSource + GRAPH_CHANNELS, -1);
+		std::vector<int> slotOf(nodes, -1);
+		std::vector<int> freeSlots;
+		mSlots = 0;
+		uint32_t taken = 0;
+		int catchAll = -1;
+
+		size_t next = 0;
+		for (int l = 0; l < levels; l++) {
+			// Buffers nothing from this level on reads
+			for (int i : order) {
+				if (slotOf[i] >= 0 && lastRead[i] == l - 1) {
+					freeSlots.push_back(slotOf[i]);
+				}
+			}
+			for (; next < order.size() && level[order[next]] == l; next++) {
+				const int i = order[next];
+				const GraphNode& node = aGraph.node(i);
+				Step step;
+				step.mType = node.mType;
+				step.mNode = i;
+				step.mSource = -1;
+				step.mGain = node.mGain;
+				step.mFirstInput = (int)mInputs.size();
+				step.mInputCount = 0;
+				if (freeSlots.empty()) {
+					slotOf[i] = mSlots++;
+				} else {
+					slotOf[i] = freeSlots.back();
+					freeSlots.pop_back();
+				}
+				step.mSlot = slotOf[i];
+
+				if (node.mType == GRAPH_SOURCE) {
+					step.mSource = mSources++;
+					const uint32_t channels = node.mChannels & ~taken;
+					for (int c = 0; c < GRAPH_CHANNELS; c++) {
+						if (channels & (1u << c)) {
+							mChannelSource[c] = step.mSource;
+						}
+					}
+					taken |= channels;
+					if (node.mChannels == 0 && catchAll < 0) {
+						catchAll = step.mSource;
+					}
+				} else {
+					for (const GraphSend& send : node.mInputs) {
+						mInputs.push_back({ slotOf[send.mFrom], send.mGain });
+					}
+					step.mInputCount = (int)node.mInputs.size();
+					step.mFilter = node.mFilter;
+					step.mEffects = node.mEffects;
+				}
+				mSteps.push_back(step);
+			}
+			mLevels.push_back((int)mSteps.size());
+		}
+		if (catchAll >= 0) {
+			for (int c = 0; c < GRAPH_CHANNELS; c++) {
+				if (!(taken & (1u << c))) {
+					mChannelSource[c] = catchAll;
+				}
+			}
+		}
+
+		mFrames = aFrames;
+		mOutputSlot = slotOf[aGraph.output()];
+		mBuffers.assign((size_t)mSlots * 2 * aFrames, 0.0f);
+		return true;
+	}
+
+	// Source playing aChannel, -1 if its notes aren't heard
+	int sourceFor(int aChannel) const {
+		return (aChannel >= 0 && aChannel < GRAPH_CHANNELS) ? mChannelSource[aChannel] : -1;
+	}
+
+	int sources() const {
+		return mSources;
+	}
+
+	int steps() const {
+		return (int)mSteps.size();
+	}
+
+	int levels() const {
+		return (int)mLevels.size() - 1;
+	}
+
+	// Buffers the plan needs, fewer than steps() when lifetimes don't overlap
+	int slots() const {
+		return mSlots;
+	}
+
+	// Run every step over aFrames (up to the compiled frame count). aRenderSource(source, left,
+	// right, frames, threaded) adds the source's voices into zeroed buffers, right null for mono,
+	// and may use aThreads itself when threaded is set. A level with more than one step that has
+	// work in it runs its steps on aThreads, a step alone keeps the pool for its voices.
+	// aSourceVoices[s] is how many voices source s has. Returns the output's left buffer, the
+	// right one follows it at frames().
+	template<class F>
+	float* process(int aFrames, bool aStereo, ThreadPool* aThreads, const int* aSourceVoices, F& aRenderSource) {
+		for (int l = 0; l + 1 < (int)mLevels.size(); l++) {
+			const int first = mLevels[l];
+			const int count = mLevels[l + 1] - first;
+			int heavySteps = 0;
+			for (int s = first; s < first + count; s++) {
+				heavySteps += heavy(mSteps[s], aSourceVoices) ? 1 : 0;
+			}
+
+			if (aThreads != nullptr && heavySteps > 1) {
+				auto task = [&](int aStep) {
+					runStep(mSteps[first + aStep], aStereo, aFrames, false, aRenderSource);
+				};
+				aThreads->parallelFor(count, task);
+			} else {
+				for (int s = first; s < first + count; s++) {
+					runStep(mSteps[s], aStereo, aFrames, heavySteps <= 1, aRenderSource);
+				}
+			}
+		}
+		return left(mOutputSlot);
+	}
+
+	int frames() const {
+		return mFrames;
+	}
+};
+
+#endif
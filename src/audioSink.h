@@ -0,0 +1,171 @@
+#ifndef AUDIOSINK_H
+#define AUDIOSINK_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "wavWriter.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// Somewhere rendered audio goes. A BlockScheduler opens the sink, then hands it one block of
+// interleaved float frames at a time.
+class AudioSink {
+public:
+	virtual ~AudioSink() {}
+
+	virtual bool open(unsigned int aSampleRate, unsigned int aChannels, unsigned int aBlockFrames) = 0;
+	// Take aFrames interleaved frames, returns false if the sink can't take any more
+	virtual bool write(const float* aSamples, int aFrames) = 0;
+	virtual void close() = 0;
+
+	// True if write() waits for the device, so blocks are paced at the sample rate.
+	// Other sinks take blocks as fast as they can be rendered.
+	virtual bool realtime() const {
+		return false;
+	}
+
+	// Times the device ran out of audio so far, realtime sinks only
+	virtual long long underruns() const {
+		return 0;
+	}
+
+	virtual const char* name() const = 0;
+};
+
+// Throws the audio away, for benchmarking the engine on its own
+class NullSink : public AudioSink {
+private:
+	long long mFrames;
+
+public:
+	NullSink() {
+		mFrames = 0;
+	}
+
+	bool open(unsigned int aSampleRate, unsigned int aChannels, unsigned int aBlockFrames) {
+		(void)aSampleRate;
+		(void)aChannels;
+		(void)aBlockFrames;
+		mFrames = 0;
+		return true;
+	}
+
+	bool write(const float* aSamples, int aFrames) {
+		(void)aSamples;
+		mFrames += aFrames;
+		return true;
+	}
+
+	void close() {}
+
+	long long frames() const {
+		return mFrames;
+	}
+
+	const char* name() const {
+		return "null";
+	}
+};
+
+// Bounces to a wav file
+class WavSink : public AudioSink {
+private:
+	std::string mPath;
+	WavFormat mFormat;
+	bool mDither;
+	unsigned int mChannels;
+	WavWriter mWriter;
+
+public:
+	WavSink(const std::string& aPath, WavFormat aFormat = WAV_PCM16, bool aDither = false) : mPath(aPath) {
+		mFormat = aFormat;
+		mDither = aDither;
+		mChannels = 1;
+	}
+
+	bool open(unsigned int aSampleRate, unsigned int aChannels, unsigned int aBlockFrames) {
+		(void)aBlockFrames;
+		mChannels = aChannels;
+		return mWriter.open(mPath, aSampleRate, aChannels, mFormat, mDither);
+	}
+
+	bool write(const float* aSamples, int aFrames) {
+		mWriter.write(aSamples, (size_t)aFrames * mChannels);
+		return true;
+	}
+
+	void close() {
+		mWriter.close();
+	}
+
+	const char* name() const {
+		return "wav";
+	}
+};
+
+// Headerless little endian PCM to stdout ("-") or a file or named pipe, for streaming into
+// other tools, e.g. main --render song.txt - | aplay -f S16_LE -r 44100 (S24_3LE, S32_LE or
+// FLOAT_LE for the other formats)
+class RawSink : public AudioSink {
+private:
+	std::string mPath;
+	SampleConverter mConverter;
+	unsigned int mChannels;
+	FILE* mFile;
+	std::vector<char> mScratch;
+
+public:
+	RawSink(const std::string& aPath, WavFormat aFormat = WAV_PCM16, bool aDither = false)
+		: mPath(aPath), mConverter(aFormat, aDither) {
+		mChannels = 1;
+		mFile = nullptr;
+	}
+
+	~RawSink() {
+		close();
+	}
+
+	bool open(unsigned int aSampleRate, unsigned int aChannels, unsigned int aBlockFrames) {
+		(void)aSampleRate;
+		(void)aBlockFrames;
+		close();
+		mChannels = aChannels;
+		if (mPath == "-") {
+#ifdef _WIN32
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			mFile = stdout;
+		} else {
+			mFile = std::fopen(mPath.c_str(), "wb");
+		}
+		return mFile != nullptr;
+	}
+
+	bool write(const float* aSamples, int aFrames) {
+		if (mFile == nullptr) {
+			return false;
+		}
+		mConverter.convert(aSamples, (size_t)aFrames * mChannels, mScratch);
+		// Flush every block so whatever reads the stream doesn't wait on our buffering
+		bool ok = std::fwrite(mScratch.data(), 1, mScratch.size(), mFile) == mScratch.size();
+		return (std::fflush(mFile) == 0) && ok;
+	}
+
+	void close() {
+		if (mFile != nullptr && mFile != stdout) {
+			std::fclose(mFile);
+		}
+		mFile = nullptr;
+	}
+
+	const char* name() const {
+		return "raw";
+	}
+};
+
+#endif
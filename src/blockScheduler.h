@@ -0,0 +1,157 @@
+#ifndef BLOCKSCHEDULER_H
+#define BLOCKSCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "audioSink.h"
+#include "blockTime.h"
+#include "deadlineMonitor.h"
+
+// Fills nFrames interleaved frames of nChannels starting at aTime
+typedef std::function<void(float*, int, int, const BlockTime&)> BlockFunction;
+
+// The block loop every sink shares: keeps the frame clock, asks the block function for the next
+// block and hands it to the sink. Realtime sinks pace the loop by blocking in write(), the
+// others run it as fast as the block function allows. With a DeadlineMonitor set every block
+// function call is timed against the length of audio it renders.
+class BlockScheduler {
+private:
+	AudioSink& mSink;
+	BlockFunction mBlockFunction;
+	unsigned int mSampleRate;
+	unsigned int mChannels;
+	unsigned int mBlockFrames;
+	std::vector<float> mBlock;
+	DeadlineMonitor* mMonitor;
+
+	std::atomic<long long> mFrame;
+	std::atomic<bool> mRunning;
+	std::thread mThread;
+
+	void loop() {
+		while (mRunning.load(std::memory_order_relaxed)) {
+			if (!step(mBlockFrames)) {
+				break;
+			}
+		}
+		mRunning = false;
+	}
+
+public:
+	BlockScheduler(AudioSink& aSink, unsigned int aSampleRate = 44100, unsigned int aChannels = 1, unsigned int aBlockFrames = 512)
+		: mSink(aSink), mBlock((size_t)aBlockFrames * aChannels, 0.0f) {
+		mSampleRate = aSampleRate;
+		mChannels = aChannels;
+		mBlockFrames = aBlockFrames;
+		mFrame = 0;
+		mRunning = false;
+		mMonitor = nullptr;
+	}
+
+	~BlockScheduler() {
+		stop();
+	}
+
+	// Set before starting, the scheduler's thread calls it from then on
+	void setBlockFunction(BlockFunction aFunction) {
+		mBlockFunction = aFunction;
+	}
+
+	// Record block timings and sink underruns into aMonitor, set before starting
+	void setMonitor(DeadlineMonitor* aMonitor) {
+		mMonitor = aMonitor;
+	}
+
+	// Render and write the next aFrames (at most one block), false if the sink failed
+	bool step(int aFrames) {
+		aFrames = std::min(aFrames, (int)mBlockFrames);
+
+		BlockTime time;
+		time.mFrame = mFrame.load(std::memory_order_relaxed);
+		time.mTimeStep = 1.0 / (double)mSampleRate;
+		time.mTime = (double)time.mFrame * time.mTimeStep;
+		time.mSampleRate = mSampleRate;
+
+		auto renderStart = std::chrono::steady_clock::now();
+		if (mBlockFunction) {
+			mBlockFunction(mBlock.data(), aFrames, mChannels, time);
+		} else {
+			std::fill(mBlock.begin(), mBlock.begin() + (size_t)aFrames * mChannels, 0.0f);
+		}
+		if (mMonitor != nullptr) {
+			double renderNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - renderStart).count();
+			mMonitor->recordBlock(renderNs, aFrames * 1e9 / (double)mSampleRate);
+		}
+
+		bool ok = mSink.write(mBlock.data(), aFrames);
+		if (mMonitor != nullptr) {
+			mMonitor->recordUnderruns(mSink.underruns());
+		}
+		mFrame.store(time.mFrame + aFrames, std::memory_order_relaxed);
+		return ok;
+	}
+
+	// Open the sink and render aFrames on this thread, then close it
+	bool run(long long aFrames) {
+		if (!mSink.open(mSampleRate, mChannels, mBlockFrames)) {
+			return false;
+		}
+		bool ok = true;
+		for (long long done = 0; ok && done < aFrames; done += mBlockFrames) {
+			ok = step((int)std::min<long long>(mBlockFrames, aFrames - done));
+		}
+		mSink.close();
+		return ok;
+	}
+
+	// Open the sink and keep it fed from a thread of our own until stop()
+	bool start() {
+		if (mRunning || !mSink.open(mSampleRate, mChannels, mBlockFrames)) {
+			return false;
+		}
+		mRunning = true;
+		mThread = std::thread(&BlockScheduler::loop, this);
+		return true;
+	}
+
+	void stop() {
+		if (!mThread.joinable()) {
+			return;
+		}
+		mRunning = false;
+		mThread.join();
+		mSink.close();
+	}
+
+	bool running() const {
+		return mRunning.load(std::memory_order_relaxed);
+	}
+
+	// Time of the next block to be rendered
+	double time() const {
+		return (double)mFrame.load(std::memory_order_relaxed) / (double)mSampleRate;
+	}
+
+	long long frame() const {
+		return mFrame.load(std::memory_order_relaxed);
+	}
+
+	unsigned int sampleRate() const {
+		return mSampleRate;
+	}
+
+	unsigned int channels() const {
+		return mChannels;
+	}
+
+	unsigned int blockFrames() const {
+		return mBlockFrames;
+	}
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef BLOCKTIME_H
+#define BLOCKTIME_H
+
+// Timing of one block handed to a process callback
+struct BlockTime {
+	// Engine time of the first frame in seconds
+	double mTime;
+	// Seconds per frame
+	double mTimeStep;
+	// Index of the first frame since the stream started
+	long long mFrame;
+	unsigned int mSampleRate;
+
+	BlockTime() {
+		mTime = 0.0;
+		mTimeStep = 1.0 / 44100.0;
+		mFrame = 0;
+		mSampleRate = 44100;
+	}
+
+	// Time of frame aOffset within this block
+	double timeAt(int aOffset) const {
+		return mTime + (double)aOffset * mTimeStep;
+	}
+
+	// Timing of the sub block starting aOffset frames into this one
+	BlockTime offset(int aOffset) const {
+		BlockTime t = *this;
+		t.mTime = timeAt(aOffset);
+		t.mFrame = mFrame + aOffset;
+		return t;
+	}
+};
+
+#endif
@@ -0,0 +1,35 @@
+// Output conversion kernel, included by sampleConverter.h once per instruction set inside a
+// namespace that provides Ops (see simdOps.h). Don't include this anywhere else.
+
+// Scale aCount samples by aScale, add aDither (in output steps), clip to +-aScale and truncate
+// towards zero into aOut
+template<bool Dither>
+static void convertSamples(const float* aIn, const float* aDither, float aScale, int32_t* aOut, int aCount) {
+	const Ops::V high = Ops::set(aScale);
+	const Ops::V low = Ops::set(-aScale);
+	int i = 0;
+	for (; i + Ops::W <= aCount; i += Ops::W) {
+		Ops::V v = Ops::mul(Ops::loadu(aIn + i), high);
+		if (Dither) {
+			v = Ops::add(v, Ops::loadu(aDither + i));
+		}
+		Ops::storeInt(aOut + i, Ops::min(Ops::max(v, low), high));
+	}
+	// Tail with the scalar ops, which round the same way
+	for (; i < aCount; i++) {
+		float v = aIn[i] * aScale;
+		if (Dither) {
+			v += aDither[i];
+		}
+		SimdScalar::Ops::storeInt(aOut + i, SimdScalar::Ops::min(SimdScalar::Ops::max(v, -aScale), aScale));
+	}
+}
+
+// aDither may be null for no dither
+static void convertToInt(const float* aIn, const float* aDither, float aScale, int32_t* aOut, int aCount) {
+	if (aDither == nullptr) {
+		convertSamples<false>(aIn, aDither, aScale, aOut, aCount);
+	} else {
+		convertSamples<true>(aIn, aDither, aScale, aOut, aCount);
+	}
+}
@@ -0,0 +1,35 @@
+// Convolution kernels, included by convolver.h once per instruction set inside a namespace that
+// provides Ops (see simdOps.h). Don't include this anywhere else.
+
+// aSum[t] += sum over i of aTaps[i] * aIn[t - i] for t < aFrames, aIn must reach back aCount - 1
+// samples. Tap by tap, so every output sums its taps in the same order at every width.
+static void directFir(const float* aTaps, int aCount, const float* aIn, float* aSum, int aFrames) {
+	for (int i = 0; i < aCount; i++) {
+		const Ops::V h = Ops::set(aTaps[i]);
+		const float* x = aIn - i;
+		int t = 0;
+		for (; t + Ops::W <= aFrames; t += Ops::W) {
+			Ops::storeu(aSum + t, Ops::add(Ops::loadu(aSum + t), Ops::mul(h, Ops::loadu(x + t))));
+		}
+		for (; t < aFrames; t++) {
+			aSum[t] += aTaps[i] * x[t];
+		}
+	}
+}
+
+// aAcc += aX * aH over aBins complex values in split arrays
+static void multiplyAdd(const float* aXRe, const float* aXIm, const float* aHRe, const float* aHIm, float* aAccRe, float* aAccIm, int aBins) {
+	int k = 0;
+	for (; k + Ops::W <= aBins; k += Ops::W) {
+		const Ops::V xr = Ops::loadu(aXRe + k);
+		const Ops::V xi = Ops::loadu(aXIm + k);
+		const Ops::V hr = Ops::loadu(aHRe + k);
+		const Ops::V hi = Ops::loadu(aHIm + k);
+		Ops::storeu(aAccRe + k, Ops::add(Ops::loadu(aAccRe + k), Ops::sub(Ops::mul(xr, hr), Ops::mul(xi, hi))));
+		Ops::storeu(aAccIm + k, Ops::add(Ops::loadu(aAccIm + k), Ops::add(Ops::mul(xr, hi), Ops::mul(xi, hr))));
+	}
+	for (; k < aBins; k++) {
+		aAccRe[k] += aXRe[k] * aHRe[k] - aXIm[k] * aHIm[k];
+		aAccIm[k] += aXRe[k] * aHIm[k] + aXIm[k] * aHRe[k];
+	}
+}
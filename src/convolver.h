@@ -0,0 +1,332 @@
+#ifndef CONVOLVER_H
+#define CONVOLVER_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cpuFeatures.h"
+#include "simdOps.h"
+#include "fft.h"
+
+// Head partition (and direct FIR) length, and the tail partition length of PartitionedConvolver
+const int CONVOLVER_PARTITION = 128;
+const int CONVOLVER_TAIL_PARTITION = 1024;
+
+// Convolution kernels, one copy per instruction set
+namespace SimdScalar {
+#include "convolveKernel.inl"
+}
+#if defined(SYNTH_X86)
+namespace SimdSse2 {
+#include "convolveKernel.inl"
+}
+SYNTH_TARGET_AVX2_BEGIN
+namespace SimdAvx2 {
+#include "convolveKernel.inl"
+}
+SYNTH_TARGET_END
+SYNTH_TARGET_AVX512_BEGIN
+namespace SimdAvx512 {
+#include "convolveKernel.inl"
+}
+SYNTH_TARGET_END
+#endif
+
+struct ConvolveKernels {
+	void (*mDirectFir)(const float*, int, const float*, float*, int);
+	void (*mMultiplyAdd)(const float*, const float*, const float*, const float*, float*, float*, int);
+};
+
+inline ConvolveKernels convolveKernelsFor(SimdLevel aLevel) {
+	switch (aLevel) {
+#if defined(SYNTH_X86)
+	case SIMD_AVX512: return { SimdAvx512::directFir, SimdAvx512::multiplyAdd };
+	case SIMD_AVX2: return { SimdAvx2::directFir, SimdAvx2::multiplyAdd };
+	case SIMD_SSE2: return { SimdSse2::directFir, SimdSse2::multiplyAdd };
+#endif
+	default: return { SimdScalar::directFir, SimdScalar::multiplyAdd };
+	}
+}
+
+// Uniformly partitioned overlap-save convolution of whole blocks with one stretch of an impulse
+// response. Input spectra are kept in a frequency domain delay line, so each block costs one FFT,
+// one complex multiply-add per IR partition and one inverse FFT. Nothing allocates after setup().
+class UniformConvolver {
+private:
+	int mPartition;
+	int mPartitions;
+	int mBins;
+	RealFft mFft;
+	// IR partition spectra and the last mPartitions input spectra, mPartitions x mBins each
+	std::vector<float> mIrRe;
+	std::vector<float> mIrIm;
+	std::vector<float> mInputRe;
+	std::vector<float> mInputIm;
+	int mNewest;
+	// Previous and current input block, the sum of products and the inverse FFT
+	std::vector<float> mInput;
+	std::vector<float> mAccRe;
+	std::vector<float> mAccIm;
+	std::vector<float> mTime;
+	ConvolveKernels mKernels;
+
+public:
+	UniformConvolver() {
+		mKernels = convolveKernelsFor(CpuFeatures::detect());
+		mPartition = 0;
+		mPartitions = 0;
+		mBins = 0;
+		mNewest = 0;
+	}
+
+	// Convolve with aLength samples of aIr in partitions of aPartition (a power of two)
+	void setup(const float* aIr, int aLength, int aPartition) {
+		mPartition = aPartition;
+		mPartitions = std::max(0, (aLength + aPartition - 1) / aPartition);
+		mFft.setup(2 * aPartition);
+		mBins = mFft.bins();
+		mIrRe.assign((size_t)mPartitions * mBins, 0.0f);
+		mIrIm.assign((size_t)mPartitions * mBins, 0.0f);
+		mInputRe.assign((size_t)mPartitions * mBins, 0.0f);
+		mInputIm.assign((size_t)mPartitions * mBins, 0.0f);
+		mNewest = 0;
+		mInput.assign(2 * aPartition, 0.0f);
+		mAccRe.assign(mBins, 0.0f);
+		mAccIm.assign(mBins, 0.0f);
+		mTime.assign(2 * aPartition, 0.0f);
+
+		// Each partition zero padded to the FFT size
+		for (int p = 0; p < mPartitions; p++) {
+			std::fill(mTime.begin(), mTime.end(), 0.0f);
+			int n = std::min(aPartition, aLength - p * aPartition);
+			std::copy(aIr + (size_t)p * aPartition, aIr + (size_t)p * aPartition + n, mTime.begin());
+			mFft.forward(mTime.data(), &mIrRe[(size_t)p * mBins], &mIrIm[(size_t)p * mBins]);
+		}
+	}
+
+	int partitions() const {
+		return mPartitions;
+	}
+
+	// Take the next aPartition input samples and write the convolution over the same samples
+	void process(const float* aIn, float* aOut) {
+		const int size = mPartition;
+		std::copy(mInput.begin() + size, mInput.end(), mInput.begin());
+		std::copy(aIn, aIn + size, mInput.begin() + size);
+
+		mNewest = (mNewest + 1) % mPartitions;
+		mFft.forward(mInput.data(), &mInputRe[(size_t)mNewest * mBins], &mInputIm[(size_t)mNewest * mBins]);
+
+		// IR partition p meets the input from p blocks ago
+		std::fill(mAccRe.begin(), mAccRe.end(), 0.0f);
+		std::fill(mAccIm.begin(), mAccIm.end(), 0.0f);
+		float* accRe = mAccRe.data();
+		float* accIm = mAccIm.data();
+		for (int p = 0; p < mPartitions; p++) {
+			const size_t slot = (size_t)((mNewest - p + mPartitions) % mPartitions) * mBins;
+			mKernels.mMultiplyAdd(&mInputRe[slot], &mInputIm[slot], &mIrRe[(size_t)p * mBins], &mIrIm[(size_t)p * mBins], accRe, accIm, mBins);
+		}
+
+		// Overlap-save: the second half is the part that didn't wrap round
+		mFft.inverse(accRe, accIm, mTime.data());
+		std::copy(mTime.begin() + size, mTime.end(), aOut);
+	}
+};
+
+// Zero latency convolution with a long impulse response, in three parts:
+//   IR [0, P)          direct FIR on the audio thread, so output needs no whole block of input
+//   IR [P, 2T)         UniformConvolver of P sample partitions, run as each P of input completes
+//   IR [2T, end)       UniformConvolver of T sample partitions on a worker thread
+// with P = CONVOLVER_PARTITION and T = CONVOLVER_TAIL_PARTITION. A tail segment of input is
+// handed over once complete and its output isn't due until a whole segment later, so the worker
+// has T samples of time to do it. process() takes any number of frames. The audio thread only
+// waits if the worker falls that far behind, which also keeps offline renders exact.
+class PartitionedConvolver {
+private:
+	std::vector<float> mDirect;
+	ConvolveKernels mKernels;
+	// Previous and current head partition of input
+	std::vector<float> mHistory;
+	int mPosition;
+
+	UniformConvolver mHead;
+	bool mHasHead;
+	// Head output for the current partition
+	std::vector<float> mHeadOut;
+
+	UniformConvolver mTail;
+	bool mHasTail;
+	// Input and output segments, double buffered between us and the worker
+	std::vector<float> mTailIn[2];
+	std::vector<float> mTailOut[2];
+	long long mSegment;
+	int mSegmentPosition;
+
+	std::thread mWorker;
+	std::mutex mMutex;
+	std::condition_variable mPostedCondition;
+	std::condition_variable mDoneCondition;
+	long long mPosted;
+	long long mDone;
+	bool mQuit;
+
+	void workerLoop() {
+		for (long long job = 0;; job++) {
+			{
+				std::unique_lock<std::mutex> lock(mMutex);
+				mPostedCondition.wait(lock, [&] { return mQuit || mPosted > job; });
+				if (mQuit) {
+					return;
+				}
+			}
+			mTail.process(mTailIn[job % 2].data(), mTailOut[job % 2].data());
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mDone = job + 1;
+			}
+			mDoneCondition.notify_one();
+		}
+	}
+
+	void stopWorker() {
+		if (mWorker.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mQuit = true;
+			}
+			mPostedCondition.notify_one();
+			mWorker.join();
+		}
+	}
+
+	// Segment mSegment starts, it plays the output of the job from two segments back
+	void beginSegment() {
+		if (mSegment >= 2) {
+			std::unique_lock<std::mutex> lock(mMutex);
+			mDoneCondition.wait(lock, [&] { return mDone >= mSegment - 1; });
+		}
+	}
+
+	// A head partition of input is complete
+	void endPartition() {
+		const float* current = mHistory.data() + CONVOLVER_PARTITION;
+		if (mHasHead) {
+			mHead.process(current, mHeadOut.data());
+		}
+		if (mHasTail) {
+			std::copy(current, current + CONVOLVER_PARTITION, mTailIn[mSegment % 2].begin() + (mSegmentPosition - CONVOLVER_PARTITION));
+			if (mSegmentPosition == CONVOLVER_TAIL_PARTITION) {
+				{
+					std::lock_guard<std::mutex> lock(mMutex);
+					mPosted = mSegment + 1;
+				}
+				mPostedCondition.notify_one();
+				mSegment++;
+				mSegmentPosition = 0;
+			}
+		}
+		std::copy(mHistory.begin() + CONVOLVER_PARTITION, mHistory.end(), mHistory.begin());
+		mPosition = 0;
+	}
+
+public:
+	PartitionedConvolver() {
+		mKernels = convolveKernelsFor(CpuFeatures::detect());
+		mPosition = 0;
+		mHasHead = false;
+		mHasTail = false;
+		mSegment = 0;
+		mSegmentPosition = 0;
+		mPosted = 0;
+		mDone = 0;
+		mQuit = false;
+		setup(nullptr, 0);
+	}
+
+	~PartitionedConvolver() {
+		stopWorker();
+	}
+
+	PartitionedConvolver(const PartitionedConvolver&) = delete;
+	PartitionedConvolver& operator=(const PartitionedConvolver&) = delete;
+
+	// Allocates and restarts the worker, so only while nothing is processing
+	void setup(const float* aIr, int aLength) {
+		static_assert(CONVOLVER_TAIL_PARTITION % CONVOLVER_PARTITION == 0, "Tail segments are whole head partitions");
+		const int P = CONVOLVER_PARTITION;
+		const int T = CONVOLVER_TAIL_PARTITION;
+		stopWorker();
+
+		aLength = std::max(0, aLength);
+		mDirect.assign(P, 0.0f);
+		std::copy(aIr, aIr + std::min(aLength, P), mDirect.begin());
+		mHistory.assign(2 * P, 0.0f);
+		mPosition = 0;
+
+		mHasHead = aLength > P;
+		if (mHasHead) {
+			mHead.setup(aIr + P, std::min(aLength, 2 * T) - P, P);
+		}
+		mHeadOut.assign(P, 0.0f);
+
+		mHasTail = aLength > 2 * T;
+		if (mHasTail) {
+			mTail.setup(aIr + 2 * T, aLength - 2 * T, T);
+		}
+		for (int i = 0; i < 2; i++) {
+			mTailIn[i].assign(mHasTail ? T : 0, 0.0f);
+			mTailOut[i].assign(mHasTail ? T : 0, 0.0f);
+		}
+		mSegment = 0;
+		mSegmentPosition = 0;
+		mPosted = 0;
+		mDone = 0;
+		mQuit = false;
+		if (mHasTail) {
+			mWorker = std::thread(&PartitionedConvolver::workerLoop, this);
+		}
+	}
+
+	// Samples of delay before the first output, always none
+	int latency() const {
+		return 0;
+	}
+
+	// Write aFrames of the convolution of the input so far with the IR to aOut
+	void process(const float* aIn, float* aOut, int aFrames) {
+		const int P = CONVOLVER_PARTITION;
+		for (int done = 0; done < aFrames;) {
+			if (mHasTail && mPosition == 0 && mSegmentPosition == 0) {
+				beginSegment();
+			}
+			const int n = std::min(aFrames - done, P - mPosition);
+			float* current = mHistory.data() + P;
+			std::copy(aIn + done, aIn + done + n, current + mPosition);
+
+			float sum[CONVOLVER_PARTITION];
+			std::copy(mHeadOut.begin() + mPosition, mHeadOut.begin() + mPosition + n, sum);
+			if (mHasTail) {
+				const float* tail = mTailOut[mSegment % 2].data() + mSegmentPosition;
+				for (int t = 0; t < n; t++) {
+					sum[t] += tail[t];
+				}
+			}
+			mKernels.mDirectFir(mDirect.data(), P, current + mPosition, sum, n);
+			std::copy(sum, sum + n, aOut + done);
+
+			mPosition += n;
+			if (mHasTail) {
+				mSegmentPosition += n;
+			}
+			done += n;
+			if (mPosition == P) {
+				endPartition();
+			}
+		}
+	}
+};
+
+#endif
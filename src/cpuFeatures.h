@@ -0,0 +1,89 @@
+#ifndef CPUFEATURES_H
+#define CPUFEATURES_H
+
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SYNTH_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// Instruction sets the SIMD kernels are built for, in increasing order of width
+enum SimdLevel {
+	SIMD_SCALAR = 0,
+	SIMD_SSE2,
+	SIMD_AVX2,
+	SIMD_AVX512,
+};
+
+namespace CpuFeatures {
+	// Widest instruction set both the CPU and the OS support
+	SimdLevel detect() {
+#if defined(SYNTH_X86)
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		int maxLeaf = info[0];
+
+		__cpuid(info, 1);
+		bool sse2 = (info[3] & (1 << 26)) != 0;
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+		if (!sse2) {
+			return SIMD_SCALAR;
+		}
+		if (!osxsave || !avx || maxLeaf < 7) {
+			return SIMD_SSE2;
+		}
+
+		// The OS has to save YMM (and ZMM/opmask) state on context switches
+		unsigned long long xcr0 = _xgetbv(0);
+		__cpuidex(info, 7, 0);
+		bool avx2 = (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+		bool avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+		if (avx2 && avx512) {
+			return SIMD_AVX512;
+		}
+		return avx2 ? SIMD_AVX2 : SIMD_SSE2;
+#else
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2")) {
+			return SIMD_AVX512;
+		}
+		if (__builtin_cpu_supports("avx2")) {
+			return SIMD_AVX2;
+		}
+		if (__builtin_cpu_supports("sse2")) {
+			return SIMD_SSE2;
+		}
+		return SIMD_SCALAR;
+#endif
+#else
+		return SIMD_SCALAR;
+#endif
+	}
+
+	const char* name(SimdLevel aLevel) {
+		switch (aLevel) {
+		case SIMD_SSE2: return "sse2";
+		case SIMD_AVX2: return "avx2";
+		case SIMD_AVX512: return "avx512";
+		case SIMD_SCALAR: default: return "scalar";
+		}
+	}
+
+	// Parse a name from name(), returns false if it isn't one
+	bool parse(const char* aName, SimdLevel& aLevel) {
+		for (int i = SIMD_SCALAR; i <= SIMD_AVX512; i++) {
+			if (std::strcmp(aName, name((SimdLevel)i)) == 0) {
+				aLevel = (SimdLevel)i;
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+#endif
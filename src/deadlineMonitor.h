@@ -0,0 +1,241 @@
+#ifndef DEADLINEMONITOR_H
+#define DEADLINEMONITOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+// Render time buckets: everything under 1us, then 8 per octave from 1us up to about 1s
+const int DEADLINE_BUCKETS_PER_OCTAVE = 8;
+const int DEADLINE_BUCKETS = 1 + 20 * DEADLINE_BUCKETS_PER_OCTAVE;
+
+// Copy of the monitor's counters at one moment, times in nanoseconds
+struct DeadlineSnapshot {
+	long long mBlocks;
+	// Blocks whose render took longer than the audio they produced
+	long long mMissed;
+	// Times the device ran out of audio, as reported by the sink
+	long long mUnderruns;
+	double mMinNs;
+	double mMeanNs;
+	double mP99Ns;
+	double mMaxNs;
+	// Render time over budget, of the most recent and of the worst block
+	double mLoad;
+	double mMaxLoad;
+	int mVoices;
+	int mPeakVoices;
+
+	DeadlineSnapshot() {
+		mBlocks = 0;
+		mMissed = 0;
+		mUnderruns = 0;
+		mMinNs = 0.0;
+		mMeanNs = 0.0;
+		mP99Ns = 0.0;
+		mMaxNs = 0.0;
+		mLoad = 0.0;
+		mMaxLoad = 0.0;
+		mVoices = 0;
+		mPeakVoices = 0;
+	}
+
+	void print(std::ostream& aOut) const {
+		aOut << "Blocks: " << mBlocks << ", missed deadlines: " << mMissed << ", underruns: " << mUnderruns << std::endl;
+		aOut << "Render us min/mean/p99/max: " << mMinNs / 1000.0 << " / " << mMeanNs / 1000.0 << " / "
+			<< mP99Ns / 1000.0 << " / " << mMaxNs / 1000.0 << std::endl;
+		aOut << "Load: " << mLoad * 100.0 << "% (worst " << mMaxLoad * 100.0 << "%), voices: " << mVoices
+			<< " (peak " << mPeakVoices << ")" << std::endl;
+	}
+
+	void json(std::ostream& aOut) const {
+		aOut << "{\"blocks\": " << mBlocks << ", \"missed\": " << mMissed << ", \"underruns\": " << mUnderruns
+			<< ", \"min_ns\": " << mMinNs << ", \"mean_ns\": " << mMeanNs << ", \"p99_ns\": " << mP99Ns
+			<< ", \"max_ns\": " << mMaxNs << ", \"load\": " << mLoad << ", \"max_load\": " << mMaxLoad
+			<< ", \"voices\": " << mVoices << ", \"peak_voices\": " << mPeakVoices << "}";
+	}
+};
+
+// Per block render timing against the realtime budget. One audio thread records, any thread can
+// take a snapshot. Everything is a relaxed atomic, so recording never blocks and a snapshot may
+// mix counters from neighbouring blocks.
+class DeadlineMonitor {
+private:
+	std::atomic<uint32_t> mHistogram[DEADLINE_BUCKETS];
+	std::atomic<long long> mBlocks;
+	std::atomic<long long> mMissed;
+	std::atomic<long long> mUnderruns;
+	std::atomic<double> mTotalNs;
+	std::atomic<double> mMinNs;
+	std::atomic<double> mMaxNs;
+	std::atomic<double> mLoad;
+	std::atomic<double> mMaxLoad;
+	std::atomic<int> mVoices;
+	std::atomic<int> mPeakVoices;
+
+	static int bucket(double aNs) {
+		if (aNs < 1000.0) {
+			return 0;
+		}
+		int octave;
+		double mantissa = std::frexp(aNs / 1000.0, &octave);
+		// aNs / 1000 = mantissa * 2^octave with mantissa in 0.5..1
+		int sub = (int)((mantissa * 2.0 - 1.0) * DEADLINE_BUCKETS_PER_OCTAVE);
+		return std::min(DEADLINE_BUCKETS - 1, 1 + (octave - 1) * DEADLINE_BUCKETS_PER_OCTAVE + sub);
+	}
+
+	// Top edge of a bucket in ns
+	static double bucketLimit(int aBucket) {
+		if (aBucket == 0) {
+			return 1000.0;
+		}
+		int octave = (aBucket - 1) / DEADLINE_BUCKETS_PER_OCTAVE;
+		int sub = (aBucket - 1) % DEADLINE_BUCKETS_PER_OCTAVE;
+		return 1000.0 * std::ldexp(1.0 + (sub + 1) / (double)DEADLINE_BUCKETS_PER_OCTAVE, octave);
+	}
+
+	// Single writer, so a load and store is enough and cheaper than a read-modify-write
+	template<class T>
+	static void add(std::atomic<T>& aValue, T aAmount) {
+		aValue.store(aValue.load(std::memory_order_relaxed) + aAmount, std::memory_order_relaxed);
+	}
+
+public:
+	DeadlineMonitor() {
+		reset();
+	}
+
+	void reset() {
+		for (int i = 0; i < DEADLINE_BUCKETS; i++) {
+			mHistogram[i].store(0, std::memory_order_relaxed);
+		}
+		mBlocks = 0;
+		mMissed = 0;
+		mUnderruns = 0;
+		mTotalNs = 0.0;
+		mMinNs = 0.0;
+		mMaxNs = 0.0;
+		mLoad = 0.0;
+		mMaxLoad = 0.0;
+		mVoices = 0;
+		mPeakVoices = 0;
+	}
+
+	// Audio thread: a block took aRenderNs to render aBudgetNs of audio
+	void recordBlock(double aRenderNs, double aBudgetNs) {
+		long long blocks = mBlocks.load(std::memory_order_relaxed);
+		add(mHistogram[bucket(aRenderNs)], (uint32_t)1);
+		add(mTotalNs, aRenderNs);
+		if (blocks == 0 || aRenderNs < mMinNs.load(std::memory_order_relaxed)) {
+			mMinNs.store(aRenderNs, std::memory_order_relaxed);
+		}
+		if (aRenderNs > mMaxNs.load(std::memory_order_relaxed)) {
+			mMaxNs.store(aRenderNs, std::memory_order_relaxed);
+		}
+
+		double load = (aBudgetNs > 0.0) ? aRenderNs / aBudgetNs : 0.0;
+		mLoad.store(load, std::memory_order_relaxed);
+		if (load > mMaxLoad.load(std::memory_order_relaxed)) {
+			mMaxLoad.store(load, std::memory_order_relaxed);
+		}
+		if (load > 1.0) {
+			add(mMissed, 1LL);
+		}
+		mBlocks.store(blocks + 1, std::memory_order_release);
+	}
+
+	// Audio thread: the sink's running underrun count
+	void recordUnderruns(long long aUnderruns) {
+		mUnderruns.store(aUnderruns, std::memory_order_relaxed);
+	}
+
+	// Audio thread: voices playing after a block
+	void recordVoices(int aVoices) {
+		mVoices.store(aVoices, std::memory_order_relaxed);
+		if (aVoices > mPeakVoices.load(std::memory_order_relaxed)) {
+			mPeakVoices.store(aVoices, std::memory_order_relaxed);
+		}
+	}
+
+	DeadlineSnapshot snapshot() const {
+		DeadlineSnapshot s;
+		s.mBlocks = mBlocks.load(std::memory_order_acquire);
+		s.mMissed = mMissed.load(std::memory_order_relaxed);
+		s.mUnderruns = mUnderruns.load(std::memory_order_relaxed);
+		s.mMinNs = mMinNs.load(std::memory_order_relaxed);
+		s.mMaxNs = mMaxNs.load(std::memory_order_relaxed);
+		s.mMeanNs = (s.mBlocks > 0) ? mTotalNs.load(std::memory_order_relaxed) / (double)s.mBlocks : 0.0;
+		s.mLoad = mLoad.load(std::memory_order_relaxed);
+		s.mMaxLoad = mMaxLoad.load(std::memory_order_relaxed);
+		s.mVoices = mVoices.load(std::memory_order_relaxed);
+		s.mPeakVoices = mPeakVoices.load(std::memory_order_relaxed);
+
+		// p99 as the top of the bucket the 99th percentile block falls in, capped by the max
+		long long counted = 0;
+		for (int i = 0; i < DEADLINE_BUCKETS; i++) {
+			counted += mHistogram[i].load(std::memory_order_relaxed);
+			if (counted * 100 >= s.mBlocks * 99 && counted > 0) {
+				s.mP99Ns = std::min(bucketLimit(i), s.mMaxNs);
+				break;
+			}
+		}
+		return s;
+	}
+};
+
+// Appends a JSON snapshot line to a file every aIntervalSeconds from a thread of its own
+class DeadlineDumper {
+private:
+	const DeadlineMonitor& mMonitor;
+	std::ofstream mFile;
+	double mInterval;
+	bool mStop;
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::thread mThread;
+
+	void loop() {
+		std::unique_lock<std::mutex> lock(mMutex);
+		while (!mStop) {
+			mWake.wait_for(lock, std::chrono::duration<double>(mInterval));
+			mMonitor.snapshot().json(mFile);
+			mFile << std::endl;
+		}
+	}
+
+public:
+	DeadlineDumper(const DeadlineMonitor& aMonitor, const std::string& aPath, double aIntervalSeconds = 1.0)
+		: mMonitor(aMonitor), mFile(aPath, std::ios::app) {
+		mInterval = std::max(0.01, aIntervalSeconds);
+		mStop = false;
+		if (mFile.is_open()) {
+			mThread = std::thread(&DeadlineDumper::loop, this);
+		}
+	}
+
+	// Writes a last line on the way out
+	~DeadlineDumper() {
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mStop = true;
+		}
+		mWake.notify_all();
+		if (mThread.joinable()) {
+			mThread.join();
+		}
+	}
+
+	bool isOpen() const {
+		return mFile.is_open();
+	}
+};
+
+#endif
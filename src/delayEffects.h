@@ -0,0 +1,239 @@
+#ifndef DELAYEFFECTS_H
+#define DELAYEFFECTS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+#include "delayLine.h"
+#include "effect.h"
+
+// Sine LFO as a rotating phasor, a multiply-add per sample and no sin() once it is running
+struct EffectLfo {
+	double mSin;
+	double mCos;
+	double mRotSin;
+	double mRotCos;
+
+	EffectLfo() {
+		start(0.0, 1.0, 0.0);
+	}
+
+	void start(double aHertz, double aSampleRate, double aPhase) {
+		const double w = 2.0 * 3.14159265358979323846 * aHertz / aSampleRate;
+		mSin = std::sin(aPhase);
+		mCos = std::cos(aPhase);
+		mRotSin = std::sin(w);
+		mRotCos = std::cos(w);
+	}
+
+	// aOut[i] = aCentre + aDepth * sin, renormalised once per block so the amplitude can't drift
+	void render(float* aOut, int aFrames, float aCentre, float aDepth) {
+		double s = mSin;
+		double c = mCos;
+		for (int i = 0; i < aFrames; i++) {
+			aOut[i] = aCentre + aDepth * (float)s;
+			double next = s * mRotCos + c * mRotSin;
+			c = c * mRotCos - s * mRotSin;
+			s = next;
+		}
+		double norm = 1.0 / std::sqrt(s * s + c * c);
+		mSin = s * norm;
+		mCos = c * norm;
+	}
+};
+
+enum DelayMode {
+	// One line fed the sum of both sides, its echoes on both
+	DELAY_MONO = 0,
+	// A line per side
+	DELAY_STEREO,
+	// Echoes alternate left and right
+	DELAY_PING_PONG,
+};
+
+// Tempo synced echo. The delay is aBeats beats (quarter notes) at the current tempo, so 0.75 is a
+// dotted eighth. The feedback path has a one pole lowpass, so repeats darken as they fade. When
+// the tempo changes the delay glides to the new time over one block rather than jumping.
+class TempoDelay : public Effect {
+private:
+	DelayLinePool mPool;
+	DelayLine mLines[2];
+	DelayMode mMode;
+	double mSampleRate;
+	double mBeats;
+	std::atomic<double> mTempo;
+	float mFeedback;
+	float mDamping;
+	// Delay in samples the last block ended on, and the feedback lowpass per line
+	float mDelay;
+	float mLowpass[2];
+
+	float targetDelay() const {
+		double samples = 60.0 / std::max(mTempo.load(std::memory_order_relaxed), 1.0) * mBeats * mSampleRate;
+		return (float)std::max(1.0, std::min(samples, (double)mLines[0].maxDelay() - 1.0));
+	}
+
+public:
+	// aMaxSeconds is the longest delay the lines hold, slower tempos are clamped to it
+	TempoDelay(double aSampleRate, DelayMode aMode = DELAY_STEREO, double aBeats = 0.75, double aTempo = 120.0,
+		float aFeedback = 0.4f, float aDamping = 0.3f, float aWet = 0.35f, double aMaxSeconds = 4.0) {
+		mSampleRate = aSampleRate;
+		mMode = aMode;
+		mBeats = std::max(0.0, aBeats);
+		mTempo = aTempo;
+		mFeedback = std::max(0.0f, std::min(aFeedback, 0.99f));
+		mDamping = std::max(0.0f, std::min(aDamping, 0.99f));
+		mPool.allocate(2, (uint32_t)(aMaxSeconds * aSampleRate) + 2);
+		for (int side = 0; side < 2; side++) {
+			mLines[side] = mPool.line(side);
+			mLowpass[side] = 0.0f;
+		}
+		mDelay = targetDelay();
+		setWet(aWet);
+	}
+
+	// Beats per minute, from any thread
+	void setTempo(double aTempo) {
+		mTempo.store(aTempo, std::memory_order_relaxed);
+	}
+
+	double tailTime() const override {
+		// Until the repeats are 60dB down
+		double delay = (double)mDelay / mSampleRate;
+		return (mFeedback > 0.0f) ? delay * (1.0 + std::log(0.001) / std::log((double)mFeedback)) : delay;
+	}
+
+	void process(float* aLeft, float* aRight, int aFrames) override {
+		float delays[EFFECT_CHUNK];
+		float echo[2][EFFECT_CHUNK];
+		float feed[2][EFFECT_CHUNK];
+		const float target = targetDelay();
+		const float step = (target - mDelay) / (float)std::max(aFrames, 1);
+		const int lines = (mMode == DELAY_MONO || aRight == nullptr) ? 1 : 2;
+
+		for (int start = 0; start < aFrames;) {
+			// Reads come before writes, so a block can't be longer than the delay
+			const int n = std::min(std::min(EFFECT_CHUNK, aFrames - start), std::max(1, (int)std::min(mDelay, target)));
+			for (int i = 0; i < n; i++) {
+				delays[i] = mDelay + step * (float)i;
+			}
+			mDelay += step * (float)n;
+			for (int side = 0; side < lines; side++) {
+				mLines[side].readBlock(mLines[side].position(), delays, echo[side], n);
+			}
+
+			float* left = aLeft + start;
+			float* right = (aRight != nullptr) ? aRight + start : nullptr;
+			// Ping pong crosses the lines over and feeds the input to the left one only
+			const bool cross = mMode == DELAY_PING_PONG && lines == 2;
+			for (int side = 0; side < lines; side++) {
+				const float* back = echo[cross ? 1 - side : side];
+				float lowpass = mLowpass[side];
+				for (int i = 0; i < n; i++) {
+					lowpass = back[i] + mDamping * (lowpass - back[i]);
+					float in;
+					if (right == nullptr) {
+						in = left[i];
+					} else if (lines == 1 || cross) {
+						in = (side == 0) ? 0.5f * (left[i] + right[i]) : 0.0f;
+					} else {
+						in = (side == 0) ? left[i] : right[i];
+					}
+					feed[side][i] = in + mFeedback * lowpass;
+				}
+				mLowpass[side] = lowpass;
+			}
+			for (int side = 0; side < lines; side++) {
+				mLines[side].writeBlock(feed[side], n);
+			}
+
+			for (int i = 0; i < n; i++) {
+				left[i] += mWet * echo[0][i];
+			}
+			if (right != nullptr) {
+				const float* echoRight = echo[lines - 1];
+				for (int i = 0; i < n; i++) {
+					right[i] += mWet * echoRight[i];
+				}
+			}
+			start += n;
+		}
+		mDelay = target;
+	}
+};
+
+// Delay swept by a sine LFO, the core of chorus and flanger. Each side has its own line and its
+// LFO a quarter cycle apart, for width. The delays for a block come from the LFO in one pass and
+// the line is read with readBlock(); blocks are kept no longer than the shortest delay so the
+// feedback path can read before it writes.
+class ModulatedDelay : public Effect {
+private:
+	DelayLinePool mPool;
+	DelayLine mLines[2];
+	EffectLfo mLfo[2];
+	float mCentre;
+	float mDepth;
+	float mFeedback;
+	int mMaxBlock;
+
+public:
+	// Delay sweeps aCentreMs +- aDepthMs at aRateHz
+	ModulatedDelay(double aSampleRate, double aCentreMs, double aDepthMs, double aRateHz, float aFeedback, float aWet) {
+		aDepthMs = std::max(0.0, std::min(aDepthMs, aCentreMs - 0.05));
+		mCentre = (float)(aCentreMs * 0.001 * aSampleRate);
+		mDepth = (float)(aDepthMs * 0.001 * aSampleRate);
+		mFeedback = std::max(-0.98f, std::min(aFeedback, 0.98f));
+		mMaxBlock = std::max(1, (int)(mCentre - mDepth));
+		mPool.allocate(2, (uint32_t)(mCentre + mDepth) + 2);
+		for (int side = 0; side < 2; side++) {
+			mLines[side] = mPool.line(side);
+			mLfo[side].start(aRateHz, aSampleRate, side * 0.5 * 3.14159265358979323846);
+		}
+		setWet(aWet);
+	}
+
+	double tailTime() const override {
+		return (mFeedback != 0.0f) ? 0.1 : 0.05;
+	}
+
+	void process(float* aLeft, float* aRight, int aFrames) override {
+		float delays[EFFECT_CHUNK];
+		float delayed[EFFECT_CHUNK];
+		float feed[EFFECT_CHUNK];
+		float* sides[2] = { aLeft, aRight };
+
+		for (int side = 0; side < 2 && sides[side] != nullptr; side++) {
+			DelayLine& line = mLines[side];
+			for (int start = 0; start < aFrames;) {
+				const int n = std::min(std::min(EFFECT_CHUNK, aFrames - start), mMaxBlock);
+				float* io = sides[side] + start;
+				mLfo[side].render(delays, n, mCentre, mDepth);
+				line.readBlock(line.position(), delays, delayed, n);
+				for (int i = 0; i < n; i++) {
+					feed[i] = io[i] + mFeedback * delayed[i];
+					io[i] += mWet * delayed[i];
+				}
+				line.writeBlock(feed, n);
+				start += n;
+			}
+		}
+	}
+};
+
+// Thickening: a slow sweep round a delay of about 15ms, no feedback
+class ChorusEffect : public ModulatedDelay {
+public:
+	ChorusEffect(double aSampleRate, double aRateHz = 0.8, double aDepthMs = 3.0, float aWet = 0.5f)
+		: ModulatedDelay(aSampleRate, 15.0, aDepthMs, aRateHz, 0.0f, aWet) {}
+};
+
+// Jet sweep: a short delay of a few ms with feedback, so the comb filter notches ring
+class FlangerEffect : public ModulatedDelay {
+public:
+	FlangerEffect(double aSampleRate, double aRateHz = 0.25, double aDepthMs = 1.5, float aFeedback = 0.6f, float aWet = 0.7f)
+		: ModulatedDelay(aSampleRate, 2.5, aDepthMs, aRateHz, aFeedback, aWet) {}
+};
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef DELAYLINE_H
+#define DELAYLINE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Power of two ring buffer over storage it doesn't own. Indexing is a subtract and a mask, so
+// reads and writes never branch or take a modulo. Fractional delays are read with linear
+// interpolation, one sample at a time or a block of delays at a time for modulated effects.
+class DelayLine {
+private:
+	float* mBuffer;
+	uint32_t mMask;
+	uint32_t mWrite;
+
+public:
+	DelayLine() {
+		mBuffer = nullptr;
+		mMask = 0;
+		mWrite = 0;
+	}
+
+	// aLength must be a power of two
+	DelayLine(float* aBuffer, uint32_t aLength) {
+		mBuffer = aBuffer;
+		mMask = aLength - 1;
+		mWrite = 0;
+	}
+
+	// Smallest power of two holding at least aLength samples
+	static uint32_t roundUp(uint32_t aLength) {
+		uint32_t length = 1;
+		while (length < aLength) {
+			length <<= 1;
+		}
+		return length;
+	}
+
+	bool valid() const {
+		return mBuffer != nullptr;
+	}
+
+	uint32_t length() const {
+		return mMask + 1;
+	}
+
+	// Longest delay read() can give
+	uint32_t maxDelay() const {
+		return mMask;
+	}
+
+	void clear() {
+		if (mBuffer != nullptr) {
+			std::fill(mBuffer, mBuffer + length(), 0.0f);
+		}
+	}
+
+	// Sample written aDelay writes ago, 1 is the most recent
+	float read(uint32_t aDelay) const {
+		return mBuffer[(mWrite - aDelay) & mMask];
+	}
+
+	// Sample aDelay writes ago, 1 <= aDelay < maxDelay(), between whole delays linearly interpolated
+	float readLinear(float aDelay) const {
+		uint32_t whole = (uint32_t)aDelay;
+		float fraction = aDelay - (float)whole;
+		float a = mBuffer[(mWrite - whole) & mMask];
+		float b = mBuffer[(mWrite - whole - 1u) & mMask];
+		return a + (b - a) * fraction;
+	}
+
+	// Count of writes so far, where blocks of reads are measured from
+	uint32_t position() const {
+		return mWrite;
+	}
+
+	// aOut[i] is the sample aDelays[i] writes before write aStart + i, interpolated. Delays below
+	// i + 1 read samples of the block itself, so write the block first when they can be that short;
+	// with feedback, keep blocks no longer than the shortest delay and read before writing.
+	void readBlock(uint32_t aStart, const float* aDelays, float* aOut, int aFrames) const {
+		const float* buffer = mBuffer;
+		const uint32_t mask = mMask;
+		for (int i = 0; i < aFrames; i++) {
+			uint32_t whole = (uint32_t)aDelays[i];
+			float fraction = aDelays[i] - (float)whole;
+			uint32_t at = aStart + (uint32_t)i - whole;
+			float a = buffer[at & mask];
+			float b = buffer[(at - 1u) & mask];
+			aOut[i] = a + (b - a) * fraction;
+		}
+	}
+
+	void write(float aSample) {
+		mBuffer[mWrite & mMask] = aSample;
+		mWrite++;
+	}
+
+	void writeBlock(const float* aIn, int aFrames) {
+		for (int i = 0; i < aFrames; i++) {
+			mBuffer[(mWrite + (uint32_t)i) & mMask] = aIn[i];
+		}
+		mWrite += (uint32_t)aFrames;
+	}
+};
+
+// One allocation split into equal power of two delay lines, so voices can be handed a line
+// without allocating on the audio thread
+class DelayLinePool {
+private:
+	std::vector<float> mStorage;
+	uint32_t mLength;
+	int mLines;
+
+public:
+	DelayLinePool(int aLines = 0, uint32_t aMinLength = 2048) {
+		mLength = 0;
+		mLines = 0;
+		allocate(aLines, aMinLength);
+	}
+
+	// Reallocates, so only while nothing holds a line
+	void allocate(int aLines, uint32_t aMinLength) {
+		mLength = DelayLine::roundUp(std::max<uint32_t>(aMinLength, 1));
+		mLines = std::max(0, aLines);
+		mStorage.assign((size_t)mLines * mLength, 0.0f);
+	}
+
+	int lines() const {
+		return mLines;
+	}
+
+	uint32_t length() const {
+		return mLength;
+	}
+
+	// View of line aIndex, 0 <= aIndex < lines(). Holds whatever the last user left in it
+	DelayLine line(int aIndex) {
+		return DelayLine(mStorage.data() + (size_t)aIndex * mLength, mLength);
+	}
+};
+
+#endif
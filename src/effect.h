@@ -0,0 +1,38 @@
+#ifndef EFFECT_H
+#define EFFECT_H
+
+#include <algorithm>
+
+// Frames effects work through at a time, so their scratch buffers can live on the stack
+const int EFFECT_CHUNK = 128;
+
+// Effect on the engine's mix bus. process() adds the wet signal to a planar block in place,
+// buffers are all sized when the effect is made so processing never allocates
+class Effect {
+protected:
+	float mWet;
+
+public:
+	Effect() {
+		mWet = 0.3f;
+	}
+
+	virtual ~Effect() {}
+
+	// Gain of the wet signal, the dry signal is left as it is
+	void setWet(float aWet) {
+		mWet = std::max(0.0f, aWet);
+	}
+
+	float wet() const {
+		return mWet;
+	}
+
+	// aRight is null for mono output
+	virtual void process(float* aLeft, float* aRight, int aFrames) = 0;
+
+	// Seconds the effect keeps sounding after its input stops
+	virtual double tailTime() const = 0;
+};
+
+#endif
@@ -1,10 +1,20 @@
 #ifndef ENVELOPE_H
 #define ENVELOPE_H
 
+#include <algorithm>
+
 #include "utils.h"
+#include "blockTime.h"
 
 struct Envelope {
 	virtual double getAmp(const double aTime, const double aTimeOn, const double aTimeOff) = 0;
+
+	// Fill aGain with the amplitude of aFrames consecutive samples starting at aTime
+	virtual void render(float* aGain, int aFrames, const BlockTime& aTime, const double aTimeOn, const double aTimeOff) {
+		for (int i = 0; i < aFrames; i++) {
+			aGain[i] = (float)getAmp(aTime.timeAt(i), aTimeOn, aTimeOff);
+		}
+	}
 };
 
 struct EnvelopeADSR : public Envelope {
@@ -70,6 +80,147 @@ struct EnvelopeADSR : public Envelope {
 
 		return amp;
 	}
+
+	void render(float* aGain, int aFrames, const BlockTime& aTime, const double aTimeOn, const double aTimeOff) {
+		// Qualified call so the per sample evaluation is inlined rather than dispatched
+		for (int i = 0; i < aFrames; i++) {
+			aGain[i] = (float)EnvelopeADSR::getAmp(aTime.timeAt(i), aTimeOn, aTimeOff);
+		}
+	}
+};
+
+// Stages of a VoiceEnvelope
+enum EnvelopeStage {
+	ENV_IDLE = 0,
+	ENV_ATTACK,
+	ENV_DECAY,
+	ENV_SUSTAIN,
+	ENV_RELEASE,
+};
+
+// Per voice ADSR state machine. Each stage is a linear ramp with its per sample increment and
+// length worked out when the stage starts, so rendering is an add per sample. Attack and release
+// start from the level the voice is at, so retriggers and early note offs don't jump.
+struct VoiceEnvelope {
+	EnvelopeStage mStage;
+	double mLevel;
+	double mIncrement;
+	// Samples left in the current ramp
+	int mRemaining;
+
+	// Settings in samples, taken from an EnvelopeADSR at note on
+	double mAttackSamples;
+	double mDecaySamples;
+	double mReleaseSamples;
+	double mStartAmp;
+	double mSustainAmp;
+
+	VoiceEnvelope() {
+		mStage = ENV_IDLE;
+		mLevel = 0.0;
+		mIncrement = 0.0;
+		mRemaining = 0;
+		mAttackSamples = 0.0;
+		mDecaySamples = 0.0;
+		mReleaseSamples = 0.0;
+		mStartAmp = 1.0;
+		mSustainAmp = 1.0;
+	}
+
+	// Start (or restart) the attack from the current level
+	void noteOn(const EnvelopeADSR& aSettings, double aSampleRate) {
+		mAttackSamples = aSettings.mAttackTime * aSampleRate;
+		mDecaySamples = aSettings.mDecayTime * aSampleRate;
+		mReleaseSamples = aSettings.mReleaseTime * aSampleRate;
+		mStartAmp = std::min(aSettings.mStartAmp, 1.0);
+		mSustainAmp = std::min(aSettings.mSustainAmp, 1.0);
+		if (mStage == ENV_IDLE) {
+			mLevel = 0.0;
+		}
+		enter(ENV_ATTACK);
+	}
+
+	// Release from wherever the envelope has got to
+	void noteOff() {
+		if (mStage != ENV_IDLE && mStage != ENV_RELEASE) {
+			enter(ENV_RELEASE);
+		}
+	}
+
+	// Nothing left to play, the voice can be reused
+	bool idle() const {
+		return mStage == ENV_IDLE;
+	}
+
+	bool released() const {
+		return mStage == ENV_RELEASE || mStage == ENV_IDLE;
+	}
+
+	// Fill aGain with the next aFrames levels
+	void render(float* aGain, int aFrames) {
+		int i = 0;
+		while (i < aFrames) {
+			if (mStage == ENV_IDLE || mStage == ENV_SUSTAIN) {
+				std::fill(aGain + i, aGain + aFrames, (float)mLevel);
+				return;
+			}
+
+			int n = std::min(aFrames - i, mRemaining);
+			double level = mLevel;
+			for (int k = 0; k < n; k++) {
+				level += mIncrement;
+				aGain[i + k] = (float)level;
+			}
+			mLevel = level;
+			mRemaining -= n;
+			i += n;
+
+			if (mRemaining == 0) {
+				next();
+			}
+		}
+	}
+
+private:
+	// Ramp from the current level to aTarget over aSamples, at least one sample
+	void ramp(double aTarget, double aSamples) {
+		mRemaining = std::max(1, (int)(aSamples + 0.5));
+		mIncrement = (aTarget - mLevel) / mRemaining;
+	}
+
+	void enter(EnvelopeStage aStage) {
+		mStage = aStage;
+		switch (aStage) {
+		case ENV_ATTACK: ramp(mStartAmp, mAttackSamples); break;
+		case ENV_DECAY: ramp(mSustainAmp, mDecaySamples); break;
+		case ENV_RELEASE:
+			if (mLevel <= 0.0) {
+				enter(ENV_IDLE);
+			} else {
+				ramp(0.0, mReleaseSamples);
+			}
+			break;
+		case ENV_SUSTAIN:
+		case ENV_IDLE:
+			mIncrement = 0.0;
+			mRemaining = 0;
+			break;
+		}
+	}
+
+	// End of a ramp, land exactly on its target and move on
+	void next() {
+		switch (mStage) {
+		case ENV_ATTACK: mLevel = mStartAmp; enter(ENV_DECAY); break;
+		case ENV_DECAY:
+			// A silent sustain has nothing left to play, don't wait for the note off
+			mLevel = mSustainAmp;
+			enter((mSustainAmp <= 0.0) ? ENV_IDLE : ENV_SUSTAIN);
+			break;
+		case ENV_RELEASE: mLevel = 0.0; enter(ENV_IDLE); break;
+		default: break;
+		}
+	}
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,123 @@
+#ifndef FBMNOISE_H
+#define FBMNOISE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "noise.h"
+
+// Octaves an fBm oscillator sums at most, and the longest run rendered in one pass
+const int FBM_MAX_OCTAVES = 8;
+const int FBM_CHUNK = 64;
+
+// Fractal Brownian motion over 1D value noise: octave k is smoothly interpolated random values on a
+// lattice running at aHertz * lacunarity^k points per second, weighted by gain^k. Lattice values
+// are an integer hash of the seed, octave and lattice index, so there is no fmod or sin and a
+// block is rendered one octave at a time as a branch-free loop over samples. Octaves whose lattice
+// would run faster than half the sample rate are dropped, so the cost per sample is bounded by
+// FBM_MAX_OCTAVES and by how many octaves fit below Nyquist, whatever octave count is asked for.
+class FbmNoise {
+private:
+	uint32_t mSeed;
+	int mOctaves;
+	// Lattice points per sample, whole lattice position and fraction of the way to the next point
+	double mIncrement[FBM_MAX_OCTAVES];
+	uint32_t mIndex[FBM_MAX_OCTAVES];
+	double mFraction[FBM_MAX_OCTAVES];
+	float mAmp[FBM_MAX_OCTAVES];
+	uint32_t mKey[FBM_MAX_OCTAVES];
+
+	static float lattice(uint32_t aKey, uint32_t aIndex) {
+		return NoiseGenerator::toFloat(NoiseGenerator::mix(aKey ^ (aIndex * 0x9e3779b9u)));
+	}
+
+	// Add octave aOctave for aFrames <= FBM_CHUNK samples into aOut
+	void renderOctave(int aOctave, float* aOut, int aFrames, float aGain) {
+		const uint32_t key = mKey[aOctave];
+		const uint32_t base = mIndex[aOctave];
+		const float from = (float)mFraction[aOctave];
+		const float step = (float)mIncrement[aOctave];
+		const float amp = aGain * mAmp[aOctave];
+		for (int i = 0; i < aFrames; i++) {
+			// Within one chunk the position stays below FBM_CHUNK / 2 + 1, so float is plenty
+			float pos = from + (float)i * step;
+			int whole = (int)pos;
+			float t = pos - (float)whole;
+			float a = lattice(key, base + (uint32_t)whole);
+			float b = lattice(key, base + (uint32_t)whole + 1u);
+			float s = t * t * (3.0f - 2.0f * t);
+			aOut[i] += amp * (a + (b - a) * s);
+		}
+
+		double pos = mFraction[aOctave] + (double)aFrames * mIncrement[aOctave];
+		double whole = std::floor(pos);
+		mIndex[aOctave] += (uint32_t)whole;
+		mFraction[aOctave] = pos - whole;
+	}
+
+public:
+	FbmNoise() {
+		mSeed = 1;
+		mOctaves = 0;
+		for (int k = 0; k < FBM_MAX_OCTAVES; k++) {
+			mIncrement[k] = 0.0;
+			mIndex[k] = 0;
+			mFraction[k] = 0.0;
+			mAmp[k] = 0.0f;
+			mKey[k] = 0;
+		}
+	}
+
+	// Lattice of the first octave runs at aHertz. The octave weights are normalised so the sum
+	// of every requested octave peaks at 1, dropping the ones above Nyquist only removes detail.
+	void start(double aHertz, double aSampleRate, int aOctaves = 4, double aLacunarity = 2.0, double aGain = 0.5) {
+		aOctaves = std::max(1, std::min(aOctaves, FBM_MAX_OCTAVES));
+		aLacunarity = std::max(1.0, aLacunarity);
+
+		double total = 0.0;
+		double weight = 1.0;
+		for (int k = 0; k < aOctaves; k++) {
+			total += weight;
+			weight *= aGain;
+		}
+
+		mOctaves = 0;
+		double increment = aHertz / aSampleRate;
+		weight = 1.0;
+		for (int k = 0; k < aOctaves && increment <= 0.5; k++) {
+			mIncrement[k] = increment;
+			mAmp[k] = (float)(weight / total);
+			mOctaves++;
+			increment *= aLacunarity;
+			weight *= aGain;
+		}
+		seed(mSeed);
+	}
+
+	// Restart on the lattice of aSeed, the same seed always gives the same noise
+	void seed(uint32_t aSeed) {
+		mSeed = aSeed;
+		for (int k = 0; k < FBM_MAX_OCTAVES; k++) {
+			mKey[k] = NoiseGenerator::seedFor(aSeed, (uint32_t)k);
+			mIndex[k] = 0;
+			mFraction[k] = 0.0;
+		}
+	}
+
+	int octaves() const {
+		return mOctaves;
+	}
+
+	// Add aGain * noise for aFrames samples into aOut
+	void render(float* aOut, int aFrames, float aGain) {
+		for (int start = 0; start < aFrames; start += FBM_CHUNK) {
+			int n = std::min(FBM_CHUNK, aFrames - start);
+			for (int k = 0; k < mOctaves; k++) {
+				renderOctave(k, aOut + start, n, aGain);
+			}
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "cpuFeatures.h"
+#include "simdOps.h"
+
+// Butterfly kernels, one copy per instruction set
+namespace SimdScalar {
+#include "fftKernel.inl"
+}
+#if defined(SYNTH_X86)
+namespace SimdSse2 {
+#include "fftKernel.inl"
+}
+SYNTH_TARGET_AVX2_BEGIN
+namespace SimdAvx2 {
+#include "fftKernel.inl"
+}
+SYNTH_TARGET_END
+SYNTH_TARGET_AVX512_BEGIN
+namespace SimdAvx512 {
+#include "fftKernel.inl"
+}
+SYNTH_TARGET_END
+#endif
+
+// FFT of real signals of one power of two size, done as a complex FFT of half the size. Tables
+// and work space are built once, so transforms never allocate. Spectra are split into real and
+// imaginary arrays of bins() values, which keeps spectrum products simple loops that vectorise.
+class RealFft {
+private:
+	typedef void(*StageKernel)(float*, float*, const float*, const float*, float, int, int);
+
+	int mSize;
+	int mHalf;
+	std::vector<int> mBitReverse;
+	// Twiddles of the complex FFT stage by stage, the stage with butterflies half apart uses
+	// entries half - 1 .. 2 * half - 2 so its inner loop reads them in order. Then
+	// exp(-2 pi i k / mSize) to split its output
+	std::vector<float> mTwiddleRe;
+	std::vector<float> mTwiddleIm;
+	std::vector<float> mSplitRe;
+	std::vector<float> mSplitIm;
+	std::vector<float> mWorkRe;
+	std::vector<float> mWorkIm;
+	StageKernel mStage;
+
+	static StageKernel kernelFor(SimdLevel aLevel) {
+		switch (aLevel) {
+#if defined(SYNTH_X86)
+		case SIMD_AVX512: return SimdAvx512::fftStage;
+		case SIMD_AVX2: return SimdAvx2::fftStage;
+		case SIMD_SSE2: return SimdSse2::fftStage;
+#endif
+		default: return SimdScalar::fftStage;
+		}
+	}
+
+	// In place radix 2 FFT of mWork, conjugate twiddles for the inverse (unscaled)
+	void transform(bool aInverse) {
+		float* re = mWorkRe.data();
+		float* im = mWorkIm.data();
+		for (int i = 0; i < mHalf; i++) {
+			int j = mBitReverse[i];
+			if (j > i) {
+				std::swap(re[i], re[j]);
+				std::swap(im[i], im[j]);
+			}
+		}
+
+		const float sign = aInverse ? -1.0f : 1.0f;
+		for (int half = 1; half < mHalf; half <<= 1) {
+			mStage(re, im, &mTwiddleRe[half - 1], &mTwiddleIm[half - 1], sign, half, mHalf);
+		}
+	}
+
+public:
+	RealFft(int aSize = 0) {
+		mStage = kernelFor(CpuFeatures::detect());
+		mSize = 0;
+		mHalf = 0;
+		if (aSize > 0) {
+			setup(aSize);
+		}
+	}
+
+	// aSize must be a power of two of at least 4
+	void setup(int aSize) {
+		const double pi = 3.14159265358979323846;
+		mSize = aSize;
+		mHalf = aSize / 2;
+
+		int bits = 0;
+		while ((1 << bits) < mHalf) {
+			bits++;
+		}
+		mBitReverse.assign(mHalf, 0);
+		for (int i = 0; i < mHalf; i++) {
+			int r = 0;
+			for (int b = 0; b < bits; b++) {
+				r |= ((i >> b) & 1) << (bits - 1 - b);
+			}
+			mBitReverse[i] = r;
+		}
+
+		mTwiddleRe.assign(std::max(1, mHalf - 1), 0.0f);
+		mTwiddleIm.assign(std::max(1, mHalf - 1), 0.0f);
+		for (int half = 1; half < mHalf; half <<= 1) {
+			for (int j = 0; j < half; j++) {
+				mTwiddleRe[half - 1 + j] = (float)std::cos(-pi * j / half);
+				mTwiddleIm[half - 1 + j] = (float)std::sin(-pi * j / half);
+			}
+		}
+		mSplitRe.assign(mHalf, 0.0f);
+		mSplitIm.assign(mHalf, 0.0f);
+		for (int k = 0; k < mHalf; k++) {
+			mSplitRe[k] = (float)std::cos(-2.0 * pi * k / mSize);
+			mSplitIm[k] = (float)std::sin(-2.0 * pi * k / mSize);
+		}
+		mWorkRe.assign(mHalf, 0.0f);
+		mWorkIm.assign(mHalf, 0.0f);
+	}
+
+	int size() const {
+		return mSize;
+	}
+
+	// Spectrum values, DC to Nyquist
+	int bins() const {
+		return mHalf + 1;
+	}
+
+	// Unscaled spectrum of aSize samples of aIn
+	void forward(const float* aIn, float* aRe, float* aIm) {
+		for (int n = 0; n < mHalf; n++) {
+			mWorkRe[n] = aIn[2 * n];
+			mWorkIm[n] = aIn[2 * n + 1];
+		}
+		transform(false);
+
+		// Even and odd sample spectra out of the packed transform, then one butterfly each
+		for (int k = 0; k <= mHalf; k++) {
+			const int a = (k == mHalf) ? 0 : k;
+			const int b = (k == 0) ? 0 : mHalf - k;
+			const float evenRe = 0.5f * (mWorkRe[a] + mWorkRe[b]);
+			const float evenIm = 0.5f * (mWorkIm[a] - mWorkIm[b]);
+			const float oddRe = 0.5f * (mWorkIm[a] + mWorkIm[b]);
+			const float oddIm = -0.5f * (mWorkRe[a] - mWorkRe[b]);
+			const float wr = (k == mHalf) ? -1.0f : mSplitRe[k];
+			const float wi = (k == mHalf) ? 0.0f : mSplitIm[k];
+			aRe[k] = evenRe + (oddRe * wr - oddIm * wi);
+			aIm[k] = evenIm + (oddRe * wi + oddIm * wr);
+		}
+	}
+
+	// aSize samples back from a spectrum, inverse(forward(x)) is x
+	void inverse(const float* aRe, const float* aIm, float* aOut) {
+		for (int k = 0; k < mHalf; k++) {
+			const int b = mHalf - k;
+			const float evenRe = 0.5f * (aRe[k] + aRe[b]);
+			const float evenIm = 0.5f * (aIm[k] - aIm[b]);
+			const float diffRe = 0.5f * (aRe[k] - aRe[b]);
+			const float diffIm = 0.5f * (aIm[k] + aIm[b]);
+			// Odd spectrum is the difference turned back by the conjugate twiddle
+			const float wr = mSplitRe[k];
+			const float wi = -mSplitIm[k];
+			const float oddRe = diffRe * wr - diffIm * wi;
+			const float oddIm = diffRe * wi + diffIm * wr;
+			mWorkRe[k] = evenRe - oddIm;
+			mWorkIm[k] = evenIm + oddRe;
+		}
+		transform(true);
+
+		const float scale = 1.0f / (float)mHalf;
+		for (int n = 0; n < mHalf; n++) {
+			aOut[2 * n] = mWorkRe[n] * scale;
+			aOut[2 * n + 1] = mWorkIm[n] * scale;
+		}
+	}
+};
+
+#endif
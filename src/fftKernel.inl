@@ -0,0 +1,39 @@
+// FFT butterfly kernel, included by fft.h once per instruction set inside a namespace that
+// provides Ops (see simdOps.h). Don't include this anywhere else.
+
+// One radix 2 stage over aCount points in place, butterflies aHalf apart with twiddles
+// aTwiddleRe/Im[0 .. aHalf), the imaginary parts times aSign
+static void fftStage(float* aRe, float* aIm, const float* aTwiddleRe, const float* aTwiddleIm, float aSign, int aHalf, int aCount) {
+	const Ops::V sign = Ops::set(aSign);
+	for (int i = 0; i < aCount; i += 2 * aHalf) {
+		float* aR = aRe + i;
+		float* aI = aIm + i;
+		float* bR = aR + aHalf;
+		float* bI = aI + aHalf;
+		int j = 0;
+		for (; j + Ops::W <= aHalf; j += Ops::W) {
+			const Ops::V wr = Ops::loadu(aTwiddleRe + j);
+			const Ops::V wi = Ops::mul(sign, Ops::loadu(aTwiddleIm + j));
+			const Ops::V br = Ops::loadu(bR + j);
+			const Ops::V bi = Ops::loadu(bI + j);
+			const Ops::V ar = Ops::loadu(aR + j);
+			const Ops::V ai = Ops::loadu(aI + j);
+			const Ops::V vr = Ops::sub(Ops::mul(br, wr), Ops::mul(bi, wi));
+			const Ops::V vi = Ops::add(Ops::mul(br, wi), Ops::mul(bi, wr));
+			Ops::storeu(bR + j, Ops::sub(ar, vr));
+			Ops::storeu(bI + j, Ops::sub(ai, vi));
+			Ops::storeu(aR + j, Ops::add(ar, vr));
+			Ops::storeu(aI + j, Ops::add(ai, vi));
+		}
+		for (; j < aHalf; j++) {
+			const float wr = aTwiddleRe[j];
+			const float wi = aSign * aTwiddleIm[j];
+			const float vr = bR[j] * wr - bI[j] * wi;
+			const float vi = bR[j] * wi + bI[j] * wr;
+			bR[j] = aR[j] - vr;
+			bI[j] = aI[j] - vi;
+			aR[j] += vr;
+			aI[j] += vi;
+		}
+	}
+}
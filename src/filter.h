@@ -0,0 +1,277 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#include "cpuFeatures.h"
+#include "simdOps.h"
+
+enum FilterMode {
+	FILTER_OFF = 0,
+	FILTER_LOWPASS,
+	FILTER_HIGHPASS,
+	FILTER_BANDPASS,
+	FILTER_NOTCH,
+};
+
+// Filter settings of an instrument or bus. For voices the cutoff follows the envelope:
+// mCutoff * 2^(mEnvAmount * level), so a positive amount opens the filter as the note swells.
+struct FilterSettings {
+	FilterMode mMode = FILTER_OFF;
+	double mCutoff = 1000.0;
+	// Q, 0.707 is flat
+	double mResonance = 0.707;
+	// Octaves the cutoff moves at full envelope
+	double mEnvAmount = 0.0;
+
+	double cutoffAt(float aLevel) const {
+		return mCutoff * std::exp2(mEnvAmount * (double)aLevel);
+	}
+};
+
+// Coefficients of the trapezoidal (TPT) state variable filter for one cutoff. The only tan is
+// in make(), filters ramp linearly between the sets at the ends of each block.
+struct SvfCoefficients {
+	float mA1;
+	float mA2;
+	float mA3;
+
+	static SvfCoefficients make(double aCutoff, double aResonance, double aSampleRate) {
+		double cutoff = std::max(10.0, std::min(aCutoff, 0.49 * aSampleRate));
+		double g = std::tan(3.14159265358979323846 * cutoff / aSampleRate);
+		double k = damping(aResonance);
+		double a1 = 1.0 / (1.0 + g * (g + k));
+		SvfCoefficients c;
+		c.mA1 = (float)a1;
+		c.mA2 = (float)(g * a1);
+		c.mA3 = (float)(g * g * a1);
+		return c;
+	}
+
+	static double damping(double aResonance) {
+		return 1.0 / std::max(aResonance, 0.1);
+	}
+
+	// Output is aMix[0] * input + aMix[1] * band + aMix[2] * low
+	static void mix(FilterMode aMode, double aResonance, float aMix[3]) {
+		float k = (float)damping(aResonance);
+		switch (aMode) {
+		case FILTER_LOWPASS: aMix[0] = 0.0f; aMix[1] = 0.0f; aMix[2] = 1.0f; break;
+		case FILTER_HIGHPASS: aMix[0] = 1.0f; aMix[1] = -k; aMix[2] = -1.0f; break;
+		case FILTER_BANDPASS: aMix[0] = 0.0f; aMix[1] = 1.0f; aMix[2] = 0.0f; break;
+		case FILTER_NOTCH: aMix[0] = 1.0f; aMix[1] = -k; aMix[2] = 0.0f; break;
+		default: aMix[0] = 1.0f; aMix[1] = 0.0f; aMix[2] = 0.0f; break;
+		}
+	}
+};
+
+// Running state of one filter, carried from block to block
+struct SvfState {
+	float mIc1;
+	float mIc2;
+	// Coefficients the last block ended on, where the next one ramps from
+	SvfCoefficients mCoeffs;
+	bool mPrimed;
+
+	SvfState() {
+		mIc1 = 0.0f;
+		mIc2 = 0.0f;
+		mCoeffs = { 0.0f, 0.0f, 0.0f };
+		mPrimed = false;
+	}
+};
+
+// Filters run side by side by the lane kernel, one voice render task's worth
+const int FILTER_LANES = 8;
+
+// Structure of arrays over FILTER_LANES filters for one block. Unused lanes are all zeros and
+// output silence.
+struct FilterLanes {
+	alignas(64) float mIc1[FILTER_LANES];
+	alignas(64) float mIc2[FILTER_LANES];
+	alignas(64) float mA1[FILTER_LANES];
+	alignas(64) float mA2[FILTER_LANES];
+	alignas(64) float mA3[FILTER_LANES];
+	alignas(64) float mStepA1[FILTER_LANES];
+	alignas(64) float mStepA2[FILTER_LANES];
+	alignas(64) float mStepA3[FILTER_LANES];
+	alignas(64) float mMix0[FILTER_LANES];
+	alignas(64) float mMix1[FILTER_LANES];
+	alignas(64) float mMix2[FILTER_LANES];
+
+	FilterLanes() {
+		clear();
+	}
+
+	void clear() {
+		float* fields[] = { mIc1, mIc2, mA1, mA2, mA3, mStepA1, mStepA2, mStepA3, mMix0, mMix1, mMix2 };
+		for (float* f : fields) {
+			std::fill(f, f + FILTER_LANES, 0.0f);
+		}
+	}
+
+	// Load aState into aLane, ramping to aTo over aFrames
+	void load(int aLane, const SvfState& aState, const SvfCoefficients& aTo, const float aMix[3], int aFrames) {
+		const float scale = 1.0f / (float)std::max(aFrames, 1);
+		mIc1[aLane] = aState.mIc1;
+		mIc2[aLane] = aState.mIc2;
+		mA1[aLane] = aState.mCoeffs.mA1;
+		mA2[aLane] = aState.mCoeffs.mA2;
+		mA3[aLane] = aState.mCoeffs.mA3;
+		mStepA1[aLane] = (aTo.mA1 - aState.mCoeffs.mA1) * scale;
+		mStepA2[aLane] = (aTo.mA2 - aState.mCoeffs.mA2) * scale;
+		mStepA3[aLane] = (aTo.mA3 - aState.mCoeffs.mA3) * scale;
+		mMix0[aLane] = aMix[0];
+		mMix1[aLane] = aMix[1];
+		mMix2[aLane] = aMix[2];
+	}
+
+	// Integrator state of aLane back into aState, which now ends on aTo
+	void store(int aLane, SvfState& aState, const SvfCoefficients& aTo) const {
+		aState.mIc1 = mIc1[aLane];
+		aState.mIc2 = mIc2[aLane];
+		aState.mCoeffs = aTo;
+	}
+};
+
+// Lane kernels, one copy per instruction set
+namespace SimdScalar {
+#include "filterKernel.inl"
+}
+#if defined(SYNTH_X86)
+namespace SimdSse2 {
+#include "filterKernel.inl"
+}
+SYNTH_TARGET_AVX2_BEGIN
+namespace SimdAvx2 {
+#include "filterKernel.inl"
+}
+SYNTH_TARGET_END
+#endif
+
+typedef void(*FilterKernel)(FilterLanes&, float*, int);
+
+// FILTER_LANES only fills an AVX2 register, so AVX-512 gets the AVX2 kernel
+inline FilterKernel filterKernelFor(SimdLevel aLevel) {
+	switch (aLevel) {
+#if defined(SYNTH_X86)
+	case SIMD_AVX512:
+	case SIMD_AVX2: return SimdAvx2::filterLanes;
+	case SIMD_SSE2: return SimdSse2::filterLanes;
+#endif
+	default: return SimdScalar::filterLanes;
+	}
+}
+
+// One filter on a planar block, e.g. a side of a mix bus. Same sums as the lane kernel.
+class StateVariableFilter {
+private:
+	FilterMode mMode;
+	double mResonance;
+	double mSampleRate;
+	float mMix[3];
+	SvfState mState;
+
+public:
+	StateVariableFilter() {
+		mMode = FILTER_OFF;
+		mResonance = 0.707;
+		mSampleRate = 44100.0;
+		SvfCoefficients::mix(mMode, mResonance, mMix);
+	}
+
+	void setup(FilterMode aMode, double aResonance, double aSampleRate) {
+		mMode = aMode;
+		mResonance = aResonance;
+		mSampleRate = aSampleRate;
+		SvfCoefficients::mix(mMode, mResonance, mMix);
+		reset();
+	}
+
+	void reset() {
+		mState = SvfState();
+	}
+
+	bool enabled() const {
+		return mMode != FILTER_OFF;
+	}
+
+	// Filter aFrames of aIo in place, the cutoff ramping from where the last block ended to aCutoff
+	void process(float* aIo, int aFrames, double aCutoff) {
+		if (!enabled() || aFrames <= 0) {
+			return;
+		}
+		SvfCoefficients to = SvfCoefficients::make(aCutoff, mResonance, mSampleRate);
+		if (!mState.mPrimed) {
+			mState.mCoeffs = to;
+			mState.mPrimed = true;
+		}
+
+		const float scale = 1.0f / (float)aFrames;
+		const float da1 = (to.mA1 - mState.mCoeffs.mA1) * scale;
+		const float da2 = (to.mA2 - mState.mCoeffs.mA2) * scale;
+		const float da3 = (to.mA3 - mState.mCoeffs.mA3) * scale;
+		float a1 = mState.mCoeffs.mA1;
+		float a2 = mState.mCoeffs.mA2;
+		float a3 = mState.mCoeffs.mA3;
+		float ic1 = mState.mIc1;
+		float ic2 = mState.mIc2;
+		for (int i = 0; i < aFrames; i++) {
+			float v0 = aIo[i];
+			float v3 = v0 - ic2;
+			float v1 = a1 * ic1 + a2 * v3;
+			float v2 = (ic2 + a2 * ic1) + a3 * v3;
+			ic1 = 2.0f * v1 - ic1;
+			ic2 = 2.0f * v2 - ic2;
+			aIo[i] = (mMix[0] * v0 + mMix[1] * v1) + mMix[2] * v2;
+			a1 += da1;
+			a2 += da2;
+			a3 += da3;
+		}
+		mState.mIc1 = ic1;
+		mState.mIc2 = ic2;
+		mState.mCoeffs = to;
+	}
+};
+
+// A StateVariableFilter per side whose cutoff can be moved from any thread, for buses
+class StereoFilter {
+private:
+	StateVariableFilter mSides[2];
+	std::atomic<double> mCutoff;
+
+public:
+	StereoFilter() {
+		mCutoff = 1000.0;
+	}
+
+	// Resets the filter state, so only while nothing is processing
+	void setup(FilterMode aMode, double aCutoff, double aResonance, double aSampleRate) {
+		for (int side = 0; side < 2; side++) {
+			mSides[side].setup(aMode, aResonance, aSampleRate);
+		}
+		mCutoff = aCutoff;
+	}
+
+	// From any thread, it ramps there over the next block
+	void setCutoff(double aCutoff) {
+		mCutoff.store(aCutoff, std::memory_order_relaxed);
+	}
+
+	bool enabled() const {
+		return mSides[0].enabled();
+	}
+
+	// aRight is null for mono
+	void process(float* aLeft, float* aRight, int aFrames) {
+		const double cutoff = mCutoff.load(std::memory_order_relaxed);
+		mSides[0].process(aLeft, aFrames, cutoff);
+		if (aRight != nullptr) {
+			mSides[1].process(aRight, aFrames, cutoff);
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,39 @@
+// Filter lane kernel, included by filter.h once per instruction set inside a namespace that
+// provides Ops (see simdOps.h). Don't include this anywhere else.
+
+// Filter aFrames frames of aIo in place, frame i of lane l at aIo[i * FILTER_LANES + l].
+// Coefficients ramp by their increments every sample.
+static void filterLanes(FilterLanes& aLanes, float* aIo, int aFrames) {
+	const Ops::V two = Ops::set(2.0f);
+	for (int l = 0; l < FILTER_LANES; l += Ops::W) {
+		Ops::V ic1 = Ops::load(aLanes.mIc1 + l);
+		Ops::V ic2 = Ops::load(aLanes.mIc2 + l);
+		Ops::V a1 = Ops::load(aLanes.mA1 + l);
+		Ops::V a2 = Ops::load(aLanes.mA2 + l);
+		Ops::V a3 = Ops::load(aLanes.mA3 + l);
+		const Ops::V da1 = Ops::load(aLanes.mStepA1 + l);
+		const Ops::V da2 = Ops::load(aLanes.mStepA2 + l);
+		const Ops::V da3 = Ops::load(aLanes.mStepA3 + l);
+		const Ops::V m0 = Ops::load(aLanes.mMix0 + l);
+		const Ops::V m1 = Ops::load(aLanes.mMix1 + l);
+		const Ops::V m2 = Ops::load(aLanes.mMix2 + l);
+
+		for (int i = 0; i < aFrames; i++) {
+			float* io = aIo + i * FILTER_LANES + l;
+			Ops::V v0 = Ops::load(io);
+			Ops::V v3 = Ops::sub(v0, ic2);
+			Ops::V v1 = Ops::add(Ops::mul(a1, ic1), Ops::mul(a2, v3));
+			Ops::V v2 = Ops::add(Ops::add(ic2, Ops::mul(a2, ic1)), Ops::mul(a3, v3));
+			ic1 = Ops::sub(Ops::mul(two, v1), ic1);
+			ic2 = Ops::sub(Ops::mul(two, v2), ic2);
+			Ops::store(io, Ops::add(Ops::add(Ops::mul(m0, v0), Ops::mul(m1, v1)), Ops::mul(m2, v2)));
+
+			a1 = Ops::add(a1, da1);
+			a2 = Ops::add(a2, da2);
+			a3 = Ops::add(a3, da3);
+		}
+
+		Ops::store(aLanes.mIc1 + l, ic1);
+		Ops::store(aLanes.mIc2 + l, ic2);
+	}
+}
@@ -1,7 +1,19 @@
 #ifndef INSTRUMENT_H
 #define INSTRUMENT_H
 
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+
 #include "envelope.h"
+#include "blockTime.h"
+#include "oscillator.h"
+#include "delayLine.h"
+#include "karplusStrong.h"
+#include "filter.h"
+
+// Oscillator layers a voice can hold
+const int NOTE_OSCILLATORS = 3;
 
 struct Note {
 	int mId;
@@ -9,6 +21,21 @@ struct Note {
 	double mTimeOff;
 	bool mActive;
 	int mChannel;
+	// Noise seed, each oscillator gets its own stream of it
+	uint32_t mSeed;
+	// Envelope level at the end of the last rendered block
+	float mLevel;
+	VoiceEnvelope mEnvelope;
+	// Constant power pan gains, only used for stereo output
+	float mPanLeft;
+	float mPanRight;
+	// Per voice oscillator state, set up by Instrument::start
+	Oscillator mOsc[NOTE_OSCILLATORS];
+	// The voice slot's line from the engine's DelayLinePool, and the string that plays it
+	DelayLine mDelay;
+	KarplusString mString;
+	// Voice filter, run by the engine after the instrument renders
+	SvfState mFilter;
 
 	Note() {
 		mId = 0;
@@ -16,75 +43,364 @@ struct Note {
 		mTimeOff = 0.0;
 		mActive = false;
 		mChannel = 0;
+		mSeed = 1;
+		mLevel = 0.0f;
+		Utility::panGains(0.0, mPanLeft, mPanRight);
 	}
 };
 
-typedef bool(*lambda)(Note const& item);
-template<class T>
-void safe_remove(T& v, lambda f) {
-	auto n = v.begin();
-	while (n != v.end())
-		if (!f(*n))
-			n = v.erase(n);
-		else
-			++n;
-}
+// Note changes sent from the input thread to the audio thread
+enum NoteEventType {
+	NOTE_ON = 0,
+	NOTE_OFF,
+	NOTE_RETRIGGER,
+};
+
+// A note is its id and channel together, so one key can sound on two channels at once
+struct NoteEvent {
+	NoteEventType mType;
+	int mId;
+	int mChannel;
+	double mTime;
+};
+
+// Voices are rendered in chunks of this many frames so scratch buffers can live on the stack
+const int RENDER_CHUNK = 64;
+static_assert(RENDER_CHUNK <= FBM_CHUNK, "OscillatorCursor::prepare renders at most FBM_CHUNK frames");
+
+// One oscillator of an instrument voice, pitched aNoteOffset semitones from the played note
+struct OscLayer {
+	Synth::WaveForm mWaveForm;
+	int mNoteOffset;
+	float mGain;
+	double mLfoHertz;
+	double mLfoAmp;
+	// OSC_FBM only
+	int mFbmOctaves = 4;
+	double mFbmLacunarity = 2.0;
+	double mFbmGain = 0.5;
+};
+
+// Envelope settings of an instrument, times in seconds
+struct EnvelopeSettings {
+	double mAttackTime;
+	double mDecayTime;
+	double mStartAmp;
+	double mSustainAmp;
+	double mReleaseTime;
+};
 
+typedef void (*InstrumentStartFn)(Note& aNote, double aSampleRate);
+typedef void (*InstrumentRenderFn)(float* aLeft, float* aRight, int aFrames, const BlockTime& aTime, Note& aNote, bool& aNoteFinished);
+
+// Runtime view of an instrument. The settings are for code that drives voices itself (VoiceBank),
+// start and render jump into the loop compiled for the instrument by InstrumentDef.
 struct Instrument {
 	double mVolume;
 	EnvelopeADSR mEnvelope;
+	// Oscillator stack every voice of this instrument plays
+	OscLayer mLayers[NOTE_OSCILLATORS];
+	int mLayerCount;
+	// Per voice filter keyed off the envelope, FILTER_OFF mixes voices straight out of render
+	FilterSettings mFilter;
+	InstrumentStartFn mStart;
+	InstrumentStartFn mRetrigger;
+	InstrumentRenderFn mRender;
 
-	virtual double sound(double aTime, Note aNote, bool& aNoteFinished) = 0;
+	// Set up aNote's oscillators at note on
+	void start(Note& aNote, double aSampleRate) const {
+		mStart(aNote, aSampleRate);
+	}
+
+	// Key pressed again on a voice still sounding, the envelope restarts from its level
+	void retrigger(Note& aNote, double aSampleRate) const {
+		mRetrigger(aNote, aSampleRate);
+	}
+
+	// Mix aFrames of aNote into aLeft and, panned, into aRight. With no aRight the note is mixed
+	// into aLeft unpanned. aNoteFinished is set once the envelope has run out
+	void render(float* aLeft, float* aRight, int aFrames, const BlockTime& aTime, Note& aNote, bool& aNoteFinished) const {
+		mRender(aLeft, aRight, aFrames, aTime, aNote, aNoteFinished);
+	}
+
+	// Mono mix of aFrames of aNote into aOut
+	void render(float* aOut, int aFrames, const BlockTime& aTime, Note& aNote, bool& aNoteFinished) const {
+		mRender(aOut, nullptr, aFrames, aTime, aNote, aNoteFinished);
+	}
 };
 
-struct BellInstrument : public Instrument {
-	BellInstrument() {
-		mEnvelope.mAttackTime = 0.01;
-		mEnvelope.mDecayTime = 1.0;
-		mEnvelope.mSustainAmp = 0.0;
-		mEnvelope.mReleaseTime = 1.0;
-		mVolume = 1.0;
+// Filter of a patch with a constexpr filter member, FILTER_OFF for one without
+template<class Patch, class = void>
+struct PatchFilter {
+	static FilterSettings get() {
+		return FilterSettings();
 	}
+};
 
-	virtual double sound(double aTime, Note aNote, bool& aNoteFinished) {
-		double amp = mEnvelope.getAmp(aTime, aNote.mTimeOn, aNote.mTimeOff);
-		if (amp <= 0.0) {
-			aNoteFinished = true;
+template<class Patch>
+struct PatchFilter<Patch, std::void_t<decltype(Patch::filter)>> {
+	static FilterSettings get() {
+		return Patch::filter;
+	}
+};
+
+// Instrument compiled from a patch, a struct with constexpr members
+//   volume    output gain
+//   envelope  EnvelopeSettings
+//   layers    array of up to NOTE_OSCILLATORS OscLayers
+//   filter    optional FilterSettings
+// Waveforms, offsets and gains are all constants, so render() is one loop per instrument with
+// every layer inlined and no per sample dispatch.
+template<class Patch>
+struct InstrumentDef {
+	static const int LAYERS = (int)std::extent<decltype(Patch::layers)>::value;
+	static_assert(LAYERS <= NOTE_OSCILLATORS, "Note holds at most NOTE_OSCILLATORS oscillators");
+
+	// Settings and entry points for an Instrument table
+	static Instrument describe() {
+		Instrument inst;
+		inst.mVolume = Patch::volume;
+		inst.mEnvelope = makeEnvelope();
+		for (int k = 0; k < LAYERS; k++) {
+			inst.mLayers[k] = Patch::layers[k];
+		}
+		inst.mLayerCount = LAYERS;
+		inst.mFilter = PatchFilter<Patch>::get();
+		inst.mStart = &InstrumentDef::start;
+		inst.mRetrigger = &InstrumentDef::retrigger;
+		inst.mRender = &InstrumentDef::render;
+		return inst;
+	}
+
+	static void start(Note& aNote, double aSampleRate) {
+		aNote.mEnvelope.noteOn(envelope(), aSampleRate);
+		for (int k = 0; k < LAYERS; k++) {
+			const OscLayer& layer = Patch::layers[k];
+			aNote.mOsc[k].setFbm(layer.mFbmOctaves, layer.mFbmLacunarity, layer.mFbmGain);
+			aNote.mOsc[k].start(Utility::scale(aNote.mId + layer.mNoteOffset), aSampleRate, layer.mWaveForm, layer.mLfoHertz, layer.mLfoAmp);
+			aNote.mOsc[k].seed(NoiseGenerator::seedFor(aNote.mSeed, (uint32_t)k));
+		}
+	}
+
+	// Oscillator phases, LFOs and noise run on so the waveform doesn't jump
+	static void retrigger(Note& aNote, double aSampleRate) {
+		aNote.mEnvelope.noteOn(envelope(), aSampleRate);
+	}
+
+	// Voices keep their own time, aTime is for instruments that follow the clock
+	static void render(float* aLeft, float* aRight, int aFrames, const BlockTime& aTime, Note& aNote, bool& aNoteFinished) {
+		(void)aTime;
+		if (aRight == nullptr) {
+			renderLayers<false>(aLeft, aRight, aFrames, aNote, aNoteFinished, std::make_index_sequence<LAYERS>());
+		} else {
+			renderLayers<true>(aLeft, aRight, aFrames, aNote, aNoteFinished, std::make_index_sequence<LAYERS>());
+		}
+	}
+
+private:
+	static EnvelopeADSR makeEnvelope() {
+		EnvelopeADSR env;
+		env.mAttackTime = Patch::envelope.mAttackTime;
+		env.mDecayTime = Patch::envelope.mDecayTime;
+		env.mStartAmp = Patch::envelope.mStartAmp;
+		env.mSustainAmp = Patch::envelope.mSustainAmp;
+		env.mReleaseTime = Patch::envelope.mReleaseTime;
+		return env;
+	}
+
+	// Settings voices copy at note on
+	static const EnvelopeADSR& envelope() {
+		static const EnvelopeADSR env = makeEnvelope();
+		return env;
+	}
+
+	// Every layer and the pan in one pass, the stereo loop only adds a multiply per side
+	template<bool Stereo, size_t... K>
+	static void renderLayers(float* aLeft, float* aRight, int aFrames, Note& aNote, bool& aNoteFinished, std::index_sequence<K...>) {
+		float gain[RENDER_CHUNK];
+		const float panLeft = aNote.mPanLeft;
+		const float panRight = aNote.mPanRight;
+
+		for (int start = 0; start < aFrames && !aNote.mEnvelope.idle(); start += RENDER_CHUNK) {
+			int n = std::min(RENDER_CHUNK, aFrames - start);
+			aNote.mEnvelope.render(gain, n);
+
+			OscillatorCursor cursor[] = { OscillatorCursor(aNote.mOsc[K])... };
+			(cursor[K].template prepare<Patch::layers[K].mWaveForm>(n), ...);
+			for (int i = 0; i < n; i++) {
+				float wave = 0.0f;
+				((wave += Patch::layers[K].mGain * (float)cursor[K].template next<Patch::layers[K].mWaveForm, (Patch::layers[K].mLfoAmp != 0.0)>()), ...);
+				float sample = gain[i] * wave * (float)Patch::volume;
+				if (Stereo) {
+					aLeft[start + i] += sample * panLeft;
+					aRight[start + i] += sample * panRight;
+				} else {
+					aLeft[start + i] += sample;
+				}
+			}
+			(cursor[K].template store<(Patch::layers[K].mLfoAmp != 0.0)>(aNote.mOsc[K]), ...);
+
+			aNote.mLevel = gain[n - 1];
 		}
-		
-		double output = (
-			+ 1.00 * Synth::osc(aNote.mTimeOn - aTime, Utility::scale(aNote.mId + 12), Synth::OSC_SINE, 5.0, 0.001)
-			+ 0.50 * Synth::osc(aNote.mTimeOn - aTime, Utility::scale(aNote.mId + 24))
-			+ 0.25 * Synth::osc(aNote.mTimeOn - aTime, Utility::scale(aNote.mId + 36))
-		);
-		 
-		return amp * output * mVolume;
+		aNoteFinished = aNote.mEnvelope.idle();
 	}
 };
 
-struct HarmonicaInstrument : public Instrument {
-	HarmonicaInstrument() {
-		mEnvelope.mAttackTime = 0.05;
-		mEnvelope.mDecayTime = 1.0;
-		mEnvelope.mSustainAmp = 0.95;
-		mEnvelope.mReleaseTime = 0.1;
-		mVolume = 1.0;
+struct BellPatch {
+	static constexpr double volume = 1.0;
+	static constexpr EnvelopeSettings envelope = { 0.01, 1.0, 1.0, 0.0, 1.0 };
+	static constexpr OscLayer layers[] = {
+		{ Synth::OSC_SINE, 12, 1.00f, 5.0, 0.001 },
+		{ Synth::OSC_SINE, 24, 0.50f, 0.0, 0.0 },
+		{ Synth::OSC_SINE, 36, 0.25f, 0.0, 0.0 },
+	};
+};
+
+struct HarmonicaPatch {
+	static constexpr double volume = 1.0;
+	static constexpr EnvelopeSettings envelope = { 0.05, 1.0, 1.0, 0.95, 0.1 };
+	static constexpr OscLayer layers[] = {
+		{ Synth::OSC_SQUARE, 0, 1.00f, 5.0, 0.001 },
+		{ Synth::OSC_SQUARE, 12, 0.50f, 0.0, 0.0 },
+		{ Synth::OSC_SQUARE, 24, 0.05f, 0.0, 0.0 },
+	};
+};
+
+// Plucked string instrument compiled from a patch, a struct with constexpr members
+//   volume      output gain
+//   envelope    EnvelopeSettings, mostly for the release when the key goes up
+//   brightness  0 (dark) .. 1 (bright)
+//   ringTime    seconds for a held string to die away by 60dB
+//   filter      optional FilterSettings
+// Plays on the note's delay line, which the engine hands every voice (see Note::mDelay), so
+// note on is a pluck into memory the voice already has.
+template<class Patch>
+struct PluckedDef {
+	static Instrument describe() {
+		Instrument inst;
+		inst.mVolume = Patch::volume;
+		inst.mEnvelope = makeEnvelope();
+		inst.mLayerCount = 0;
+		inst.mFilter = PatchFilter<Patch>::get();
+		inst.mStart = &PluckedDef::start;
+		// A string played again is plucked again
+		inst.mRetrigger = &PluckedDef::start;
+		inst.mRender = &PluckedDef::render;
+		return inst;
 	}
 
-	virtual double sound(double aTime, Note aNote, bool& aNoteFinished) {
-		double amp = mEnvelope.getAmp(aTime, aNote.mTimeOn, aNote.mTimeOff);
-		if (amp <= 0.0) {
+	static void start(Note& aNote, double aSampleRate) {
+		aNote.mEnvelope.noteOn(envelope(), aSampleRate);
+		if (aNote.mDelay.valid()) {
+			aNote.mString.pluck(aNote.mDelay, Utility::scale(aNote.mId), aSampleRate, Patch::brightness, Patch::ringTime, aNote.mSeed);
+		}
+	}
+
+	static void render(float* aLeft, float* aRight, int aFrames, const BlockTime& aTime, Note& aNote, bool& aNoteFinished) {
+		(void)aTime;
+		if (!aNote.mDelay.valid()) {
 			aNoteFinished = true;
+			return;
 		}
+		if (aRight == nullptr) {
+			renderString<false>(aLeft, aRight, aFrames, aNote, aNoteFinished);
+		} else {
+			renderString<true>(aLeft, aRight, aFrames, aNote, aNoteFinished);
+		}
+	}
 
-		double output = (
-			+ 1.00 * Synth::osc(aNote.mTimeOn - aTime, Utility::scale(aNote.mId), Synth::OSC_SQUARE, 5.0, 0.001)
-			+ 0.50 * Synth::osc(aNote.mTimeOn - aTime, Utility::scale(aNote.mId + 12), Synth::OSC_SQUARE)
-			+ 0.05 * Synth::osc(aNote.mTimeOn - aTime, Utility::scale(aNote.mId + 24), Synth::OSC_SQUARE)
-		);
+private:
+	// Below this the string has died away, even if the key is still held
+	static constexpr float SILENCE = 1e-4f;
 
-		return amp * output * mVolume;
+	static EnvelopeADSR makeEnvelope() {
+		EnvelopeADSR env;
+		env.mAttackTime = Patch::envelope.mAttackTime;
+		env.mDecayTime = Patch::envelope.mDecayTime;
+		env.mStartAmp = Patch::envelope.mStartAmp;
+		env.mSustainAmp = Patch::envelope.mSustainAmp;
+		env.mReleaseTime = Patch::envelope.mReleaseTime;
+		return env;
+	}
+
+	static const EnvelopeADSR& envelope() {
+		static const EnvelopeADSR env = makeEnvelope();
+		return env;
+	}
+
+	template<bool Stereo>
+	static void renderString(float* aLeft, float* aRight, int aFrames, Note& aNote, bool& aNoteFinished) {
+		float gain[RENDER_CHUNK];
+		float string[RENDER_CHUNK];
+		const float panLeft = aNote.mPanLeft;
+		const float panRight = aNote.mPanRight;
+		bool silent = false;
+
+		for (int start = 0; start < aFrames && !aNote.mEnvelope.idle() && !silent; start += RENDER_CHUNK) {
+			int n = std::min(RENDER_CHUNK, aFrames - start);
+			aNote.mEnvelope.render(gain, n);
+			float peak = aNote.mString.render(aNote.mDelay, string, n);
+
+			for (int i = 0; i < n; i++) {
+				float sample = gain[i] * string[i] * (float)Patch::volume;
+				if (Stereo) {
+					aLeft[start + i] += sample * panLeft;
+					aRight[start + i] += sample * panRight;
+				} else {
+					aLeft[start + i] += sample;
+				}
+			}
+
+			aNote.mLevel = gain[n - 1] * peak;
+			silent = peak < SILENCE;
+		}
+		aNoteFinished = aNote.mEnvelope.idle() || silent;
 	}
 };
 
-#endif
\ No newline at end of file
+struct PluckPatch {
+	static constexpr double volume = 1.0;
+	static constexpr EnvelopeSettings envelope = { 0.001, 0.0, 1.0, 1.0, 0.08 };
+	static constexpr double brightness = 0.5;
+	static constexpr double ringTime = 4.0;
+};
+
+// Saw pair through a resonant lowpass that opens with the envelope
+struct SweepPatch {
+	static constexpr double volume = 0.6;
+	static constexpr EnvelopeSettings envelope = { 0.3, 0.8, 1.0, 0.4, 0.5 };
+	static constexpr OscLayer layers[] = {
+		{ Synth::OSC_SAW, 0, 1.00f, 0.0, 0.0 },
+		{ Synth::OSC_SAW, 12, 0.40f, 0.3, 0.002 },
+	};
+	static constexpr FilterSettings filter = { FILTER_LOWPASS, 200.0, 4.0, 5.0 };
+};
+
+// Soft sine with a pink noise breath on top
+struct BreathPatch {
+	static constexpr double volume = 0.8;
+	static constexpr EnvelopeSettings envelope = { 0.08, 0.3, 1.0, 0.7, 0.3 };
+	static constexpr OscLayer layers[] = {
+		{ Synth::OSC_SINE, 0, 1.00f, 5.0, 0.002 },
+		{ Synth::OSC_NOISE_PINK, 0, 0.25f, 0.0, 0.0 },
+	};
+};
+
+// Triangle roughened by fBm noise whose lattice runs two octaves above the note
+struct WindPatch {
+	static constexpr double volume = 0.7;
+	static constexpr EnvelopeSettings envelope = { 0.2, 0.5, 1.0, 0.6, 0.6 };
+	static constexpr OscLayer layers[] = {
+		{ Synth::OSC_TRIANGLE, 0, 0.60f, 0.0, 0.0 },
+		{ Synth::OSC_FBM, 24, 0.80f, 0.0, 0.0, 6, 2.0, 0.55 },
+	};
+};
+
+typedef InstrumentDef<BellPatch> BellInstrument;
+typedef InstrumentDef<HarmonicaPatch> HarmonicaInstrument;
+typedef PluckedDef<PluckPatch> PluckInstrument;
+typedef InstrumentDef<SweepPatch> SweepInstrument;
+typedef InstrumentDef<BreathPatch> BreathInstrument;
+typedef InstrumentDef<WindPatch> WindInstrument;
+
+#endif
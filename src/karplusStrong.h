@@ -0,0 +1,102 @@
+#ifndef KARPLUSSTRONG_H
+#define KARPLUSSTRONG_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "delayLine.h"
+#include "noise.h"
+
+// Plucked string state for one voice, the delay line itself belongs to the voice (Note::mDelay).
+// The loop is the delay line, a two tap lowpass for brightness, a first order allpass that tunes
+// the fractional part of the period and a loss gain worked out from the ring time, so every
+// pitch dies away in the same time.
+struct KarplusString {
+	// Whole samples of delay, the filters make up the rest of the period
+	uint32_t mLength;
+	// Lowpass: out = (1 - w) * x + w * previous x, delays by w samples
+	float mLowpassWeight;
+	float mLowpassLast;
+	// Allpass fractional delay
+	float mAllpassCoeff;
+	float mAllpassIn;
+	float mAllpassOut;
+	// Gain per trip round the loop
+	float mLoss;
+
+	KarplusString() {
+		mLength = 0;
+		mLowpassWeight = 0.5f;
+		mLowpassLast = 0.0f;
+		mAllpassCoeff = 0.0f;
+		mAllpassIn = 0.0f;
+		mAllpassOut = 0.0f;
+		mLoss = 0.0f;
+	}
+
+	// Tune to aHertz and fill aLine with a noise burst. aBrightness 0..1 runs from the classic
+	// averaged (dark) string to no lowpass at all, aRingTime is the time to fall 60dB.
+	// Pitches too low for the line are played at the lowest pitch it holds.
+	void pluck(DelayLine& aLine, double aHertz, double aSampleRate, double aBrightness, double aRingTime, uint32_t aSeed) {
+		aBrightness = std::max(0.0, std::min(aBrightness, 1.0));
+		double weight = 0.5 * (1.0 - aBrightness);
+		double period = aSampleRate / std::max(aHertz, 1.0);
+
+		// Keep the allpass delay within 0.1 .. 1.1 samples where its phase delay is flat enough
+		double whole = std::floor(period - weight - 0.1);
+		whole = std::max(1.0, std::min(whole, (double)aLine.maxDelay()));
+		double fraction = std::max(0.1, period - weight - whole);
+
+		mLength = (uint32_t)whole;
+		mLowpassWeight = (float)weight;
+		mAllpassCoeff = (float)((1.0 - fraction) / (1.0 + fraction));
+		mLoss = (float)std::pow(10.0, -3.0 / (std::max(aRingTime, 0.001) * aSampleRate / (whole + weight + fraction)));
+		mLowpassLast = 0.0f;
+		mAllpassIn = 0.0f;
+		mAllpassOut = 0.0f;
+
+		// One period of noise, softened the same way the loop will soften it
+		NoiseGenerator noise;
+		noise.seed(aSeed);
+		float last = 0.0f;
+		for (uint32_t i = 0; i < mLength; i++) {
+			float x = noise.white();
+			aLine.write((1.0f - mLowpassWeight) * x + mLowpassWeight * last);
+			last = x;
+		}
+	}
+
+	// Write the next aFrames samples of the string to aOut, returns the loudest
+	float render(DelayLine& aLine, float* aOut, int aFrames) {
+		const uint32_t length = mLength;
+		const float weight = mLowpassWeight;
+		const float coeff = mAllpassCoeff;
+		const float loss = mLoss;
+		float lowpassLast = mLowpassLast;
+		float allpassIn = mAllpassIn;
+		float allpassOut = mAllpassOut;
+		float peak = 0.0f;
+
+		for (int i = 0; i < aFrames; i++) {
+			float x = aLine.read(length);
+			float lowpass = (1.0f - weight) * x + weight * lowpassLast;
+			lowpassLast = x;
+			float allpass = coeff * lowpass + allpassIn - coeff * allpassOut;
+			allpassIn = lowpass;
+			allpassOut = allpass;
+
+			float y = allpass * loss;
+			aLine.write(y);
+			aOut[i] = y;
+			peak = std::max(peak, std::fabs(y));
+		}
+
+		mLowpassLast = lowpassLast;
+		mAllpassIn = allpassIn;
+		mAllpassOut = allpassOut;
+		return peak;
+	}
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read only view of a whole file through the OS page cache, nothing is copied in. The view is
+// valid until close() or destruction. Empty files open with a null data()
+class MappedFile {
+private:
+	const uint8_t* mData;
+	size_t mSize;
+#ifdef _WIN32
+	HANDLE mFile;
+	HANDLE mMapping;
+#endif
+
+public:
+	MappedFile() {
+		mData = nullptr;
+		mSize = 0;
+#ifdef _WIN32
+		mFile = INVALID_HANDLE_VALUE;
+		mMapping = nullptr;
+#endif
+	}
+
+	~MappedFile() {
+		close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const std::string& aPath) {
+		close();
+#ifdef _WIN32
+		mFile = CreateFileA(aPath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (mFile == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(mFile, &size)) {
+			close();
+			return false;
+		}
+		mSize = (size_t)size.QuadPart;
+		if (mSize == 0) {
+			return true;
+		}
+		mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mMapping == nullptr) {
+			close();
+			return false;
+		}
+		mData = (const uint8_t*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+		if (mData == nullptr) {
+			close();
+			return false;
+		}
+#else
+		int fd = ::open(aPath.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat info;
+		if (fstat(fd, &info) != 0) {
+			::close(fd);
+			return false;
+		}
+		mSize = (size_t)info.st_size;
+		if (mSize > 0) {
+			void* view = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (view == MAP_FAILED) {
+				::close(fd);
+				mSize = 0;
+				return false;
+			}
+			// Read front to back once, so let the kernel read ahead
+			madvise(view, mSize, MADV_SEQUENTIAL);
+			mData = (const uint8_t*)view;
+		}
+		// The mapping keeps the file open
+		::close(fd);
+#endif
+		return true;
+	}
+
+	void close() {
+#ifdef _WIN32
+		if (mData != nullptr) {
+			UnmapViewOfFile(mData);
+		}
+		if (mMapping != nullptr) {
+			CloseHandle(mMapping);
+			mMapping = nullptr;
+		}
+		if (mFile != INVALID_HANDLE_VALUE) {
+			CloseHandle(mFile);
+			mFile = INVALID_HANDLE_VALUE;
+		}
+#else
+		if (mData != nullptr) {
+			munmap((void*)mData, mSize);
+		}
+#endif
+		mData = nullptr;
+		mSize = 0;
+	}
+
+	const uint8_t* data() const {
+		return mData;
+	}
+
+	size_t size() const {
+		return mSize;
+	}
+};
+
+#endif
@@ -0,0 +1,299 @@
+#ifndef MIDIFILE_H
+#define MIDIFILE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "mappedFile.h"
+#include "sequencer.h"
+
+const int MIDI_CHANNELS = 16;
+
+// How a MIDI file's channels land in the engine
+struct MidiLoadOptions {
+	// Engine channel (Note::mChannel, so the instrument and graph source) for each MIDI channel
+	// from 0, -1 drops it. MIDI channel N as numbered 1 to 16 plays engine channel N, 16 plays 0
+	int mChannelMap[MIDI_CHANNELS];
+	// Note ids are the key less 60, so middle C is id 0, plus this many semitones
+	int mTranspose;
+	// Controller 10 becomes pan events
+	bool mPan;
+
+	MidiLoadOptions() {
+		for (int c = 0; c < MIDI_CHANNELS; c++) {
+			mChannelMap[c] = (c + 1) % MIDI_CHANNELS;
+		}
+		mTranspose = 0;
+		mPan = true;
+	}
+};
+
+struct MidiFileInfo {
+	// 0 or 1
+	int mFormat;
+	int mTracks;
+	// Events put into the sequencer, and the time of the last one
+	long long mEvents;
+	double mSeconds;
+
+	MidiFileInfo() {
+		mFormat = 0;
+		mTracks = 0;
+		mEvents = 0;
+		mSeconds = 0.0;
+	}
+};
+
+// Standard MIDI File (format 0 and 1) reader. The file is mapped rather than read, and every
+// track is decoded in place by a cursor. The tracks are merged by a winner tree of cursors keyed
+// on their next event's tick, so events come out in time order in one pass and go straight into
+// the sequencer's array, which they reach in order so each is an append. Tempo changes are
+// followed as they come, ticks to frames is a multiply-add. Only note on/off and optionally
+// pan reach the sequencer, everything else is skipped over.
+//
+// The engine knows notes by id, which is their pitch, and channel, so the same key held on two
+// channels at once is two voices. A damaged track ends where the damage starts.
+class MidiFile {
+private:
+	struct Track {
+		const uint8_t* mPos;
+		const uint8_t* mEnd;
+		// Tick of the event at mPos
+		uint64_t mTick;
+		uint8_t mRunning;
+	};
+
+	static uint32_t u32(const uint8_t* p) {
+		return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+	}
+
+	static uint16_t u16(const uint8_t* p) {
+		return (uint16_t)((p[0] << 8) | p[1]);
+	}
+
+	// Variable length quantity, at most four bytes. False if it runs off the end
+	static bool varLen(const uint8_t*& p, const uint8_t* aEnd, uint32_t& aValue) {
+		uint32_t value = 0;
+		for (int i = 0; i < 4 && p < aEnd; i++) {
+			uint8_t b = *p++;
+			value = (value << 7) | (b & 0x7f);
+			if (!(b & 0x80)) {
+				aValue = value;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Read the delta time in front of the next event. False at the end of the track, or if the
+	// track ends before the event does
+	static bool advance(Track& aTrack) {
+		uint32_t delta;
+		if (aTrack.mPos >= aTrack.mEnd || !varLen(aTrack.mPos, aTrack.mEnd, delta)) {
+			return false;
+		}
+		aTrack.mTick += delta;
+		return aTrack.mPos < aTrack.mEnd;
+	}
+
+	// Tracks are numbered in the low bits of a tree key, ticks in the rest. No track's key reaches
+	// NO_TRACK, which marks a finished track
+	static constexpr int TRACK_BITS = 16;
+	static constexpr uint64_t TRACK_MASK = (1u << TRACK_BITS) - 1;
+	static constexpr uint64_t MAX_TICK = (1ull << (64 - TRACK_BITS)) - 2;
+	static constexpr uint64_t NO_TRACK = ~0ull;
+
+	static uint64_t key(const Track& aTrack, int aIndex) {
+		return (aTrack.mTick << TRACK_BITS) | (uint64_t)aIndex;
+	}
+
+	// Set a track's leaf of the winner tree to aKey and replay its matches up to the root, which
+	// it returns. The winner so far stays in a register and only the other side of each match is
+	// loaded, so there is no branch on the keys and no store to reload between levels
+	static uint64_t replay(std::vector<uint64_t>& aTree, size_t aLeaf, uint64_t aKey) {
+		size_t at = aLeaf;
+		aTree[at] = aKey;
+		while (at > 1) {
+			aKey = std::min(aKey, aTree[at ^ 1]);
+			at >>= 1;
+			aTree[at] = aKey;
+		}
+		return aKey;
+	}
+
+public:
+	// True if aPath starts like a MIDI file
+	static bool isMidi(const std::string& aPath) {
+		std::ifstream file(aPath, std::ios::binary);
+		char magic[4];
+		return file.read(magic, 4) && std::memcmp(magic, "MThd", 4) == 0;
+	}
+
+	// Map aPath and add its notes to aSequencer. False if it can't be read or isn't format 0 or 1
+	static bool load(const std::string& aPath, Sequencer& aSequencer, const MidiLoadOptions& aOptions = MidiLoadOptions(), MidiFileInfo* aInfo = nullptr) {
+		MappedFile file;
+		if (!file.open(aPath)) {
+			return false;
+		}
+		return parse(file.data(), file.size(), aSequencer, aOptions, aInfo);
+	}
+
+	// Decode an SMF image already in memory
+	static bool parse(const uint8_t* aData, size_t aSize, Sequencer& aSequencer, const MidiLoadOptions& aOptions = MidiLoadOptions(), MidiFileInfo* aInfo = nullptr) {
+		if (aData == nullptr || aSize < 14 || std::memcmp(aData, "MThd", 4) != 0 || u32(aData + 4) < 6) {
+			return false;
+		}
+		const int format = u16(aData + 8);
+		const int division = u16(aData + 12);
+		if (format > 1 || division == 0) {
+			return false;
+		}
+
+		// Ticks to sample frames: per quarter note at the current tempo (120bpm until told), or
+		// SMPTE frames of a number of ticks that no tempo changes. Each is one division of whole
+		// numbers, so a tick that falls on a frame lands on it exactly
+		const double sampleRate = (double)aSequencer.sampleRate();
+		const bool smpte = (division & 0x8000) != 0;
+		double framesPerTick;
+		if (smpte) {
+			const int fps = -(int)(int8_t)(division >> 8);
+			const int ticksPerFrame = division & 0xff;
+			if (fps <= 0 || ticksPerFrame == 0) {
+				return false;
+			}
+			framesPerTick = sampleRate / ((double)fps * ticksPerFrame);
+		} else {
+			framesPerTick = (500000.0 * sampleRate) / (1e6 * (double)division);
+		}
+
+		// Every MTrk chunk, skipping any others. A chunk that runs past the end is cut short
+		std::vector<Track> tracks;
+		for (uint64_t at = 8 + (uint64_t)u32(aData + 4); at + 8 <= aSize;) {
+			const uint64_t body = at + 8;
+			const uint64_t bodyEnd = std::min<uint64_t>(body + u32(aData + at + 4), aSize);
+			if (std::memcmp(aData + at, "MTrk", 4) == 0) {
+				Track track = { aData + body, aData + bodyEnd, 0, 0 };
+				if (advance(track) && tracks.size() <= TRACK_MASK) {
+					tracks.push_back(track);
+				}
+			}
+			at = bodyEnd;
+		}
+
+		// Winner tree of (tick, track) packed into one integer, so ties keep track order. The
+		// leaves are a power of two from tree[leaves], each node the smaller of its two children
+		size_t leaves = 1;
+		while (leaves < tracks.size()) {
+			leaves *= 2;
+		}
+		std::vector<uint64_t> tree(2 * leaves, NO_TRACK);
+		for (size_t t = 0; t < tracks.size(); t++) {
+			tree[leaves + t] = key(tracks[t], (int)t);
+		}
+		for (size_t n = leaves - 1; n >= 1; n--) {
+			tree[n] = std::min(tree[2 * n], tree[2 * n + 1]);
+		}
+		uint64_t top = tree[1];
+
+		uint64_t tempoTick = 0;
+		double tempoFrames = 0.0;
+		long long events = 0;
+		long long last = 0;
+
+		while (top != NO_TRACK) {
+			const int index = (int)(top & TRACK_MASK);
+			Track& track = tracks[index];
+			const uint8_t*& p = track.mPos;
+			// First frame at or after the tick, less rounding noise, as Sequencer::frameAt(). Ticks
+			// fit in 48 bits and frames are never negative, so the ceiling is a truncate and a
+			// compare rather than a call
+			const double frames = tempoFrames + (double)(int64_t)(track.mTick - tempoTick) * framesPerTick;
+			const double wanted = frames - 1e-6;
+			long long frame = (long long)wanted;
+			frame += ((double)frame < wanted) ? 1 : 0;
+			bool alive = true;
+
+			uint8_t status = *p;
+			if (status & 0x80) {
+				p++;
+			} else {
+				status = track.mRunning;
+			}
+
+			if (status < 0x80) {
+				// Data with no running status to go with it
+				alive = false;
+			} else if (status < 0xf0) {
+				track.mRunning = status;
+				const int kind = status & 0xf0;
+				const int bytes = (kind == 0xc0 || kind == 0xd0) ? 1 : 2;
+				if (track.mEnd - p < bytes) {
+					alive = false;
+				} else {
+					const int channel = aOptions.mChannelMap[status & 0x0f];
+					const int data1 = p[0] & 0x7f;
+					const int data2 = (bytes == 2) ? (p[1] & 0x7f) : 0;
+					p += bytes;
+					if (channel >= 0) {
+						if (kind == 0x90 && data2 > 0) {
+							aSequencer.add(frame, SEQ_NOTE_ON, data1 - 60 + aOptions.mTranspose, channel, 0.0f);
+							events++;
+							last = frame;
+						} else if (kind == 0x80 || kind == 0x90) {
+							aSequencer.add(frame, SEQ_NOTE_OFF, data1 - 60 + aOptions.mTranspose, channel, 0.0f);
+							events++;
+							last = frame;
+						} else if (kind == 0xb0 && data1 == 10 && aOptions.mPan) {
+							aSequencer.add(frame, SEQ_PAN, 0, channel, std::max(-1.0f, (float)(data2 - 64) / 63.0f));
+							events++;
+						}
+					}
+				}
+			} else {
+				// Meta and sysex events cancel running status
+				track.mRunning = 0;
+				uint8_t type = 0;
+				if (status == 0xff) {
+					if (p >= track.mEnd) {
+						alive = false;
+					} else {
+						type = *p++;
+					}
+				}
+				uint32_t length = 0;
+				if (!alive || (status != 0xff && status != 0xf0 && status != 0xf7) || !varLen(p, track.mEnd, length) || length > (uint32_t)(track.mEnd - p)) {
+					alive = false;
+				} else if (status == 0xff && type == 0x2f) {
+					alive = false;
+				} else {
+					if (status == 0xff && type == 0x51 && length == 3 && !smpte) {
+						// Microseconds per quarter note from here on
+						tempoFrames = frames;
+						tempoTick = track.mTick;
+						framesPerTick = ((double)((p[0] << 16) | (p[1] << 8) | p[2]) * sampleRate) / (1e6 * (double)division);
+					}
+					p += length;
+				}
+			}
+
+			// The track plays its matches again with its new key, or drops out
+			const bool more = alive && advance(track) && track.mTick <= MAX_TICK;
+			top = replay(tree, leaves + (size_t)index, more ? key(track, index) : NO_TRACK);
+		}
+
+		aSequencer.prepare();
+		if (aInfo != nullptr) {
+			aInfo->mFormat = format;
+			aInfo->mTracks = (int)tracks.size();
+			aInfo->mEvents = events;
+			aInfo->mSeconds = (double)last / sampleRate;
+		}
+		return true;
+	}
+};
+
+#endif
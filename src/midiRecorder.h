@@ -0,0 +1,295 @@
+#ifndef MIDIRECORDER_H
+#define MIDIRECORDER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "instrument.h"
+#include "midiFile.h"
+#include "ringBuffer.h"
+
+// Note events the audio thread hands the writer, more than a block of any script will fill
+const unsigned int RECORDER_QUEUE = 8192;
+
+// One applied note event at the stream frame it took effect on
+struct RecordedEvent {
+	long long mFrame;
+	NoteEventType mType;
+	int mId;
+	int mChannel;
+};
+
+// Records the notes an engine plays into a Standard MIDI File (format 0). The engine calls
+// record() for every event as it applies it and advance() after every block, both on the audio
+// thread, and both only store into a ring buffer or an atomic, so they never lock or allocate.
+// A full queue drops the event and counts it. A writer thread drains the queue every few
+// milliseconds and appends to the file, and after each append the file ends in a valid end of
+// track with its length patched in, so a performance killed part way through still loads.
+//
+// At the default 120bpm a tick is one frame when half the sample rate fits the header's 15 bit
+// division, as it does at 44.1 and 48kHz, so frames survive the round trip. Note ids are keys
+// less 60 as MidiFile reads them and engine channel N is written as MIDI channel N, 0 as 16.
+// Notes are told apart by id and channel as the engine does.
+class MidiRecorder {
+private:
+	unsigned int mSampleRate;
+	double mInterval;
+	RingBuffer<RecordedEvent, RECORDER_QUEUE> mQueue;
+	std::atomic<bool> mRecording;
+	// Stream frame the audio thread has rendered up to, and events lost to a full queue
+	std::atomic<long long> mFrame;
+	std::atomic<long long> mDropped;
+
+	// Writer side, the thread while recording and stop() after it has joined
+	std::ofstream mFile;
+	long long mStartFrame;
+	int mDivision;
+	double mTicksPerFrame;
+	uint64_t mLastTick;
+	// Bytes of track data before the end of track marker, which each append writes over
+	uint32_t mTrackBytes;
+	uint8_t mRunning;
+	// Id and channel of each sounding note
+	std::set<std::pair<int, int>> mHeld;
+	std::vector<uint8_t> mPending;
+	long long mEvents;
+
+	bool mStop;
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::thread mThread;
+
+	void loop() {
+		std::unique_lock<std::mutex> lock(mMutex);
+		while (!mStop) {
+			mWake.wait_for(lock, std::chrono::duration<double>(mInterval));
+			flush();
+		}
+	}
+
+	static int midiChannel(int aChannel) {
+		return (std::min(std::max(aChannel, 0), MIDI_CHANNELS - 1) + MIDI_CHANNELS - 1) % MIDI_CHANNELS;
+	}
+
+	void varLen(uint32_t aValue) {
+		uint8_t bytes[4];
+		int count = 0;
+		do {
+			bytes[count++] = (uint8_t)(aValue & 0x7f);
+			aValue >>= 7;
+		} while (aValue != 0 && count < 4);
+		while (count > 1) {
+			mPending.push_back(bytes[--count] | 0x80);
+		}
+		mPending.push_back(bytes[0]);
+	}
+
+	void message(long long aFrame, uint8_t aStatus, uint8_t aData1, uint8_t aData2) {
+		const uint64_t tick = (uint64_t)std::llround((double)std::max(0LL, aFrame - mStartFrame) * mTicksPerFrame);
+		varLen((uint32_t)std::min<uint64_t>(std::max(tick, mLastTick) - mLastTick, 0x0fffffff));
+		mLastTick = std::max(tick, mLastTick);
+		if (aStatus != mRunning) {
+			mPending.push_back(aStatus);
+			mRunning = aStatus;
+		}
+		mPending.push_back(aData1);
+		mPending.push_back(aData2);
+		mEvents++;
+	}
+
+	void noteOff(long long aFrame, int aId, int aChannel) {
+		// Note on at velocity 0, so a run of ons and offs keeps its running status
+		message(aFrame, (uint8_t)(0x90 | midiChannel(aChannel)), (uint8_t)(aId + 60), 0);
+	}
+
+	// Turn one engine event into MIDI, following which notes are held as the engine does
+	void encode(const RecordedEvent& aEvent) {
+		const int key = aEvent.mId + 60;
+		if (key < 0 || key > 127) {
+			return;
+		}
+		auto held = mHeld.find({ aEvent.mId, aEvent.mChannel });
+		if (aEvent.mType == NOTE_OFF) {
+			if (held != mHeld.end()) {
+				noteOff(aEvent.mFrame, aEvent.mId, aEvent.mChannel);
+				mHeld.erase(held);
+			}
+			return;
+		}
+		if (held != mHeld.end()) {
+			// Already sounding, a retrigger restarts it and a note on changes nothing
+			if (aEvent.mType != NOTE_RETRIGGER) {
+				return;
+			}
+			noteOff(aEvent.mFrame, aEvent.mId, aEvent.mChannel);
+		}
+		message(aEvent.mFrame, (uint8_t)(0x90 | midiChannel(aEvent.mChannel)), (uint8_t)key, 100);
+		mHeld.insert({ aEvent.mId, aEvent.mChannel });
+	}
+
+	// Write mPending over the end of track marker, then a new marker and the track length
+	void append() {
+		if (!mFile.is_open()) {
+			return;
+		}
+		const uint8_t end[4] = { 0x00, 0xff, 0x2f, 0x00 };
+		mPending.insert(mPending.end(), end, end + 4);
+		mFile.seekp(22 + (std::streamoff)mTrackBytes, std::ios::beg);
+		mFile.write((const char*)mPending.data(), (std::streamsize)mPending.size());
+		mTrackBytes += (uint32_t)mPending.size() - 4;
+		const uint32_t length = mTrackBytes + 4;
+		const uint8_t bytes[4] = { (uint8_t)(length >> 24), (uint8_t)(length >> 16), (uint8_t)(length >> 8), (uint8_t)length };
+		mFile.seekp(18, std::ios::beg);
+		mFile.write((const char*)bytes, 4);
+		mFile.flush();
+		mPending.clear();
+	}
+
+	// Drain the queue into the file, writer side
+	void flush() {
+		RecordedEvent e;
+		bool any = false;
+		while (mQueue.pop(e)) {
+			encode(e);
+			any = true;
+		}
+		if (any) {
+			append();
+		}
+	}
+
+	// Header, tempo and an empty track
+	void writeHeader() {
+		const uint8_t header[22] = { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1,
+			(uint8_t)(mDivision >> 8), (uint8_t)mDivision, 'M', 'T', 'r', 'k', 0, 0, 0, 0 };
+		mFile.write((const char*)header, 22);
+		// 500000us a quarter note, 120bpm
+		const uint8_t tempo[7] = { 0x00, 0xff, 0x51, 0x03, 0x07, 0xa1, 0x20 };
+		mPending.assign(tempo, tempo + 7);
+		mTrackBytes = 0;
+		append();
+	}
+
+public:
+	MidiRecorder(unsigned int aSampleRate = 44100, double aIntervalSeconds = 0.01) {
+		mSampleRate = aSampleRate;
+		mInterval = std::max(0.001, aIntervalSeconds);
+		mRecording = false;
+		mFrame = 0;
+		mDropped = 0;
+		mStartFrame = 0;
+		mDivision = std::max(1u, aSampleRate / 2);
+		while (mDivision > 0x7fff) {
+			mDivision /= 2;
+		}
+		mTicksPerFrame = 2.0 * (double)mDivision / (double)aSampleRate;
+		mLastTick = 0;
+		mTrackBytes = 0;
+		mRunning = 0;
+		mEvents = 0;
+		mStop = true;
+	}
+
+	~MidiRecorder() {
+		stop();
+	}
+
+	MidiRecorder(const MidiRecorder&) = delete;
+	MidiRecorder& operator=(const MidiRecorder&) = delete;
+
+	// Start a new file at aPath, time 0 being the frame the audio thread is up to. False if the
+	// file can't be created or a recording is already going. Control side
+	bool start(const std::string& aPath) {
+		if (mThread.joinable()) {
+			return false;
+		}
+		mFile.open(aPath, std::ios::binary | std::ios::trunc);
+		if (!mFile.is_open()) {
+			return false;
+		}
+		RecordedEvent stale;
+		while (mQueue.pop(stale)) {
+		}
+		mStartFrame = mFrame.load(std::memory_order_acquire);
+		mLastTick = 0;
+		mRunning = 0;
+		mHeld.clear();
+		mEvents = 0;
+		mDropped = 0;
+		writeHeader();
+		mStop = false;
+		mThread = std::thread(&MidiRecorder::loop, this);
+		mRecording.store(true, std::memory_order_release);
+		return true;
+	}
+
+	// Stop recording, release notes still held at the frame the audio thread is up to and close
+	// the file. Control side
+	void stop() {
+		mRecording.store(false, std::memory_order_release);
+		if (!mThread.joinable()) {
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mStop = true;
+		}
+		mWake.notify_all();
+		mThread.join();
+
+		flush();
+		const long long end = mFrame.load(std::memory_order_acquire);
+		for (const auto& held : mHeld) {
+			noteOff(end, held.first, held.second);
+		}
+		mHeld.clear();
+		append();
+		mFile.close();
+	}
+
+	bool recording() const {
+		return mRecording.load(std::memory_order_acquire);
+	}
+
+	// Audio thread: aEvent took effect on stream frame aFrame
+	void record(long long aFrame, const NoteEvent& aEvent) {
+		if (!mRecording.load(std::memory_order_acquire)) {
+			return;
+		}
+		if (!mQueue.push({ aFrame, aEvent.mType, aEvent.mId, aEvent.mChannel })) {
+			mDropped.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	// Audio thread: every frame before aFrame has been rendered
+	void advance(long long aFrame) {
+		mFrame.store(aFrame, std::memory_order_release);
+	}
+
+	// MIDI events written so far, writer side (after stop() from anywhere)
+	long long events() const {
+		return mEvents;
+	}
+
+	// Events lost because the writer fell behind
+	long long dropped() const {
+		return mDropped.load(std::memory_order_relaxed);
+	}
+
+	unsigned int sampleRate() const {
+		return mSampleRate;
+	}
+};
+
+#endif
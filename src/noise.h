@@ -0,0 +1,117 @@
+#ifndef NOISE_H
+#define NOISE_H
+
+#include <cstdint>
+
+// Rows of the Voss-McCartney pink noise generator, each one half the rate of the one before
+const int PINK_ROWS = 16;
+
+// Seeded noise for one voice. White noise is a hash of the seed and a sample counter, so a block
+// is a loop over independent samples the compiler can vectorise, the same seed always gives the
+// same stream and no state is shared between voices or threads. Pink noise is Voss-McCartney over
+// integer rows, so its running sum never drifts; brown noise is leaky integrated white noise.
+class NoiseGenerator {
+private:
+	uint32_t mSeed;
+	uint32_t mCounter;
+	// Pink rows and their sum, in white samples shifted down so PINK_ROWS + 1 of them can't overflow
+	int32_t mRows[PINK_ROWS];
+	int32_t mPinkSum;
+	float mBrown;
+
+	// Raw 32 bit white sample number aIndex of this stream
+	uint32_t bits(uint32_t aIndex) const {
+		return mix(mSeed ^ (aIndex * 0x9e3779b9u));
+	}
+
+	// Second stream for the pink rows, so they don't repeat the white samples
+	uint32_t rowBits(uint32_t aIndex) const {
+		return mix(bits(aIndex) + 0x68e31da4u);
+	}
+
+public:
+	// Integer finaliser with good avalanche (lowbias32)
+	static uint32_t mix(uint32_t x) {
+		x ^= x >> 16;
+		x *= 0x7feb352du;
+		x ^= x >> 15;
+		x *= 0x846ca68bu;
+		x ^= x >> 16;
+		return x;
+	}
+
+	static float toFloat(uint32_t aBits) {
+		// -1.0 .. 1.0, exactly representable steps of 2^-31
+		return (float)(int32_t)aBits * (1.0f / 2147483648.0f);
+	}
+
+	NoiseGenerator() {
+		seed(1);
+	}
+
+	// Seed for sub-stream aStream of aSeed, e.g. a voice of an engine or a layer of a voice
+	static uint32_t seedFor(uint32_t aSeed, uint32_t aStream) {
+		return mix(aSeed + mix(aStream + 0x632be5abu));
+	}
+
+	// Restart the stream
+	void seed(uint32_t aSeed) {
+		mSeed = aSeed;
+		mCounter = 0;
+		mPinkSum = 0;
+		for (int r = 0; r < PINK_ROWS; r++) {
+			mRows[r] = (int32_t)rowBits((uint32_t)r + 0x80000000u) >> 5;
+			mPinkSum += mRows[r];
+		}
+		mBrown = 0.0f;
+	}
+
+	float white() {
+		return toFloat(bits(mCounter++));
+	}
+
+	float pink() {
+		uint32_t n = mCounter;
+		int32_t w = (int32_t)bits(mCounter++) >> 5;
+		// Row r changes every 2^(r + 1) samples, picked by the counter's trailing zeros
+		if (n != 0) {
+			int r = 0;
+			while (((n >> r) & 1u) == 0 && r < PINK_ROWS - 1) {
+				r++;
+			}
+			int32_t fresh = (int32_t)rowBits(n) >> 5;
+			mPinkSum += fresh - mRows[r];
+			mRows[r] = fresh;
+		}
+		// Sum of PINK_ROWS + 1 values, scaled so its spread is about that of white noise
+		return (float)(mPinkSum + w) * (1.0f / 268435456.0f);
+	}
+
+	float brown() {
+		mBrown = (mBrown + 0.02f * white()) * (1.0f / 1.02f);
+		return mBrown * 3.5f;
+	}
+
+	// Add aGain * white noise for aFrames samples into aOut
+	void renderWhite(float* aOut, int aFrames, float aGain) {
+		const uint32_t start = mCounter;
+		for (int i = 0; i < aFrames; i++) {
+			aOut[i] += aGain * toFloat(bits(start + (uint32_t)i));
+		}
+		mCounter = start + (uint32_t)aFrames;
+	}
+
+	void renderPink(float* aOut, int aFrames, float aGain) {
+		for (int i = 0; i < aFrames; i++) {
+			aOut[i] += aGain * pink();
+		}
+	}
+
+	void renderBrown(float* aOut, int aFrames, float aGain) {
+		for (int i = 0; i < aFrames; i++) {
+			aOut[i] += aGain * brown();
+		}
+	}
+};
+
+#endif
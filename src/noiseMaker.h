@@ -66,26 +66,43 @@
 #include <thread>
 #include <atomic>
 #include <condition_variable>
-#include <functional>
+#include <algorithm>
 using namespace std;
 
+#include "audioSink.h"
+
 #define NOMINMAX
 #include <Windows.h>
 
 const double PI = 2.0 * acos(0.0);
 
+// winmm output as an AudioSink. The BlockScheduler drives it, write() waits for the sound card
+// to hand back a free block, so the scheduler runs at the device rate. T is the device sample
+// type: short, int or float.
 template<class T>
-class NoiseMaker
+class NoiseMaker : public AudioSink
 {
 public:
-	NoiseMaker(wstring sOutputDevice, unsigned int nSampleRate = 44100, unsigned int nChannels = 1, unsigned int nBlocks = 8, unsigned int nBlockSamples = 512)
+	NoiseMaker(wstring sOutputDevice, unsigned int nBlocks = 8, bool bDither = false)
+		: m_converter(SampleFormatOf<T>::value, bDither)
 	{
-		Create(sOutputDevice, nSampleRate, nChannels, nBlocks, nBlockSamples);
+		m_sOutputDevice = sOutputDevice;
+		m_nBlockCount = nBlocks;
+		m_bReady = false;
+		m_pBlockMemory = nullptr;
+		m_pWaveHeaders = nullptr;
+		m_nBlocksWritten = 0;
+		m_nUnderruns = 0;
 	}
 
 	~NoiseMaker()
 	{
-		Destroy();
+		close();
+	}
+
+	bool open(unsigned int nSampleRate, unsigned int nChannels, unsigned int nBlockFrames)
+	{
+		return Create(m_sOutputDevice, nSampleRate, nChannels, m_nBlockCount, nBlockFrames * nChannels);
 	}
 
 	bool Create(wstring sOutputDevice, unsigned int nSampleRate = 44100, unsigned int nChannels = 1, unsigned int nBlocks = 8, unsigned int nBlockSamples = 512)
@@ -97,31 +114,31 @@ public:
 		m_nBlockSamples = nBlockSamples;
 		m_nBlockFree = m_nBlockCount;
 		m_nBlockCurrent = 0;
+		m_nBlocksWritten = 0;
+		m_nUnderruns = 0;
 		m_pBlockMemory = nullptr;
 		m_pWaveHeaders = nullptr;
 
-		m_userFunction = nullptr;
-
 		// Validate device
 		vector<wstring> devices = Enumerate();
 		auto d = std::find(devices.begin(), devices.end(), sOutputDevice);
-		if (d != devices.end())
-		{
-			// Device is available
-			int nDeviceID = distance(devices.begin(), d);
-			WAVEFORMATEX waveFormat;
-			waveFormat.wFormatTag = WAVE_FORMAT_PCM;
-			waveFormat.nSamplesPerSec = m_nSampleRate;
-			waveFormat.wBitsPerSample = sizeof(T) * 8;
-			waveFormat.nChannels = m_nChannels;
-			waveFormat.nBlockAlign = (waveFormat.wBitsPerSample / 8) * waveFormat.nChannels;
-			waveFormat.nAvgBytesPerSec = waveFormat.nSamplesPerSec * waveFormat.nBlockAlign;
-			waveFormat.cbSize = 0;
-
-			// Open Device if valid
-			if (waveOutOpen(&m_hwDevice, nDeviceID, &waveFormat, (DWORD_PTR)waveOutProcWrap, (DWORD_PTR)this, CALLBACK_FUNCTION) != S_OK)
-				return Destroy();
-		}
+		if (d == devices.end())
+			return Destroy();
+
+		// Device is available
+		int nDeviceID = distance(devices.begin(), d);
+		WAVEFORMATEX waveFormat;
+		waveFormat.wFormatTag = (m_converter.format() == WAV_FLOAT32) ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+		waveFormat.nSamplesPerSec = m_nSampleRate;
+		waveFormat.wBitsPerSample = sizeof(T) * 8;
+		waveFormat.nChannels = m_nChannels;
+		waveFormat.nBlockAlign = (waveFormat.wBitsPerSample / 8) * waveFormat.nChannels;
+		waveFormat.nAvgBytesPerSec = waveFormat.nSamplesPerSec * waveFormat.nBlockAlign;
+		waveFormat.cbSize = 0;
+
+		// Open Device if valid
+		if (waveOutOpen(&m_hwDevice, nDeviceID, &waveFormat, (DWORD_PTR)waveOutProcWrap, (DWORD_PTR)this, CALLBACK_FUNCTION) != S_OK)
+			return Destroy();
 
 		// Allocate Wave|Block Memory
 		m_pBlockMemory = new T[m_nBlockCount * m_nBlockSamples];
@@ -142,13 +159,6 @@ public:
 		}
 
 		m_bReady = true;
-
-		m_thread = thread(&NoiseMaker::MainThread, this);
-
-		// Start the ball rolling
-		unique_lock<mutex> lm(m_muxBlockNotZero);
-		m_cvBlockNotZero.notify_one();
-
 		return true;
 	}
 
@@ -157,21 +167,78 @@ public:
 		return false;
 	}
 
-	void Stop()
+	void close()
 	{
+		if (!m_bReady)
+			return;
 		m_bReady = false;
-		m_thread.join();
+
+		// Let queued blocks play out, then hand the device back
+		waveOutReset(m_hwDevice);
+		for (unsigned int n = 0; n < m_nBlockCount; n++)
+			if (m_pWaveHeaders[n].dwFlags & WHDR_PREPARED)
+				waveOutUnprepareHeader(m_hwDevice, &m_pWaveHeaders[n], sizeof(WAVEHDR));
+		waveOutClose(m_hwDevice);
+
+		delete[] m_pWaveHeaders;
+		delete[] m_pBlockMemory;
+		m_pWaveHeaders = nullptr;
+		m_pBlockMemory = nullptr;
+	}
+
+	bool realtime() const
+	{
+		return true;
 	}
 
-	// Override to process current sample
-	virtual double UserProcess(int nChannel, double dTime)
+	const char* name() const
 	{
-		return 0.0;
+		return "winmm";
 	}
 
-	double GetTime()
+	long long underruns() const
 	{
-		return m_dGlobalTime;
+		return m_nUnderruns;
+	}
+
+	// Convert one block and queue it on the sound card, waits while every block is queued
+	bool write(const float* pSamples, int nFrames)
+	{
+		if (!m_bReady)
+			return false;
+
+		// Every block has come back from the sound card, so it has been playing silence
+		if (m_nBlocksWritten >= m_nBlockCount && m_nBlockFree == m_nBlockCount)
+			m_nUnderruns++;
+
+		// Wait for block to become available
+		if (m_nBlockFree == 0)
+		{
+			unique_lock<mutex> lm(m_muxBlockNotZero);
+			while (m_nBlockFree == 0) // sometimes, Windows signals incorrectly
+				m_cvBlockNotZero.wait(lm);
+		}
+
+		// Block is here, so use it
+		m_nBlockFree--;
+
+		// Prepare block for processing
+		if (m_pWaveHeaders[m_nBlockCurrent].dwFlags & WHDR_PREPARED)
+			waveOutUnprepareHeader(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
+
+		// One clip and convert pass for the whole block
+		unsigned int nSamples = min((unsigned int)nFrames * m_nChannels, m_nBlockSamples);
+		T* pBlock = m_pBlockMemory + m_nBlockCurrent * m_nBlockSamples;
+		m_converter.convert(pSamples, nSamples, (void*)pBlock);
+		m_pWaveHeaders[m_nBlockCurrent].dwBufferLength = nSamples * sizeof(T);
+
+		// Send block to sound device
+		waveOutPrepareHeader(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
+		waveOutWrite(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
+		m_nBlockCurrent++;
+		m_nBlockCurrent %= m_nBlockCount;
+		m_nBlocksWritten++;
+		return true;
 	}
 
 
@@ -188,45 +255,34 @@ public:
 		return sDevices;
 	}
 
-	void SetUserFunction(std::function<double(int, double)> func)
-	{
-		m_userFunction = func;
-	}
-
-	double clip(double dSample, double dMax)
-	{
-		if (dSample >= 0.0)
-			return fmin(dSample, dMax);
-		else
-			return fmax(dSample, -dMax);
-	}
-
 
 private:
-	std::function<double(int, double)> m_userFunction;
-
+	wstring m_sOutputDevice;
 	unsigned int m_nSampleRate;
 	unsigned int m_nChannels;
 	// Blocks are how fine you split each wavelength up - higher no. blocks means close to wavelength approximation (see derivative lim approx)
 	unsigned int m_nBlockCount;
 	unsigned int m_nBlockSamples;
 	unsigned int m_nBlockCurrent;
+	unsigned long long m_nBlocksWritten;
+	atomic<long long> m_nUnderruns;
+	SampleConverter m_converter;
 
 	T* m_pBlockMemory;
 	WAVEHDR* m_pWaveHeaders;
 	HWAVEOUT m_hwDevice;
 
-	thread m_thread;
 	atomic<bool> m_bReady;
 	atomic<unsigned int> m_nBlockFree;
 	condition_variable m_cvBlockNotZero;
 	mutex m_muxBlockNotZero;
 
-	atomic<double> m_dGlobalTime;
-
 	// Handler for soundcard request for more data
 	void waveOutProc(HWAVEOUT hWaveOut, UINT uMsg, DWORD dwParam1, DWORD dwParam2)
 	{
+		(void)hWaveOut;
+		(void)dwParam1;
+		(void)dwParam2;
 		if (uMsg != WOM_DONE) return;
 
 		m_nBlockFree++;
@@ -239,65 +295,6 @@ private:
 	{
 		((NoiseMaker*)dwInstance)->waveOutProc(hWaveOut, uMsg, dwParam1, dwParam2);
 	}
-
-	// Main thread. This loop responds to requests from the soundcard to fill 'blocks'
-	// with audio data. If no requests are available it goes dormant until the sound
-	// card is ready for more data. The block is fille by the "user" in some manner
-	// and then issued to the soundcard.
-	void MainThread()
-	{
-		m_dGlobalTime = 0.0;
-		double dTimeStep = 1.0 / (double)m_nSampleRate;
-
-		// Goofy hack to get maximum integer for a type at run-time
-		T nMaxSample = (T)pow(2, (sizeof(T) * 8) - 1) - 1;
-		double dMaxSample = (double)nMaxSample;
-		T nPreviousSample = 0;
-
-		while (m_bReady)
-		{
-			// Wait for block to become available
-			if (m_nBlockFree == 0)
-			{
-				unique_lock<mutex> lm(m_muxBlockNotZero);
-				while (m_nBlockFree == 0) // sometimes, Windows signals incorrectly
-					m_cvBlockNotZero.wait(lm);
-			}
-
-			// Block is here, so use it
-			m_nBlockFree--;
-
-			// Prepare block for processing
-			if (m_pWaveHeaders[m_nBlockCurrent].dwFlags & WHDR_PREPARED)
-				waveOutUnprepareHeader(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
-
-			T nNewSample = 0;
-			int nCurrentBlock = m_nBlockCurrent * m_nBlockSamples;
-
-			for (unsigned int n = 0; n < m_nBlockSamples; n += m_nChannels)
-			{
-				// User Process
-				for (unsigned int c = 0; c < m_nChannels; c++)
-				{
-					if (m_userFunction == nullptr)
-						nNewSample = (T)(clip(UserProcess(c, m_dGlobalTime), 1.0) * dMaxSample);
-					else
-						nNewSample = (T)(clip(m_userFunction(c, m_dGlobalTime), 1.0) * dMaxSample);
-
-					m_pBlockMemory[nCurrentBlock + n + c] = nNewSample;
-					nPreviousSample = nNewSample;
-				}
-
-				m_dGlobalTime = m_dGlobalTime + dTimeStep;
-			}
-
-			// Send block to sound device
-			waveOutPrepareHeader(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
-			waveOutWrite(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
-			m_nBlockCurrent++;
-			m_nBlockCurrent %= m_nBlockCount;
-		}
-	}
 };
 
 #endif
\ No newline at end of file
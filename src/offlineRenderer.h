@@ -0,0 +1,126 @@
+#ifndef OFFLINERENDERER_H
+#define OFFLINERENDERER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "synthEngine.h"
+#include "wavWriter.h"
+#include "audioSink.h"
+#include "blockScheduler.h"
+#include "blockTime.h"
+#include "sequencer.h"
+
+// One note of a scripted performance, times in seconds
+struct ScriptedNote {
+	double mTimeOn;
+	double mDuration;
+	int mId;
+	int mChannel;
+
+	ScriptedNote() {
+		mTimeOn = 0.0;
+		mDuration = 0.0;
+		mId = 0;
+		mChannel = 1;
+	}
+};
+
+struct RenderStats {
+	double mAudioSeconds;
+	double mWallSeconds;
+	double mRealtimeFactor;
+	long long mFrames;
+
+	RenderStats() {
+		mAudioSeconds = 0.0;
+		mWallSeconds = 0.0;
+		mRealtimeFactor = 0.0;
+		mFrames = 0;
+	}
+};
+
+// Plays a sequence through the engine into an AudioSink. With a file or null sink it runs as
+// fast as the CPU allows, no audio device or realtime pacing involved
+class OfflineRenderer {
+private:
+	struct ScriptEvent {
+		double mTime;
+		int mId;
+		int mChannel;
+		bool mOn;
+	};
+
+	SynthEngine& mEngine;
+	unsigned int mSampleRate;
+	unsigned int mChannels;
+	unsigned int mBlockFrames;
+
+public:
+	OfflineRenderer(SynthEngine& aEngine, unsigned int aSampleRate = 44100, unsigned int aChannels = 1, unsigned int aBlockFrames = 512)
+		: mEngine(aEngine), mSampleRate(aSampleRate), mChannels(aChannels), mBlockFrames(aBlockFrames) {}
+
+	// Bounce to a wav file
+	RenderStats render(const std::vector<ScriptedNote>& aNotes, const std::string& aOutPath, WavFormat aFormat = WAV_PCM16, double aTailTime = 1.0) {
+		WavSink sink(aOutPath, aFormat);
+		return render(aNotes, sink, aTailTime);
+	}
+
+	// Play notes into any sink, realtime sinks set the pace
+	RenderStats render(const std::vector<ScriptedNote>& aNotes, AudioSink& aSink, double aTailTime = 1.0) {
+		// Flatten into time ordered on/off events, so they go into the sequence in order
+		std::vector<ScriptEvent> events;
+		for (const ScriptedNote& n : aNotes) {
+			events.push_back({ n.mTimeOn, n.mId, n.mChannel, true });
+			events.push_back({ n.mTimeOn + n.mDuration, n.mId, n.mChannel, false });
+		}
+		std::stable_sort(events.begin(), events.end(), [](const ScriptEvent& a, const ScriptEvent& b) { return a.mTime < b.mTime; });
+
+		Sequencer sequencer(mSampleRate);
+		for (const ScriptEvent& e : events) {
+			if (e.mOn) {
+				sequencer.noteOn(e.mTime, e.mId, e.mChannel);
+			} else {
+				sequencer.noteOff(e.mTime, e.mId, e.mChannel);
+			}
+		}
+		return render(sequencer, aSink, aTailTime);
+	}
+
+	// Play aSequencer from the start into any sink for its length() and then aTailTime seconds
+	RenderStats render(Sequencer& aSequencer, AudioSink& aSink, double aTailTime = 1.0) {
+		RenderStats stats;
+		long long totalFrames = aSequencer.length() + (long long)(aTailTime * mSampleRate);
+		aSequencer.rewind();
+
+		BlockScheduler scheduler(aSink, mSampleRate, mChannels, mBlockFrames);
+		scheduler.setMonitor(&mEngine.monitor());
+		scheduler.setBlockFunction([&](float* aOut, int aFrames, int aChannels, const BlockTime& aTime) {
+			aSequencer.process(mEngine, aOut, aFrames, aChannels, aTime);
+		});
+
+		auto wallStart = std::chrono::steady_clock::now();
+		if (!scheduler.run(totalFrames)) {
+			std::cerr << "Could not write to the " << aSink.name() << " sink" << std::endl;
+			return stats;
+		}
+		auto wallEnd = std::chrono::steady_clock::now();
+
+		stats.mFrames = totalFrames;
+		stats.mAudioSeconds = (double)totalFrames / (double)mSampleRate;
+		stats.mWallSeconds = std::chrono::duration<double>(wallEnd - wallStart).count();
+		stats.mRealtimeFactor = (stats.mWallSeconds > 0.0) ? stats.mAudioSeconds / stats.mWallSeconds : 0.0;
+
+		// stderr, stdout may be carrying the audio
+		std::cerr << "Rendered " << stats.mAudioSeconds << "s of audio in " << stats.mWallSeconds
+			<< "s (" << stats.mRealtimeFactor << "x realtime)" << std::endl;
+
+		return stats;
+	}
+};
+
+#endif
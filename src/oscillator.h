@@ -0,0 +1,275 @@
+#ifndef OSCILLATOR_H
+#define OSCILLATOR_H
+
+#include <algorithm>
+#include <cmath>
+
+#include "utils.h"
+#include "noise.h"
+#include "fbmNoise.h"
+
+// Stateful oscillator for one voice layer. Phase is kept normalised to 0..1 and advanced by a
+// per sample increment, so long notes don't lose precision the way Synth::osc(aTime) does.
+// The LFO is a rotating sin/cos pair, so it costs a few multiplies per sample rather than a sin.
+// Square, pulse, saw and triangle are band-limited with PolyBLEP/PolyBLAMP corrections so they stay
+// alias-free up the keyboard for a handful of multiplies per sample.
+// Noise waveforms come from a NoiseGenerator and FbmNoise of the oscillator's own, seeded with seed().
+struct Oscillator {
+	Synth::WaveForm mWaveForm;
+	// Normalised phase and cycles per sample
+	double mPhase;
+	double mIncrement;
+	// LFO phase modulation depth in cycles
+	double mLfoDepth;
+	double mLfoSin;
+	double mLfoCos;
+	double mLfoRotSin;
+	double mLfoRotCos;
+	// Duty cycle for OSC_PULSE, 0..1
+	double mPulseWidth;
+	NoiseGenerator mNoise;
+	FbmNoise mFbm;
+	// OSC_FBM octave count, frequency and weight ratio between octaves
+	int mFbmOctaves;
+	double mFbmLacunarity;
+	double mFbmGain;
+
+	Oscillator() {
+		mWaveForm = Synth::OSC_SINE;
+		mPhase = 0.0;
+		mIncrement = 0.0;
+		mLfoDepth = 0.0;
+		mLfoSin = 0.0;
+		mLfoCos = 1.0;
+		mLfoRotSin = 0.0;
+		mLfoRotCos = 1.0;
+		mPulseWidth = 0.5;
+		mFbmOctaves = 4;
+		mFbmLacunarity = 2.0;
+		mFbmGain = 0.5;
+	}
+
+	// Polynomial band-limited step residual, t is the phase and dt the phase increment
+	static double polyBlep(double t, double dt) {
+		if (t < dt) {
+			t /= dt;
+			return t + t - t * t - 1.0;
+		}
+		if (t > 1.0 - dt) {
+			t = (t - 1.0) / dt;
+			return t * t + t + t + 1.0;
+		}
+		return 0.0;
+	}
+
+	// Integrated PolyBLEP, smooths a discontinuity in slope
+	static double polyBlamp(double t, double dt) {
+		if (t < dt) {
+			t = t / dt - 1.0;
+			return -t * t * t / 3.0;
+		}
+		if (t > 1.0 - dt) {
+			t = (t - 1.0) / dt + 1.0;
+			return t * t * t / 3.0;
+		}
+		return 0.0;
+	}
+
+	static double wrap(double p) {
+		return (p >= 1.0) ? p - 1.0 : p;
+	}
+
+	// Same parameters as Synth::osc, restarts the phase
+	void start(double aHertz, double aSampleRate, Synth::WaveForm aWaveForm = Synth::OSC_SINE, double aLFOHertz = 0.0, double aLFOAmp = 0.0) {
+		mWaveForm = aWaveForm;
+		mPhase = 0.0;
+		mIncrement = aHertz / aSampleRate;
+
+		// Synth::osc adds aLFOAmp * aHertz radians of phase at the LFO peak
+		mLfoDepth = aLFOAmp * aHertz / (2.0 * Utility::pi);
+		mLfoSin = 0.0;
+		mLfoCos = 1.0;
+		double lfoStep = Utility::freqToVel(aLFOHertz) / aSampleRate;
+		mLfoRotSin = std::sin(lfoStep);
+		mLfoRotCos = std::cos(lfoStep);
+
+		if (aWaveForm == Synth::OSC_FBM) {
+			mFbm.start(aHertz, aSampleRate, mFbmOctaves, mFbmLacunarity, mFbmGain);
+		}
+	}
+
+	// OSC_FBM settings, taken by the next start()
+	void setFbm(int aOctaves, double aLacunarity, double aGain) {
+		mFbmOctaves = aOctaves;
+		mFbmLacunarity = aLacunarity;
+		mFbmGain = aGain;
+	}
+
+	// Restart the noise stream, the same seed always gives the same noise
+	void seed(uint32_t aSeed) {
+		mNoise.seed(aSeed);
+		mFbm.seed(aSeed);
+	}
+
+	void setFrequency(double aHertz, double aSampleRate) {
+		mIncrement = aHertz / aSampleRate;
+	}
+
+	// One sample of Wave at phase p, dt is the phase increment and aWidth the OSC_PULSE duty cycle
+	template<Synth::WaveForm Wave>
+	static double shape(double p, double dt, double aWidth) {
+		switch (Wave) {
+		case Synth::OSC_SINE:
+			return std::sin(2.0 * Utility::pi * p);
+
+		case Synth::OSC_SQUARE:
+		case Synth::OSC_PULSE: {
+			const double width = (Wave == Synth::OSC_SQUARE) ? 0.5 : aWidth;
+			double naive = (p < width) ? 1.0 : -1.0;
+			return naive + polyBlep(p, dt) - polyBlep(wrap(p + 1.0 - width), dt);
+		}
+
+		case Synth::OSC_TRIANGLE: {
+			// Corners at 0.25 and 0.75 where the slope flips by 8 per cycle (8 * dt per sample),
+			// the residuals are normalised to a change of 2 like the PolyBLEP step
+			double naive = (p < 0.25) ? 4.0 * p : ((p < 0.75) ? 2.0 - 4.0 * p : 4.0 * p - 4.0);
+			return naive
+				- 4.0 * dt * polyBlamp(wrap(p + 0.75), dt)
+				+ 4.0 * dt * polyBlamp(wrap(p + 0.25), dt);
+		}
+
+		case Synth::OSC_SAW_LIM:
+		case Synth::OSC_SAW:
+			// OSC_SAW_LIM was a 99 harmonic additive saw, the PolyBLEP saw replaces it
+			return 2.0 * p - 1.0 - polyBlep(p, dt);
+
+		// Noise has state, OscillatorCursor::next takes it from the oscillator's NoiseGenerator
+		default:
+			return 0.0;
+		}
+	}
+
+	// Add aGain * waveform for aFrames samples into aOut
+	void renderAdd(float* aOut, int aFrames, float aGain) {
+		switch (mWaveForm) {
+		case Synth::OSC_SINE: renderWave<Synth::OSC_SINE>(aOut, aFrames, aGain); break;
+		case Synth::OSC_SQUARE: renderWave<Synth::OSC_SQUARE>(aOut, aFrames, aGain); break;
+		case Synth::OSC_PULSE: renderWave<Synth::OSC_PULSE>(aOut, aFrames, aGain); break;
+		case Synth::OSC_TRIANGLE: renderWave<Synth::OSC_TRIANGLE>(aOut, aFrames, aGain); break;
+		case Synth::OSC_SAW_LIM:
+		case Synth::OSC_SAW: renderWave<Synth::OSC_SAW>(aOut, aFrames, aGain); break;
+		case Synth::OSC_NOISE: mNoise.renderWhite(aOut, aFrames, aGain); break;
+		case Synth::OSC_NOISE_PINK: mNoise.renderPink(aOut, aFrames, aGain); break;
+		case Synth::OSC_NOISE_BROWN: mNoise.renderBrown(aOut, aFrames, aGain); break;
+		case Synth::OSC_FBM: mFbm.render(aOut, aFrames, aGain); break;
+		default:
+			break;
+		}
+	}
+
+private:
+	template<Synth::WaveForm Wave>
+	void renderWave(float* aOut, int aFrames, float aGain);
+};
+
+// Oscillator state copied into locals for one block, so several oscillators can be stepped
+// together in one loop. Lfo says whether the oscillator has phase modulation.
+struct OscillatorCursor {
+	double mPhase;
+	double mIncrement;
+	double mLfoDepth;
+	double mLfoSin;
+	double mLfoCos;
+	double mLfoRotSin;
+	double mLfoRotCos;
+	double mPulseWidth;
+	// Noise waveforms advance the oscillator's generators in place
+	NoiseGenerator* mNoise;
+	FbmNoise* mFbm;
+	// OSC_FBM is rendered a block at a time by prepare() and handed out by next()
+	float mBlock[FBM_CHUNK];
+	int mBlockPos;
+
+	OscillatorCursor(Oscillator& aOsc) {
+		mPhase = aOsc.mPhase;
+		mIncrement = aOsc.mIncrement;
+		mLfoDepth = aOsc.mLfoDepth;
+		mLfoSin = aOsc.mLfoSin;
+		mLfoCos = aOsc.mLfoCos;
+		mLfoRotSin = aOsc.mLfoRotSin;
+		mLfoRotCos = aOsc.mLfoRotCos;
+		mPulseWidth = aOsc.mPulseWidth;
+		mNoise = &aOsc.mNoise;
+		mFbm = &aOsc.mFbm;
+		mBlockPos = 0;
+	}
+
+	// Call before the next aFrames (at most FBM_CHUNK) calls of next<Wave>
+	template<Synth::WaveForm Wave>
+	void prepare(int aFrames) {
+		if (Wave == Synth::OSC_FBM) {
+			std::fill(mBlock, mBlock + aFrames, 0.0f);
+			mFbm->render(mBlock, aFrames, 1.0f);
+			mBlockPos = 0;
+		}
+	}
+
+	// Current sample, then advance one sample
+	template<Synth::WaveForm Wave, bool Lfo>
+	double next() {
+		switch (Wave) {
+		case Synth::OSC_NOISE: return mNoise->white();
+		case Synth::OSC_NOISE_PINK: return mNoise->pink();
+		case Synth::OSC_NOISE_BROWN: return mNoise->brown();
+		case Synth::OSC_FBM: return mBlock[mBlockPos++];
+		default: break;
+		}
+
+		double value;
+		if (Lfo) {
+			double p = mPhase + mLfoDepth * mLfoSin;
+			p -= std::floor(p);
+			value = Oscillator::shape<Wave>(p, mIncrement, mPulseWidth);
+
+			double s = mLfoSin * mLfoRotCos + mLfoCos * mLfoRotSin;
+			mLfoCos = mLfoCos * mLfoRotCos - mLfoSin * mLfoRotSin;
+			mLfoSin = s;
+		} else {
+			value = Oscillator::shape<Wave>(mPhase, mIncrement, mPulseWidth);
+		}
+
+		mPhase += mIncrement;
+		if (mPhase >= 1.0) mPhase -= 1.0;
+		return value;
+	}
+
+	// Write the advanced state back at the end of the block
+	template<bool Lfo>
+	void store(Oscillator& aOsc) const {
+		aOsc.mPhase = mPhase;
+		if (Lfo) {
+			// Pull the phasor back onto the unit circle once per block
+			double norm = 1.5 - 0.5 * (mLfoSin * mLfoSin + mLfoCos * mLfoCos);
+			aOsc.mLfoSin = mLfoSin * norm;
+			aOsc.mLfoCos = mLfoCos * norm;
+		}
+	}
+};
+
+template<Synth::WaveForm Wave>
+void Oscillator::renderWave(float* aOut, int aFrames, float aGain) {
+	OscillatorCursor cursor(*this);
+	if (mLfoDepth == 0.0) {
+		for (int i = 0; i < aFrames; i++) {
+			aOut[i] += aGain * (float)cursor.next<Wave, false>();
+		}
+		cursor.store<false>(*this);
+	} else {
+		for (int i = 0; i < aFrames; i++) {
+			aOut[i] += aGain * (float)cursor.next<Wave, true>();
+		}
+		cursor.store<true>(*this);
+	}
+}
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef REVERB_H
+#define REVERB_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "convolver.h"
+#include "delayLine.h"
+#include "effect.h"
+#include "wavReader.h"
+
+// Lines of the feedback delay network
+const int FDN_LINES = 8;
+
+// Feedback delay network: FDN_LINES delay lines of mutually prime lengths fed back through a
+// Householder matrix, which mixes every line into every other for the cost of one sum. Each line
+// has a one pole lowpass for high frequency damping and a gain that makes every line fall 60dB
+// in the decay time whatever its length. Even lines feed the left output and odd ones the right.
+class FdnReverb : public Effect {
+private:
+	DelayLinePool mPool;
+	DelayLine mLines[FDN_LINES];
+	uint32_t mLength[FDN_LINES];
+	float mGain[FDN_LINES];
+	float mLowpass[FDN_LINES];
+	float mDamping;
+	double mDecayTime;
+
+public:
+	// aSize scales the room (line lengths), aDamping 0..1 darkens the tail
+	FdnReverb(double aSampleRate, double aDecayTime = 2.0, double aSize = 1.0, double aDamping = 0.3, float aWet = 0.3f) {
+		// Milliseconds, primes so the lines' echoes don't line up
+		static const double lengths[FDN_LINES] = { 29.0, 37.0, 41.0, 43.0, 53.0, 59.0, 67.0, 73.0 };
+		aDecayTime = std::max(0.05, aDecayTime);
+		aSize = std::max(0.05, aSize);
+
+		uint32_t longest = 1;
+		for (int k = 0; k < FDN_LINES; k++) {
+			mLength[k] = std::max<uint32_t>(1, (uint32_t)(lengths[k] * 0.001 * aSize * aSampleRate));
+			longest = std::max(longest, mLength[k]);
+		}
+		mPool.allocate(FDN_LINES, longest + 1);
+		for (int k = 0; k < FDN_LINES; k++) {
+			mLines[k] = mPool.line(k);
+			mGain[k] = (float)std::pow(10.0, -3.0 * (double)mLength[k] / (aDecayTime * aSampleRate));
+			mLowpass[k] = 0.0f;
+		}
+		mDamping = (float)std::max(0.0, std::min(aDamping, 0.99));
+		mDecayTime = aDecayTime;
+		setWet(aWet);
+	}
+
+	double tailTime() const override {
+		return mDecayTime;
+	}
+
+	void process(float* aLeft, float* aRight, int aFrames) override {
+		const float damping = mDamping;
+		const float householder = 2.0f / (float)FDN_LINES;
+		// Half the lines reach each side
+		const float outGain = mWet * 2.0f / (float)FDN_LINES;
+		float taps[FDN_LINES];
+
+		for (int i = 0; i < aFrames; i++) {
+			const float in = (aRight != nullptr) ? 0.5f * (aLeft[i] + aRight[i]) : aLeft[i];
+
+			float sum = 0.0f;
+			for (int k = 0; k < FDN_LINES; k++) {
+				float out = mLines[k].read(mLength[k]);
+				mLowpass[k] = out + damping * (mLowpass[k] - out);
+				taps[k] = mLowpass[k] * mGain[k];
+				sum += taps[k];
+			}
+
+			float left = 0.0f;
+			float right = 0.0f;
+			for (int k = 0; k < FDN_LINES; k += 2) {
+				left += taps[k];
+				right += taps[k + 1];
+			}
+			for (int k = 0; k < FDN_LINES; k++) {
+				mLines[k].write(taps[k] - householder * sum + in);
+			}
+
+			if (aRight != nullptr) {
+				aLeft[i] += outGain * left;
+				aRight[i] += outGain * right;
+			} else {
+				aLeft[i] += outGain * 0.5f * (left + right);
+			}
+		}
+	}
+};
+
+// Convolution with a recorded impulse response. A mono IR is used for both sides, a stereo one
+// gives each side its own. See PartitionedConvolver for how long IRs stay cheap.
+class ConvolutionReverb : public Effect {
+private:
+	PartitionedConvolver mConvolver[2];
+	std::vector<float> mScratch;
+	bool mLoaded;
+	double mLength;
+
+public:
+	ConvolutionReverb(float aWet = 0.3f) {
+		mScratch.assign(EFFECT_CHUNK, 0.0f);
+		mLoaded = false;
+		mLength = 0.0;
+		setWet(aWet);
+	}
+
+	// Resample aIr to aSampleRate if it differs and set both sides up. The IR is scaled to unit
+	// energy, so the wet gain means the same for any IR
+	void setup(const WavData& aIr, double aSampleRate) {
+		const size_t frames = aIr.frames();
+		const double ratio = (aIr.mSampleRate > 0) ? (double)aIr.mSampleRate / aSampleRate : 1.0;
+		const size_t length = (frames > 0) ? (size_t)((double)(frames - 1) / ratio) + 1 : 0;
+		std::vector<float> sides[2];
+		double energy = 0.0;
+
+		for (int side = 0; side < 2; side++) {
+			const unsigned int channel = std::min<unsigned int>(side, std::max(1u, aIr.mChannels) - 1);
+			sides[side].resize(length);
+			for (size_t i = 0; i < length; i++) {
+				double pos = (double)i * ratio;
+				size_t whole = std::min((size_t)pos, frames - 1);
+				size_t next = std::min(whole + 1, frames - 1);
+				double t = pos - (double)whole;
+				float a = aIr.mSamples[whole * aIr.mChannels + channel];
+				float b = aIr.mSamples[next * aIr.mChannels + channel];
+				sides[side][i] = (float)(a + (b - a) * t);
+			}
+			double sideEnergy = 0.0;
+			for (float h : sides[side]) {
+				sideEnergy += (double)h * h;
+			}
+			energy = std::max(energy, sideEnergy);
+		}
+
+		const float scale = (energy > 0.0) ? (float)(1.0 / std::sqrt(energy)) : 0.0f;
+		for (int side = 0; side < 2; side++) {
+			for (float& h : sides[side]) {
+				h *= scale;
+			}
+			mConvolver[side].setup(sides[side].data(), (int)length);
+		}
+		mLoaded = length > 0;
+		mLength = (double)length / aSampleRate;
+	}
+
+	// Read and set up an IR from a WAV file, false if it can't be read
+	bool load(const std::string& aPath, double aSampleRate) {
+		WavData ir;
+		if (!WavReader::load(aPath, ir) || ir.frames() == 0) {
+			return false;
+		}
+		setup(ir, aSampleRate);
+		return true;
+	}
+
+	double tailTime() const override {
+		return mLength;
+	}
+
+	void process(float* aLeft, float* aRight, int aFrames) override {
+		if (!mLoaded) {
+			return;
+		}
+		float* sides[2] = { aLeft, aRight };
+		for (int side = 0; side < 2 && sides[side] != nullptr; side++) {
+			float* io = sides[side];
+			for (int start = 0; start < aFrames; start += EFFECT_CHUNK) {
+				const int n = std::min(EFFECT_CHUNK, aFrames - start);
+				mConvolver[side].process(io + start, mScratch.data(), n);
+				for (int i = 0; i < n; i++) {
+					io[start + i] += mWet * mScratch[i];
+				}
+			}
+		}
+	}
+};
+
+#endif
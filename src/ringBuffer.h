@@ -0,0 +1,55 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <atomic>
+
+// Bounded single producer / single consumer queue. Capacity must be a power of two,
+// push() is only called from one thread and pop() from one other thread.
+// Neither side locks or allocates.
+template<class T, unsigned int Capacity>
+class RingBuffer {
+	static_assert((Capacity & (Capacity - 1)) == 0, "RingBuffer capacity must be a power of two");
+
+private:
+	static const unsigned int kMask = Capacity - 1;
+
+	T mItems[Capacity];
+	// Head and tail live on separate cache lines so the two threads don't false share
+	alignas(64) std::atomic<unsigned int> mHead;
+	alignas(64) std::atomic<unsigned int> mTail;
+
+public:
+	RingBuffer() : mHead(0), mTail(0) {}
+
+	// Producer side, returns false when full
+	bool push(const T& aItem) {
+		unsigned int tail = mTail.load(std::memory_order_relaxed);
+		if (tail - mHead.load(std::memory_order_acquire) >= Capacity) {
+			return false;
+		}
+		mItems[tail & kMask] = aItem;
+		mTail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side, returns false when empty
+	bool pop(T& aItem) {
+		unsigned int head = mHead.load(std::memory_order_relaxed);
+		if (head == mTail.load(std::memory_order_acquire)) {
+			return false;
+		}
+		aItem = mItems[head & kMask];
+		mHead.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const {
+		return mHead.load(std::memory_order_acquire) == mTail.load(std::memory_order_acquire);
+	}
+
+	unsigned int capacity() const {
+		return Capacity;
+	}
+};
+
+#endif
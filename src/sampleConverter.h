@@ -0,0 +1,199 @@
+#ifndef SAMPLECONVERTER_H
+#define SAMPLECONVERTER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "cpuFeatures.h"
+#include "simdOps.h"
+
+// Output sample formats, picked when a sink is created
+enum WavFormat {
+	WAV_PCM16 = 0,
+	WAV_FLOAT32,
+	// Packed 3 byte samples
+	WAV_PCM24,
+	WAV_PCM32,
+};
+
+// Output format of a device sample type, for sinks templated on it
+template<class T> struct SampleFormatOf;
+template<> struct SampleFormatOf<short> { static const WavFormat value = WAV_PCM16; };
+template<> struct SampleFormatOf<int> { static const WavFormat value = WAV_PCM32; };
+template<> struct SampleFormatOf<float> { static const WavFormat value = WAV_FLOAT32; };
+
+// Samples converted per pass, and the dither table is this much longer than its period
+const int CONVERT_CHUNK = 256;
+const int DITHER_PERIOD = 4096;
+
+// Conversion kernels, one copy per instruction set
+namespace SimdScalar {
+#include "convertKernel.inl"
+}
+#if defined(SYNTH_X86)
+namespace SimdSse2 {
+#include "convertKernel.inl"
+}
+SYNTH_TARGET_AVX2_BEGIN
+namespace SimdAvx2 {
+#include "convertKernel.inl"
+}
+SYNTH_TARGET_END
+SYNTH_TARGET_AVX512_BEGIN
+namespace SimdAvx512 {
+#include "convertKernel.inl"
+}
+SYNTH_TARGET_END
+#endif
+
+// Turns float blocks in -1.0 .. 1.0 into little endian bytes of one WavFormat in a single clip,
+// dither and convert pass. Integer formats are clipped and truncated towards zero; with dither on,
+// triangular noise of +-1 step is added first (16 and 24 bit only, 32 bit has no use for it).
+// Float output is passed through unclipped.
+class SampleConverter {
+private:
+	typedef void(*ConvertKernel)(const float*, const float*, float, int32_t*, int);
+
+	WavFormat mFormat;
+	bool mDither;
+	uint32_t mRandom;
+	std::vector<float> mDitherTable;
+	ConvertKernel mKernel;
+	int32_t mInts[CONVERT_CHUNK];
+
+	static ConvertKernel kernelFor(SimdLevel aLevel) {
+		switch (aLevel) {
+#if defined(SYNTH_X86)
+		case SIMD_AVX512: return SimdAvx512::convertToInt;
+		case SIMD_AVX2: return SimdAvx2::convertToInt;
+		case SIMD_SSE2: return SimdSse2::convertToInt;
+#endif
+		default: return SimdScalar::convertToInt;
+		}
+	}
+
+	uint32_t nextRandom() {
+		// xorshift32
+		mRandom ^= mRandom << 13;
+		mRandom ^= mRandom >> 17;
+		mRandom ^= mRandom << 5;
+		return mRandom;
+	}
+
+	// Largest value a full scale sample maps to, kept below 2^31 so it still fits once truncated
+	float scale() const {
+		switch (mFormat) {
+		case WAV_PCM24: return 8388607.0f;
+		case WAV_PCM32: return 2147483520.0f;
+		case WAV_PCM16: default: return 32767.0f;
+		}
+	}
+
+	void pack(const int32_t* aIn, int aCount, unsigned char* aOut) const {
+		switch (mFormat) {
+		case WAV_PCM24:
+			for (int i = 0; i < aCount; i++) {
+				uint32_t v = (uint32_t)aIn[i];
+				aOut[i * 3] = (unsigned char)(v & 0xff);
+				aOut[i * 3 + 1] = (unsigned char)((v >> 8) & 0xff);
+				aOut[i * 3 + 2] = (unsigned char)((v >> 16) & 0xff);
+			}
+			break;
+		case WAV_PCM32:
+			for (int i = 0; i < aCount; i++) {
+				uint32_t v = (uint32_t)aIn[i];
+				aOut[i * 4] = (unsigned char)(v & 0xff);
+				aOut[i * 4 + 1] = (unsigned char)((v >> 8) & 0xff);
+				aOut[i * 4 + 2] = (unsigned char)((v >> 16) & 0xff);
+				aOut[i * 4 + 3] = (unsigned char)((v >> 24) & 0xff);
+			}
+			break;
+		case WAV_PCM16: default:
+			for (int i = 0; i < aCount; i++) {
+				uint32_t v = (uint32_t)aIn[i];
+				aOut[i * 2] = (unsigned char)(v & 0xff);
+				aOut[i * 2 + 1] = (unsigned char)((v >> 8) & 0xff);
+			}
+			break;
+		}
+	}
+
+public:
+	SampleConverter(WavFormat aFormat = WAV_PCM16, bool aDither = false, uint32_t aSeed = 0x9e3779b9u) {
+		mFormat = aFormat;
+		mDither = aDither && (aFormat == WAV_PCM16 || aFormat == WAV_PCM24);
+		mRandom = (aSeed != 0) ? aSeed : 1;
+		mKernel = kernelFor(CpuFeatures::detect());
+
+		if (mDither) {
+			// Difference of two uniform values, a chunk can start anywhere in the first period
+			mDitherTable.resize(DITHER_PERIOD + CONVERT_CHUNK);
+			for (size_t i = 0; i < mDitherTable.size(); i++) {
+				float a = (float)(nextRandom() >> 8) / 16777216.0f;
+				float b = (float)(nextRandom() >> 8) / 16777216.0f;
+				mDitherTable[i] = a - b;
+			}
+		}
+	}
+
+	static unsigned int bytesPerSample(WavFormat aFormat) {
+		switch (aFormat) {
+		case WAV_PCM24: return 3;
+		case WAV_PCM32: case WAV_FLOAT32: return 4;
+		case WAV_PCM16: default: return 2;
+		}
+	}
+
+	unsigned int bytesPerSample() const {
+		return bytesPerSample(mFormat);
+	}
+
+	WavFormat format() const {
+		return mFormat;
+	}
+
+	bool dither() const {
+		return mDither;
+	}
+
+	// Kernel for aLevel, clamped to what this CPU supports. All of them give the same bytes
+	void setSimdLevel(SimdLevel aLevel) {
+		mKernel = kernelFor(std::min(aLevel, CpuFeatures::detect()));
+	}
+
+	// aCount samples into aCount * bytesPerSample() bytes at aOut
+	void convert(const float* aIn, size_t aCount, void* aOut) {
+		unsigned char* out = (unsigned char*)aOut;
+		if (mFormat == WAV_FLOAT32) {
+			for (size_t i = 0; i < aCount; i++) {
+				uint32_t bits;
+				std::memcpy(&bits, &aIn[i], 4);
+				out[i * 4] = (unsigned char)(bits & 0xff);
+				out[i * 4 + 1] = (unsigned char)((bits >> 8) & 0xff);
+				out[i * 4 + 2] = (unsigned char)((bits >> 16) & 0xff);
+				out[i * 4 + 3] = (unsigned char)((bits >> 24) & 0xff);
+			}
+			return;
+		}
+
+		const float s = scale();
+		const unsigned int bytes = bytesPerSample();
+		for (size_t start = 0; start < aCount; start += CONVERT_CHUNK) {
+			int n = (int)std::min<size_t>(CONVERT_CHUNK, aCount - start);
+			// Start every chunk somewhere new in the table so the noise doesn't repeat at a fixed period
+			const float* dither = mDither ? mDitherTable.data() + nextRandom() % DITHER_PERIOD : nullptr;
+			mKernel(aIn + start, dither, s, mInts, n);
+			pack(mInts, n, out + start * bytes);
+		}
+	}
+
+	// Same into aOut, resized to fit
+	void convert(const float* aIn, size_t aCount, std::vector<char>& aOut) {
+		aOut.resize(aCount * bytesPerSample());
+		convert(aIn, aCount, (void*)aOut.data());
+	}
+};
+
+#endif
@@ -0,0 +1,325 @@
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "instrument.h"
+#include "blockTime.h"
+
+enum SequenceEventType {
+	SEQ_NOTE_ON = 0,
+	SEQ_NOTE_OFF,
+	// Pan of notes started on mChannel from then on, mValue -1 left to 1 right
+	SEQ_PAN,
+	// Cutoff of the bus filter, mValue in Hz
+	SEQ_BUS_CUTOFF,
+};
+
+// One event at a frame of the sequence, kept small so a pass over the array stays in cache
+struct SequenceEvent {
+	long long mFrame;
+	SequenceEventType mType;
+	int mId;
+	int mChannel;
+	float mValue;
+};
+
+// Time stamped note and parameter events in one array sorted by frame, events on the same frame
+// in the order they were added. process() renders a block through an engine in runs split at
+// the events, so every event lands on its exact frame whatever the block size. A loop region
+// plays a number of times (or forever), wrapping by seeking in the array rather than copying
+// it; notes still held at the loop end are released there.
+//
+// Fill it on one thread and prepare() or rewind() it, then only process() while it plays, from
+// the audio thread. Events go straight to the engine (see SynthEngine::applyEvent), not through
+// its input queue.
+class Sequencer {
+private:
+	std::vector<SequenceEvent> mEvents;
+	unsigned int mSampleRate;
+	// Sequence frame of the next frame out, and the next event to fire
+	long long mPosition;
+	size_t mNext;
+	// Loop region [mLoopStart, mLoopEnd), none if mLoopEnd is 0, played mLoopCount times
+	// (0 for ever). mPass counts the wraps so far
+	long long mLoopStart;
+	long long mLoopEnd;
+	int mLoopCount;
+	int mPass;
+	// Notes on and not yet off, to release at the loop end. Room for one per note on event once
+	// prepare() has sized it for the mNoteOns added
+	std::vector<int> mHeld;
+	int mHeldCount;
+	std::vector<int> mHeldChannel;
+	size_t mNoteOns;
+
+	// Out of order event, after the events of the same frame
+	void insert(const SequenceEvent& aEvent) {
+		auto at = std::upper_bound(mEvents.begin(), mEvents.end(), aEvent.mFrame,
+			[](long long aFrame, const SequenceEvent& e) { return aFrame < e.mFrame; });
+		mEvents.insert(at, aEvent);
+	}
+
+	bool looping() const {
+		return mLoopEnd > mLoopStart && (mLoopCount == 0 || mPass + 1 < mLoopCount);
+	}
+
+	template<class Engine>
+	void fire(Engine& aEngine, const SequenceEvent& aEvent, double aTime) {
+		switch (aEvent.mType) {
+		case SEQ_NOTE_ON:
+			aEngine.applyEvent({ NOTE_ON, aEvent.mId, aEvent.mChannel, aTime });
+			if (mHeldCount < (int)mHeld.size()) {
+				mHeld[mHeldCount] = aEvent.mId;
+				mHeldChannel[mHeldCount] = aEvent.mChannel;
+				mHeldCount++;
+			}
+			break;
+		case SEQ_NOTE_OFF:
+			aEngine.applyEvent({ NOTE_OFF, aEvent.mId, aEvent.mChannel, aTime });
+			for (int i = 0; i < mHeldCount; i++) {
+				if (mHeld[i] == aEvent.mId && mHeldChannel[i] == aEvent.mChannel) {
+					mHeldCount--;
+					mHeld[i] = mHeld[mHeldCount];
+					mHeldChannel[i] = mHeldChannel[mHeldCount];
+					break;
+				}
+			}
+			break;
+		case SEQ_PAN:
+			aEngine.setPan(aEvent.mChannel, aEvent.mValue);
+			break;
+		case SEQ_BUS_CUTOFF:
+			aEngine.setBusCutoff(aEvent.mValue);
+			break;
+		}
+	}
+
+public:
+	Sequencer(unsigned int aSampleRate = 44100) {
+		mSampleRate = aSampleRate;
+		mLoopStart = 0;
+		mLoopEnd = 0;
+		mLoopCount = 0;
+		mHeldCount = 0;
+		mNoteOns = 0;
+		rewind();
+	}
+
+	// First frame at or after aSeconds
+	long long frameAt(double aSeconds) const {
+		return (long long)std::ceil(aSeconds * (double)mSampleRate);
+	}
+
+	unsigned int sampleRate() const {
+		return mSampleRate;
+	}
+
+	// Event at a frame rather than a time, for loaders that count in frames
+	void add(const SequenceEvent& aEvent) {
+		add(aEvent.mFrame, aEvent.mType, aEvent.mId, aEvent.mChannel, aEvent.mValue);
+	}
+
+	// The same from its fields. In order is an append that stores each field straight into the
+	// array, rather than copying an event built on the stack, and is small enough to inline
+	void add(long long aFrame, SequenceEventType aType, int aId, int aChannel, float aValue) {
+		if (aType == SEQ_NOTE_ON) {
+			mNoteOns++;
+		}
+		if (mEvents.empty() || aFrame >= mEvents.back().mFrame) {
+			mEvents.emplace_back();
+			SequenceEvent& e = mEvents.back();
+			e.mFrame = aFrame;
+			e.mType = aType;
+			e.mId = aId;
+			e.mChannel = aChannel;
+			e.mValue = aValue;
+		} else {
+			insert({ aFrame, aType, aId, aChannel, aValue });
+		}
+	}
+
+	// Make room to hold every note on added so far, once after filling it rather than per event.
+	// Loaders and rewind() call it, control side
+	void prepare() {
+		if (mHeld.size() < mNoteOns) {
+			mHeld.resize(mNoteOns);
+			mHeldChannel.resize(mNoteOns);
+		}
+	}
+
+	void noteOn(double aTime, int aId, int aChannel) {
+		add({ frameAt(aTime), SEQ_NOTE_ON, aId, aChannel, 0.0f });
+	}
+
+	void noteOff(double aTime, int aId, int aChannel) {
+		add({ frameAt(aTime), SEQ_NOTE_OFF, aId, aChannel, 0.0f });
+	}
+
+	// Note on at aTime and off aDuration later
+	void note(double aTime, double aDuration, int aId, int aChannel) {
+		noteOn(aTime, aId, aChannel);
+		noteOff(aTime + aDuration, aId, aChannel);
+	}
+
+	void pan(double aTime, int aChannel, float aPan) {
+		add({ frameAt(aTime), SEQ_PAN, 0, aChannel, aPan });
+	}
+
+	void busCutoff(double aTime, float aCutoff) {
+		add({ frameAt(aTime), SEQ_BUS_CUTOFF, 0, 0, aCutoff });
+	}
+
+	// Play [aStart, aEnd) seconds aCount times in all, 0 for ever, then carry on past aEnd.
+	// aEnd <= aStart turns looping off
+	void setLoop(double aStart, double aEnd, int aCount = 0) {
+		mLoopStart = frameAt(aStart);
+		mLoopEnd = frameAt(aEnd);
+		mLoopCount = std::max(0, aCount);
+	}
+
+	void clear() {
+		// The held lists keep their room, prepare() only grows them
+		mEvents.clear();
+		mNoteOns = 0;
+		rewind();
+	}
+
+	// Back to the first frame, no notes held
+	void rewind() {
+		prepare();
+		mPosition = 0;
+		mNext = 0;
+		mPass = 0;
+		mHeldCount = 0;
+	}
+
+	const std::vector<SequenceEvent>& events() const {
+		return mEvents;
+	}
+
+	// Frames to the last event, with every pass of a finite loop. An endless loop counts once
+	long long length() const {
+		long long end = mEvents.empty() ? 0 : mEvents.back().mFrame + 1;
+		if (mLoopEnd <= mLoopStart) {
+			return end;
+		}
+		if (mLoopCount == 0) {
+			return mLoopEnd;
+		}
+		return std::max(end, mLoopEnd) + (long long)(mLoopCount - 1) * (mLoopEnd - mLoopStart);
+	}
+
+	// Past the last event and not looping back
+	bool finished() const {
+		return mNext >= mEvents.size() && !looping();
+	}
+
+	// Render aFrames interleaved frames of aChannels into aOut through aEngine's process(),
+	// applying every event on its frame. aEngine needs process(), applyEvent(), setPan() and
+	// setBusCutoff() as SynthEngine has. Nothing is allocated
+	template<class Engine>
+	void process(Engine& aEngine, float* aOut, int aFrames, int aChannels, const BlockTime& aTime) {
+		int done = 0;
+		while (done < aFrames) {
+			const BlockTime time = aTime.offset(done);
+
+			if (looping() && mPosition >= mLoopEnd) {
+				for (int i = 0; i < mHeldCount; i++) {
+					aEngine.applyEvent({ NOTE_OFF, mHeld[i], mHeldChannel[i], time.mTime });
+				}
+				mHeldCount = 0;
+				mPass++;
+				mPosition = mLoopStart;
+				mNext = std::lower_bound(mEvents.begin(), mEvents.end(), mLoopStart,
+					[](const SequenceEvent& e, long long aFrame) { return e.mFrame < aFrame; }) - mEvents.begin();
+			}
+			while (mNext < mEvents.size() && mEvents[mNext].mFrame <= mPosition) {
+				fire(aEngine, mEvents[mNext++], time.mTime);
+			}
+
+			// Run up to the next event or the loop end, whichever is first
+			long long run = aFrames - done;
+			if (mNext < mEvents.size()) {
+				run = std::min(run, mEvents[mNext].mFrame - mPosition);
+			}
+			if (looping()) {
+				run = std::min(run, mLoopEnd - mPosition);
+			}
+			run = std::max<long long>(run, 1);
+
+			aEngine.process(aOut + (size_t)done * aChannels, (int)run, aChannels, time);
+			done += (int)run;
+			mPosition += run;
+		}
+	}
+
+	// Script format, one note per line: <timeOn> <duration> <noteId> [channel], or a parameter:
+	//   pan <time> <channel> <pan>
+	//   cutoff <time> <hz>
+	// Blank lines and lines starting with '#' are ignored
+	bool loadScript(const std::string& aPath) {
+		std::ifstream file(aPath);
+		if (!file.is_open()) {
+			return false;
+		}
+
+		// Events with their time in seconds, which orders events that round to the same frame
+		std::vector<std::pair<double, SequenceEvent>> events;
+		std::string line;
+		while (std::getline(file, line)) {
+			if (line.empty() || line[0] == '#') {
+				continue;
+			}
+			std::istringstream fields(line);
+			std::string first;
+			fields >> first;
+			double time = 0.0;
+			if (first == "pan") {
+				int channel = 0;
+				float value = 0.0f;
+				if (fields >> time >> channel >> value) {
+					events.push_back({ time, { frameAt(time), SEQ_PAN, 0, channel, value } });
+				}
+				continue;
+			}
+			if (first == "cutoff") {
+				float value = 0.0f;
+				if (fields >> time >> value) {
+					events.push_back({ time, { frameAt(time), SEQ_BUS_CUTOFF, 0, 0, value } });
+				}
+				continue;
+			}
+
+			double duration = 0.0;
+			int id = 0;
+			int channel = 1;
+			std::istringstream note(line);
+			if (!(note >> time >> duration >> id)) {
+				continue;
+			}
+			note >> channel;
+			events.push_back({ time, { frameAt(time), SEQ_NOTE_ON, id, channel, 0.0f } });
+			events.push_back({ time + duration, { frameAt(time + duration), SEQ_NOTE_OFF, id, channel, 0.0f } });
+		}
+
+		// One sort for the whole file rather than an insert per event
+		typedef std::pair<double, SequenceEvent> Timed;
+		std::stable_sort(events.begin(), events.end(), [](const Timed& a, const Timed& b) { return a.first < b.first; });
+		clear();
+		mEvents.reserve(events.size());
+		for (const Timed& e : events) {
+			add(e.second);
+		}
+		prepare();
+		return true;
+	}
+};
+
+#endif
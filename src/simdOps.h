@@ -0,0 +1,136 @@
+#ifndef SIMDOPS_H
+#define SIMDOPS_H
+
+#include <cstdint>
+
+#include "cpuFeatures.h"
+
+#if defined(SYNTH_X86)
+#include <immintrin.h>
+#endif
+
+// Kernels are written once against an Ops struct (V = lanes of floats, M = lane mask) and
+// instantiated per instruction set. Every Ops does the same IEEE float operation per lane, so a
+// kernel gives bit-identical results whichever one runs; the scalar Ops is the reference.
+//
+// GCC and clang only emit AVX code inside functions marked for that target, so each wider
+// instruction set is wrapped in a target region. Contraction into FMA is switched off so
+// a*b+c rounds the same way in every version.
+#if defined(__clang__)
+#define SYNTH_TARGET_AVX2_BEGIN _Pragma("clang attribute push (__attribute__((target(\"avx2\"))), apply_to = function)")
+#define SYNTH_TARGET_AVX512_BEGIN _Pragma("clang attribute push (__attribute__((target(\"avx2,avx512f\"))), apply_to = function)")
+#define SYNTH_TARGET_END _Pragma("clang attribute pop")
+#elif defined(__GNUC__)
+#define SYNTH_TARGET_AVX2_BEGIN _Pragma("GCC push_options") _Pragma("GCC target(\"avx2\")") _Pragma("GCC optimize(\"fp-contract=off\")")
+#define SYNTH_TARGET_AVX512_BEGIN _Pragma("GCC push_options") _Pragma("GCC target(\"avx2,avx512f\")") _Pragma("GCC optimize(\"fp-contract=off\")")
+#define SYNTH_TARGET_END _Pragma("GCC pop_options")
+#else
+#define SYNTH_TARGET_AVX2_BEGIN
+#define SYNTH_TARGET_AVX512_BEGIN
+#define SYNTH_TARGET_END
+#endif
+
+namespace SimdScalar {
+	struct Ops {
+		typedef float V;
+		typedef bool M;
+		static const int W = 1;
+
+		static V load(const float* p) { return *p; }
+		static V loadu(const float* p) { return *p; }
+		static void store(float* p, V a) { *p = a; }
+		static void storeu(float* p, V a) { *p = a; }
+		// Truncate towards zero, unaligned
+		static void storeInt(int32_t* p, V a) { *p = (int32_t)a; }
+		static V set(float f) { return f; }
+		static V add(V a, V b) { return a + b; }
+		static V sub(V a, V b) { return a - b; }
+		static V mul(V a, V b) { return a * b; }
+		// Same operand order as minps/maxps
+		static V min(V a, V b) { return (a < b) ? a : b; }
+		static V max(V a, V b) { return (a > b) ? a : b; }
+		static M lt(V a, V b) { return a < b; }
+		static M ge(V a, V b) { return a >= b; }
+		static V select(M m, V a, V b) { return m ? a : b; }
+	};
+}
+
+#if defined(SYNTH_X86)
+namespace SimdSse2 {
+	struct Ops {
+		typedef __m128 V;
+		typedef __m128 M;
+		static const int W = 4;
+
+		static V load(const float* p) { return _mm_load_ps(p); }
+		static V loadu(const float* p) { return _mm_loadu_ps(p); }
+		static void store(float* p, V a) { _mm_store_ps(p, a); }
+		static void storeu(float* p, V a) { _mm_storeu_ps(p, a); }
+		static void storeInt(int32_t* p, V a) { _mm_storeu_si128((__m128i*)p, _mm_cvttps_epi32(a)); }
+		static V set(float f) { return _mm_set1_ps(f); }
+		static V add(V a, V b) { return _mm_add_ps(a, b); }
+		static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+		static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+		static V min(V a, V b) { return _mm_min_ps(a, b); }
+		static V max(V a, V b) { return _mm_max_ps(a, b); }
+		static M lt(V a, V b) { return _mm_cmplt_ps(a, b); }
+		static M ge(V a, V b) { return _mm_cmpge_ps(a, b); }
+		static V select(M m, V a, V b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+	};
+}
+
+SYNTH_TARGET_AVX2_BEGIN
+namespace SimdAvx2 {
+	struct Ops {
+		typedef __m256 V;
+		typedef __m256 M;
+		static const int W = 8;
+
+		static V load(const float* p) { return _mm256_load_ps(p); }
+		static V loadu(const float* p) { return _mm256_loadu_ps(p); }
+		static void store(float* p, V a) { _mm256_store_ps(p, a); }
+		static void storeu(float* p, V a) { _mm256_storeu_ps(p, a); }
+		static void storeInt(int32_t* p, V a) { _mm256_storeu_si256((__m256i*)p, _mm256_cvttps_epi32(a)); }
+		static V set(float f) { return _mm256_set1_ps(f); }
+		static V add(V a, V b) { return _mm256_add_ps(a, b); }
+		static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+		static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+		static V min(V a, V b) { return _mm256_min_ps(a, b); }
+		static V max(V a, V b) { return _mm256_max_ps(a, b); }
+		static M lt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+		static M ge(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+		static V select(M m, V a, V b) { return _mm256_blendv_ps(b, a, m); }
+	};
+}
+SYNTH_TARGET_END
+
+SYNTH_TARGET_AVX512_BEGIN
+namespace SimdAvx512 {
+	struct Ops {
+		typedef __m512 V;
+		typedef __mmask16 M;
+		static const int W = 16;
+		// Every lane. The zero masked forms, as GCC 12's unmasked min, max and cvtt pass an
+		// undefined source that -Wmaybe-uninitialized reports
+		static constexpr M ALL = 0xffff;
+
+		static V load(const float* p) { return _mm512_load_ps(p); }
+		static V loadu(const float* p) { return _mm512_loadu_ps(p); }
+		static void store(float* p, V a) { _mm512_store_ps(p, a); }
+		static void storeu(float* p, V a) { _mm512_storeu_ps(p, a); }
+		static void storeInt(int32_t* p, V a) { _mm512_storeu_si512((void*)p, _mm512_maskz_cvttps_epi32(ALL, a)); }
+		static V set(float f) { return _mm512_set1_ps(f); }
+		static V add(V a, V b) { return _mm512_add_ps(a, b); }
+		static V sub(V a, V b) { return _mm512_sub_ps(a, b); }
+		static V mul(V a, V b) { return _mm512_mul_ps(a, b); }
+		static V min(V a, V b) { return _mm512_maskz_min_ps(ALL, a, b); }
+		static V max(V a, V b) { return _mm512_maskz_max_ps(ALL, a, b); }
+		static M lt(V a, V b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+		static M ge(V a, V b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+		static V select(M m, V a, V b) { return _mm512_mask_blend_ps(m, b, a); }
+	};
+}
+SYNTH_TARGET_END
+#endif
+
+#endif
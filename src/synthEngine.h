@@ -2,38 +2,205 @@
 #define SYNTHENGINE_H
 
 #include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
 #include <vector>
 #include <string>
 
 #include "utils.h"
 #include "envelope.h"
 #include "instrument.h"
+#include "blockTime.h"
+#include "ringBuffer.h"
+#include "voicePool.h"
+#include "voiceBank.h"
+#include "threadPool.h"
+#include "blockScheduler.h"
+#include "deadlineMonitor.h"
+#include "effect.h"
+#include "delayEffects.h"
+#include "reverb.h"
+#include "audioGraph.h"
+#include "sequencer.h"
+#include "midiRecorder.h"
+#ifdef _WIN32
 #include "noiseMaker.h"
+#endif
+
+// Voices held before new notes start stealing
+const int DEFAULT_POLYPHONY = 64;
+
+// Samples of delay line every voice slot owns, enough for a plucked string down to about 21Hz
+const int VOICE_DELAY_LENGTH = 2048;
+
+// Channels with their own instrument, notes on other channels play channel 1's
+const int INSTRUMENT_CHANNELS = 16;
+
+// Voices rendered together as one task in the voice pool, fixed so the mix doesn't depend on the thread count
+const int VOICES_PER_TASK = 8;
+static_assert(VOICES_PER_TASK <= FILTER_LANES, "A task filters all its voices in one pass of the lane kernel");
+// Voices are mixed in slices of at most this many frames, a multiple of RENDER_CHUNK
+const int MIX_SLICE = 512;
+// Voices x frames below which a slice isn't worth handing to other threads
+const int PARALLEL_MIN_WORK = 8 * 256;
+
+// How voices are rendered
+enum VoiceRenderer {
+	// One Note at a time through Instrument::render
+	RENDER_VOICE_POOL = 0,
+	// Structure of arrays SIMD kernels, see VoiceBank. The bank mixes into channel 1's graph source,
+	// so channels with a source of their own and instruments the bank can't play (plucked strings,
+	// filtered patches, noise layers) still go through the pool
+	RENDER_VOICE_BANK,
+};
 
 class SynthEngine {
 private:
-	std::vector<std::wstring> mDevices;
-	NoiseMaker<short> mSound;
-
+	unsigned int mSampleRate;
 	double mOctaveBaseFreq;
 	double mRoot;
 	std::atomic<double> mFrequency;
 	EnvelopeADSR mEnvelope;
-	std::vector<Note> mNotes;
-	std::mutex mMutexNotes;
+	// Owned by the audio thread, only touched inside process()
+	VoicePool<Note> mNotes;
+	// One line per voice slot, handed to the slot's note at note on
+	DelayLinePool mDelayLines;
+	VoiceBank mBank;
+	VoiceRenderer mRenderer;
+	// Input thread -> audio thread, drained once per block
+	RingBuffer<NoteEvent, 256> mEvents;
+	std::atomic<int> mActiveNotes;
+	// Optional workers for the voice pool and graph, and a left and right MIX_SLICE of mix per
+	// task. Every source's tasks get their own, so sources can render at the same time
+	std::unique_ptr<ThreadPool> mThreads;
+	std::vector<float> mTaskMix;
+	// Voice filters for the pool, picked by the same SIMD level as the bank
+	FilterKernel mFilterKernel;
+	// Control side description of the mix, and the filter setBusFilter() puts on its output
+	AudioGraph mGraph;
+	std::shared_ptr<StereoFilter> mBusFilter;
+	// Plan the audio thread runs, the next one waiting for it, and ones it has finished with
+	// that the control side frees. Only the audio thread touches mPlan
+	GraphPlan* mPlan;
+	std::atomic<GraphPlan*> mPendingPlan;
+	RingBuffer<GraphPlan*, 16> mRetiredPlans;
+	// Pool voice indices grouped by source for the block, with each source's start, count and
+	// first task
+	std::vector<int> mSourceVoices;
+	std::vector<int> mSourceStart;
+	std::vector<int> mSourceCount;
+	// Pool and bank voices per source, which decides what is worth a thread
+	std::vector<int> mSourceLoad;
+	std::vector<int> mSourceTask;
+	// Block timings from whichever scheduler drives us, and our voice counts
+	DeadlineMonitor mMonitor;
 
-	BellInstrument mInstBell;
-	HarmonicaInstrument mInstHarm;
+	// Instrument per channel, voices jump straight into their channel's render loop
+	Instrument mInstruments[INSTRUMENT_CHANNELS];
+	// Stereo position per channel, -1 left to 1 right, taken by each voice as it starts
+	float mChannelPan[INSTRUMENT_CHANNELS];
+	// Voices started so far, each gets noise seeded from mNoiseSeed and its number
+	uint32_t mNoiseSeed;
+	uint32_t mVoicesStarted;
+	// Stream frame events applied now take effect on, and where they are recorded if anywhere
+	long long mFrame;
+	MidiRecorder* mRecorder;
 
 public:
-	SynthEngine();
+	SynthEngine(unsigned int aSampleRate = 44100, int aMaxPolyphony = DEFAULT_POLYPHONY, StealPolicy aStealPolicy = STEAL_RELEASED);
+	~SynthEngine();
+
+	SynthEngine(const SynthEngine&) = delete;
+	SynthEngine& operator=(const SynthEngine&) = delete;
+
+	// Input side, each call queues one event for the next block and returns false if the queue is full.
+	// Start a note, or retrigger it if it is still releasing. aTime is in engine time
+	bool noteOn(int aId, int aChannel, double aTime);
+	// Move a held note into its release phase, aChannel being the one it was started on
+	bool noteOff(int aId, int aChannel, double aTime);
+	// Restart a note's envelope whatever state it is in
+	bool retrigger(int aId, int aChannel, double aTime);
+	// Voice count as of the last rendered block
+	int activeNotes() const;
+	// Render timing and voice statistics, snapshot() is safe from any thread
+	DeadlineMonitor& monitor();
+
+	// Switch voice renderer, only while nothing is playing
+	void setVoiceRenderer(VoiceRenderer aRenderer);
+	// Instruction set for RENDER_VOICE_BANK, clamped to what the CPU supports
+	void setSimdLevel(SimdLevel aLevel);
+	SimdLevel simdLevel() const;
+	// Render pool voices on aThreads threads (including the audio thread), 1 is single threaded.
+	// With aPin each worker is kept on its own core. Only while nothing is playing
+	void setRenderThreads(int aThreads, bool aPin = false);
+	int renderThreads() const;
 
+	// Apply queued note events, audio thread only
+	void drainEvents();
+	// Apply one event now, bypassing the queue. Audio thread only, e.g. from a Sequencer
+	void applyEvent(const NoteEvent& aEvent);
+	// Instrument that plays notes on aChannel
+	const Instrument& instrumentFor(int aChannel) const;
+	// Play aChannel with aInstrument, e.g. InstrumentDef<MyPatch>::describe(). Only while nothing is playing
+	void setInstrument(int aChannel, const Instrument& aInstrument);
+	// Pan notes started on aChannel from now on, -1 left to 1 right with constant power
+	void setPan(int aChannel, float aPan);
+	float panFor(int aChannel) const;
+	// Mix graph, AudioGraph::standard() to start with. setGraph() compiles aGraph on the calling
+	// thread and the audio thread picks it up at its next block, so it can be called while
+	// playing, from one control thread. False, changing nothing, if aGraph doesn't compile.
+	// The SIMD voice bank renders every voice into the source of channel 1
+	bool setGraph(const AudioGraph& aGraph);
+	const AudioGraph& graph() const;
+	// Filter the graph's output bus, FILTER_OFF to bypass. Only while nothing is playing
+	void setBusFilter(FilterMode aMode, double aCutoff, double aResonance = 0.707);
+	// Move the bus cutoff from any thread, it ramps there over the next block
+	void setBusCutoff(double aCutoff);
+	// Append an effect to the output bus chain, e.g. ChorusEffect, TempoDelay or FdnReverb
+	void addEffect(std::unique_ptr<Effect> aEffect);
+	// Seconds effects ring on after the last voice stops
+	double tailTime() const;
+	// Seed for voice noise, renders with the same seed and notes are bit-identical.
+	// Restarts the voice count, so set it before playing
+	void setNoiseSeed(uint32_t aSeed);
+	// Hand every applied note event and its frame to aRecorder, nullptr for none. Only while
+	// nothing is playing, aRecorder's start() and stop() can then be called at any time
+	void setRecorder(MidiRecorder* aRecorder);
+
+	// Render aFrames interleaved frames of aChannels channels into aOut. Voices are mixed once as
+	// a left and right pair, even channels get the left and odd channels the right. Mono output
+	// skips the pan entirely.
+	void process(float* aOut, int aFrames, int aChannels, const BlockTime& aTime);
+
+	// Mix the aCount pool voices listed in aVoices into aLeft and, panned, into aRight (mono if
+	// null), in VOICES_PER_TASK tasks summed in task order. Tasks use mTaskMix from aFirstTask on,
+	// and go to the thread pool if aThreaded. Voices of instruments with a filter are rendered on
+	// their own, filtered FILTER_LANES at a time and then panned into the task's mix. VoiceBank
+	// voices aren't filtered.
+	void renderVoices(const int* aVoices, int aCount, int aFirstTask, float* aLeft, float* aRight, int aFrames, const BlockTime& aTime, bool aThreaded);
+
+	// Group pool voices by the source their channel plays through, for one block. Voices on
+	// channels no source reaching the output has are stopped
+	void assignVoices(const GraphPlan& aPlan);
+	// True if a note on aChannel can go in the voice bank, audio thread only
+	bool bankPlays(int aChannel) const;
+	// Swap in the plan setGraph() compiled if there is one, audio thread only
+	void adoptPlan();
+	// Free plans the audio thread has retired, control side
+	void collectPlans();
+
+	// Per sample compatibility adapter over process()
 	double makeNoise(int aChannel, double aTime);
+
+	// Play from the keyboard through the default output device, never returns. aSequencer, if
+	// given, plays along with every event on its exact frame
+	void run(Sequencer* aSequencer = nullptr);
 };
 
-SynthEngine::SynthEngine()
-	: mDevices(NoiseMaker<short>::Enumerate()),
-	  mSound(mDevices[0]) {
+SynthEngine::SynthEngine(unsigned int aSampleRate, int aMaxPolyphony, StealPolicy aStealPolicy)
+	: mNotes(aMaxPolyphony, aStealPolicy), mDelayLines(aMaxPolyphony, VOICE_DELAY_LENGTH), mBank(aMaxPolyphony, aSampleRate) {
+	mSampleRate = aSampleRate;
 
 	// Frequency of octave represented by keyboard, e.g. A2
 	mOctaveBaseFreq = 220.0;
@@ -41,96 +208,512 @@ SynthEngine::SynthEngine()
 	// Frequency output of instrument
 	mFrequency = 440.0;
 
-	std::cout << "Starting engine..." << std::endl;
-	
-	for (std::wstring d : mDevices) {
-		std::wcout << "Found Output Device: " << d << std::endl;
+	mActiveNotes = 0;
+	mRenderer = RENDER_VOICE_POOL;
+	mNoiseSeed = 1;
+	mVoicesStarted = 0;
+	mFrame = 0;
+	mRecorder = nullptr;
+	// A source's tasks can end in a partly filled one, so one spare per channel
+	mTaskMix.assign((size_t)((aMaxPolyphony + VOICES_PER_TASK - 1) / VOICES_PER_TASK + GRAPH_CHANNELS) * 2 * MIX_SLICE, 0.0f);
+	mFilterKernel = filterKernelFor(CpuFeatures::detect());
+	mSourceVoices.assign(aMaxPolyphony, 0);
+	mSourceStart.assign(GRAPH_CHANNELS, 0);
+	mSourceCount.assign(GRAPH_CHANNELS, 0);
+	mSourceLoad.assign(GRAPH_CHANNELS, 0);
+	mSourceTask.assign(GRAPH_CHANNELS, 0);
+
+	mBusFilter = std::make_shared<StereoFilter>();
+	mGraph = AudioGraph::standard();
+	mGraph.setFilter(mGraph.output(), mBusFilter);
+	mPlan = new GraphPlan();
+	mPlan->compile(mGraph, MIX_SLICE);
+	mPendingPlan = nullptr;
+
+	for (int i = 0; i < INSTRUMENT_CHANNELS; i++) {
+		mInstruments[i] = HarmonicaInstrument::describe();
+		mChannelPan[i] = 0.0f;
 	}
-	std::wcout << endl <<
-		"|   |   |   |   |   | |   |   |   |   | |   | |   |   |   |"   << endl <<
-		"|   | S |   |   | F | | G |   |   | J | | K | | L |   |   |"   << endl <<
-		"|   |___|   |   |___| |___|   |   |___| |___| |___|   |   |__" << endl <<
-		"|     |     |     |     |     |     |     |     |     |     |" << endl <<
-		"|  Z  |  X  |  C  |  V  |  B  |  N  |  M  |  ,  |  .  |  /  |" << endl <<
-		"|_____|_____|_____|_____|_____|_____|_____|_____|_____|_____|" << endl << endl;
+	mInstruments[2] = BellInstrument::describe();
+	mInstruments[3] = PluckInstrument::describe();
+	mInstruments[4] = SweepInstrument::describe();
+	mInstruments[5] = BreathInstrument::describe();
+	mInstruments[6] = WindInstrument::describe();
+}
 
-	mSound.SetUserFunction([this](int aChannel, double aTime) {
-		return makeNoise(aChannel, aTime);
-	});
+SynthEngine::~SynthEngine() {
+	collectPlans();
+	delete mPendingPlan.exchange(nullptr);
+	delete mPlan;
+}
 
-	// Create keyboard piano of 2 octaves
-	bool keyPressed = false;
-	while (1) {
-		keyPressed = false;
-		for (int i = 0; i < 16; i++) {
-			short nKeyState = GetAsyncKeyState((unsigned char)("ZSXCFVGBNJMK\xbcL\xbe\xbf"[i]));
-			double currTime = mSound.GetTime();
-
-			// Check if note already exists in currently playing notes
-			mMutexNotes.lock();
-			auto noteFound = std::find_if(mNotes.begin(), mNotes.end(), [&i](Note const& item) { return item.mId == i; });
-			if (noteFound == mNotes.end()) {
-				// Note not found in vector
-				if (nKeyState & 0x8000)	{
-					// Key has been pressed so create a new note
-					Note n;
-					n.mId = i;
-					n.mTimeOn = currTime;
-					n.mChannel = 1;
-					n.mActive = true;
-					mNotes.emplace_back(n);
+bool SynthEngine::noteOn(int aId, int aChannel, double aTime) {
+	return mEvents.push({ NOTE_ON, aId, aChannel, aTime });
+}
+
+bool SynthEngine::noteOff(int aId, int aChannel, double aTime) {
+	return mEvents.push({ NOTE_OFF, aId, aChannel, aTime });
+}
+
+bool SynthEngine::retrigger(int aId, int aChannel, double aTime) {
+	return mEvents.push({ NOTE_RETRIGGER, aId, aChannel, aTime });
+}
+
+int SynthEngine::activeNotes() const {
+	return mActiveNotes.load(std::memory_order_relaxed);
+}
+
+DeadlineMonitor& SynthEngine::monitor() {
+	return mMonitor;
+}
+
+void SynthEngine::setVoiceRenderer(VoiceRenderer aRenderer) {
+	mRenderer = aRenderer;
+}
+
+void SynthEngine::setSimdLevel(SimdLevel aLevel) {
+	mBank.setSimdLevel(aLevel);
+	mFilterKernel = filterKernelFor(mBank.simdLevel());
+}
+
+SimdLevel SynthEngine::simdLevel() const {
+	return mBank.simdLevel();
+}
+
+void SynthEngine::setRenderThreads(int aThreads, bool aPin) {
+	if (aThreads > 1) {
+		mThreads.reset(new ThreadPool(aThreads, aPin));
+	} else {
+		mThreads.reset();
+	}
+}
+
+int SynthEngine::renderThreads() const {
+	return mThreads ? mThreads->threads() : 1;
+}
+
+void SynthEngine::drainEvents() {
+	NoteEvent e;
+	while (mEvents.pop(e)) {
+		applyEvent(e);
+	}
+}
+
+void SynthEngine::applyEvent(const NoteEvent& aEvent) {
+	if (mRecorder != nullptr) {
+		mRecorder->record(mFrame, aEvent);
+	}
+
+	if (mRenderer == RENDER_VOICE_BANK) {
+		// Which renderer plays a note depends on the graph, so use the newest one
+		adoptPlan();
+		if (aEvent.mType == NOTE_OFF) {
+			// The note may be in either, the pool is checked below
+			mBank.noteOff(aEvent.mId, aEvent.mChannel);
+		} else if (bankPlays(aEvent.mChannel)) {
+			float panLeft, panRight;
+			Utility::panGains(panFor(aEvent.mChannel), panLeft, panRight);
+			mBank.noteOn(aEvent.mId, aEvent.mChannel, instrumentFor(aEvent.mChannel), panLeft, panRight);
+			return;
+		}
+	}
+
+	Note* noteFound = mNotes.find([&aEvent](Note const& item) { return item.mId == aEvent.mId && item.mChannel == aEvent.mChannel && item.mActive; });
+
+	switch (aEvent.mType) {
+	case NOTE_ON:
+	case NOTE_RETRIGGER:
+		if (noteFound == nullptr) {
+			// Note not playing, so take a voice from the pool (stealing one if full)
+			Note* n = mNotes.allocate();
+			if (n != nullptr) {
+				n->mId = aEvent.mId;
+				n->mTimeOn = aEvent.mTime;
+				n->mChannel = aEvent.mChannel;
+				n->mActive = true;
+				n->mSeed = NoiseGenerator::seedFor(mNoiseSeed, mVoicesStarted++);
+				n->mDelay = mDelayLines.line(mNotes.slotOf(n));
+				Utility::panGains(panFor(n->mChannel), n->mPanLeft, n->mPanRight);
+				instrumentFor(n->mChannel).start(*n, (double)mSampleRate);
+			}
+		} else if (aEvent.mType == NOTE_RETRIGGER || noteFound->mEnvelope.released()) {
+			// Key has been pressed again during release phase, the attack picks up from the current level
+			noteFound->mTimeOn = aEvent.mTime;
+			noteFound->mActive = true;
+			instrumentFor(noteFound->mChannel).retrigger(*noteFound, (double)mSampleRate);
+		}
+		break;
+
+	case NOTE_OFF:
+		if (noteFound != nullptr && !noteFound->mEnvelope.released()) {
+			noteFound->mTimeOff = aEvent.mTime;
+			noteFound->mEnvelope.noteOff();
+		}
+		break;
+	}
+}
+
+void SynthEngine::adoptPlan() {
+	// A new plan only goes in once the old one can be handed back to be freed
+	if (mPendingPlan.load(std::memory_order_relaxed) != nullptr && mRetiredPlans.push(mPlan)) {
+		mPlan = mPendingPlan.exchange(nullptr, std::memory_order_acq_rel);
+	}
+}
+
+bool SynthEngine::bankPlays(int aChannel) const {
+	// Same fallback to channel 1 as instrumentFor()
+	const int channel = (aChannel < 0 || aChannel >= INSTRUMENT_CHANNELS) ? 1 : aChannel;
+	return VoiceBank::canPlay(instrumentFor(channel)) && mPlan->sourceFor(channel) == mPlan->sourceFor(1);
+}
+
+const Instrument& SynthEngine::instrumentFor(int aChannel) const {
+	if (aChannel < 0 || aChannel >= INSTRUMENT_CHANNELS) {
+		return mInstruments[1];
+	}
+	return mInstruments[aChannel];
+}
+
+void SynthEngine::setInstrument(int aChannel, const Instrument& aInstrument) {
+	if (aChannel >= 0 && aChannel < INSTRUMENT_CHANNELS) {
+		mInstruments[aChannel] = aInstrument;
+	}
+}
+
+float SynthEngine::panFor(int aChannel) const {
+	if (aChannel < 0 || aChannel >= INSTRUMENT_CHANNELS) {
+		return mChannelPan[1];
+	}
+	return mChannelPan[aChannel];
+}
+
+void SynthEngine::setPan(int aChannel, float aPan) {
+	if (aChannel >= 0 && aChannel < INSTRUMENT_CHANNELS) {
+		mChannelPan[aChannel] = std::max(-1.0f, std::min(aPan, 1.0f));
+	}
+}
+
+bool SynthEngine::setGraph(const AudioGraph& aGraph) {
+	GraphPlan* plan = new GraphPlan();
+	if (!plan->compile(aGraph, MIX_SLICE)) {
+		delete plan;
+		return false;
+	}
+	mGraph = aGraph;
+	collectPlans();
+	// A plan still pending was never seen by the audio thread
+	delete mPendingPlan.exchange(plan, std::memory_order_acq_rel);
+	return true;
+}
+
+const AudioGraph& SynthEngine::graph() const {
+	return mGraph;
+}
+
+void SynthEngine::collectPlans() {
+	GraphPlan* plan;
+	while (mRetiredPlans.pop(plan)) {
+		delete plan;
+	}
+}
+
+void SynthEngine::setBusFilter(FilterMode aMode, double aCutoff, double aResonance) {
+	mBusFilter->setup(aMode, aCutoff, aResonance, (double)mSampleRate);
+	if (mGraph.node(mGraph.output()).mFilter != mBusFilter) {
+		AudioGraph graph = mGraph;
+		graph.setFilter(graph.output(), mBusFilter);
+		setGraph(graph);
+	}
+}
+
+void SynthEngine::setBusCutoff(double aCutoff) {
+	mBusFilter->setCutoff(aCutoff);
+}
+
+void SynthEngine::addEffect(std::unique_ptr<Effect> aEffect) {
+	AudioGraph graph = mGraph;
+	graph.addEffect(graph.output(), std::move(aEffect));
+	setGraph(graph);
+}
+
+double SynthEngine::tailTime() const {
+	return mGraph.tailTime();
+}
+
+void SynthEngine::setNoiseSeed(uint32_t aSeed) {
+	mNoiseSeed = aSeed;
+	mVoicesStarted = 0;
+}
+
+void SynthEngine::setRecorder(MidiRecorder* aRecorder) {
+	mRecorder = aRecorder;
+}
+
+void SynthEngine::process(float* aOut, int aFrames, int aChannels, const BlockTime& aTime) {
+	mFrame = aTime.mFrame;
+	drainEvents();
+
+	adoptPlan();
+	GraphPlan& plan = *mPlan;
+	// Pool voices by source, and the bank's voices all in channel 1's source
+	const int bankSource = plan.sourceFor(1);
+	assignVoices(plan);
+	std::copy(mSourceCount.begin(), mSourceCount.end(), mSourceLoad.begin());
+	if (mRenderer == RENDER_VOICE_BANK && bankSource >= 0) {
+		mSourceLoad[bankSource] += mBank.size();
+	}
+
+	const float threshold = 1.0f;
+	const bool stereo = aChannels > 1;
+	for (int start = 0; start < aFrames; start += MIX_SLICE) {
+		const int n = std::min(MIX_SLICE, aFrames - start);
+		const BlockTime time = aTime.offset(start);
+
+		auto renderSource = [&](int aSource, float* aLeft, float* aRight, int aSourceFrames, bool aThreaded) {
+			renderVoices(&mSourceVoices[mSourceStart[aSource]], mSourceCount[aSource], mSourceTask[aSource], aLeft, aRight, aSourceFrames, time, aThreaded);
+			if (mRenderer == RENDER_VOICE_BANK && aSource == bankSource) {
+				mBank.render(aLeft, aRight, aSourceFrames);
+			}
+		};
+		const float* left = plan.process(n, stereo, mThreads.get(), mSourceLoad.data(), renderSource);
+		const float* right = stereo ? left + plan.frames() : left;
+
+		// Clamp each side once, then write it to every channel of that side
+		const float* sides[2] = { left, right };
+		for (int side = 0; side < 2 && side < aChannels; side++) {
+			const float* mix = sides[side];
+			float* out = aOut + (size_t)start * aChannels;
+			for (int i = 0; i < n; i++) {
+				float sample = std::max(std::min(mix[i], threshold), -threshold) * 0.02f;
+				for (int c = side; c < aChannels; c += 2) {
+					out[i * aChannels + c] = sample;
+				}
+			}
+		}
+	}
+
+	// Finished voices go back to the pool once per block
+	mNotes.compact();
+	const int voices = (int)mNotes.size() + ((mRenderer == RENDER_VOICE_BANK) ? mBank.size() : 0);
+	mActiveNotes.store(voices, std::memory_order_relaxed);
+	mMonitor.recordVoices(voices);
+
+	// A Sequencer applies its next events before the next call, on this frame
+	mFrame = aTime.mFrame + aFrames;
+	if (mRecorder != nullptr) {
+		mRecorder->advance(mFrame);
+	}
+}
+
+void SynthEngine::renderVoices(const int* aVoices, int aCount, int aFirstTask, float* aLeft, float* aRight, int aFrames, const BlockTime& aTime, bool aThreaded) {
+	const int voices = aCount;
+	const int tasks = (voices + VOICES_PER_TASK - 1) / VOICES_PER_TASK;
+
+	for (int start = 0; start < aFrames; start += MIX_SLICE) {
+		const int n = std::min(MIX_SLICE, aFrames - start);
+		const BlockTime time = aTime.offset(start);
+
+		auto renderTask = [&](int aTask) {
+			float* mix = &mTaskMix[(size_t)(aFirstTask + aTask) * 2 * MIX_SLICE];
+			float* mixRight = (aRight != nullptr) ? mix + MIX_SLICE : nullptr;
+			std::fill(mix, mix + n, 0.0f);
+			if (mixRight != nullptr) {
+				std::fill(mixRight, mixRight + n, 0.0f);
+			}
+			// Filtered voices, frame i of lane l at lanes[i * FILTER_LANES + l]
+			alignas(64) float lanes[FILTER_LANES * MIX_SLICE];
+			float column[MIX_SLICE];
+			FilterLanes filters;
+			Note* filtered[FILTER_LANES];
+			SvfCoefficients targets[FILTER_LANES];
+			int filteredCount = 0;
+
+			int end = std::min(voices, (aTask + 1) * VOICES_PER_TASK);
+			for (int i = aTask * VOICES_PER_TASK; i < end; i++) {
+				Note& note = mNotes[aVoices[i]];
+				const Instrument& instrument = instrumentFor(note.mChannel);
+				bool isNoteFinished = false;
+
+				if (instrument.mFilter.mMode == FILTER_OFF) {
+					instrument.render(mix, mixRight, n, time, note, isNoteFinished);
 				} else {
-					// Note not in vector, but key has been released, do nothing
+					if (filteredCount == 0) {
+						std::fill(lanes, lanes + FILTER_LANES * n, 0.0f);
+					}
+					const FilterSettings& settings = instrument.mFilter;
+					const int lane = filteredCount++;
+
+					// Cutoff ramps from the level this slice starts at to the one it ends on
+					if (!note.mFilter.mPrimed) {
+						note.mFilter.mCoeffs = SvfCoefficients::make(settings.cutoffAt(note.mLevel), settings.mResonance, (double)mSampleRate);
+						note.mFilter.mPrimed = true;
+					}
+					std::fill(column, column + n, 0.0f);
+					instrument.render(column, n, time, note, isNoteFinished);
+					for (int f = 0; f < n; f++) {
+						lanes[f * FILTER_LANES + lane] = column[f];
+					}
+
+					float mixGains[3];
+					SvfCoefficients::mix(settings.mMode, settings.mResonance, mixGains);
+					targets[lane] = SvfCoefficients::make(settings.cutoffAt(note.mLevel), settings.mResonance, (double)mSampleRate);
+					filters.load(lane, note.mFilter, targets[lane], mixGains, n);
+					filtered[lane] = &note;
+				}
+
+				if (isNoteFinished) {
+					note.mActive = false;
 				}
-			} else {
-				// Note exists in vector
-				if (nKeyState & 0x8000)	{
-					// Key is still held, so do nothing
-					if (noteFound->mTimeOff > noteFound->mTimeOn)	{
-						// Key has been pressed again during release phase
-						noteFound->mTimeOn = currTime;
-						noteFound->mActive = true;
+			}
+
+			if (filteredCount > 0) {
+				mFilterKernel(filters, lanes, n);
+				for (int lane = 0; lane < filteredCount; lane++) {
+					Note& note = *filtered[lane];
+					filters.store(lane, note.mFilter, targets[lane]);
+					const float panLeft = (mixRight != nullptr) ? note.mPanLeft : 1.0f;
+					for (int f = 0; f < n; f++) {
+						mix[f] += lanes[f * FILTER_LANES + lane] * panLeft;
 					}
-				} else {
-					// Key has been released, so switch off
-					if (noteFound->mTimeOff < noteFound->mTimeOn) {
-						noteFound->mTimeOff = currTime;
+					if (mixRight != nullptr) {
+						for (int f = 0; f < n; f++) {
+							mixRight[f] += lanes[f * FILTER_LANES + lane] * note.mPanRight;
+						}
 					}
 				}
 			}
-			mMutexNotes.unlock();
+		};
+
+		if (aThreaded && mThreads && tasks > 1 && voices * n >= PARALLEL_MIN_WORK) {
+			mThreads->parallelFor(tasks, renderTask);
+		} else {
+			for (int t = 0; t < tasks; t++) {
+				renderTask(t);
+			}
+		}
+
+		// Same order whichever thread rendered which task
+		for (int t = 0; t < tasks; t++) {
+			const float* mix = &mTaskMix[(size_t)(aFirstTask + t) * 2 * MIX_SLICE];
+			for (int i = 0; i < n; i++) {
+				aLeft[start + i] += mix[i];
+			}
+			if (aRight != nullptr) {
+				for (int i = 0; i < n; i++) {
+					aRight[start + i] += mix[MIX_SLICE + i];
+				}
+			}
 		}
-	std::wcout << "\rNotes: " << mNotes.size() << "    ";
 	}
 }
 
-double SynthEngine::makeNoise(int aChannel, double aTime) {
-	std::unique_lock<mutex> lenM(mMutexNotes);
-	double mixedOutput = 0.0;
-
-	for (auto& note : mNotes) {
-		bool isNoteFinished = false;
-		double currSound = 0;
-		/*if (note.mChannel == 2) {
-			currSound = mInstBell.sound(aTime, note, isNoteFinished);
-		}
-		if (note.mChannel == 1) {
-			currSound = mInstHarm.sound(aTime, note, isNoteFinished) * 0.5;
-		}*/
-		currSound = mInstHarm.sound(aTime, note, isNoteFinished);
-		mixedOutput += currSound;
-
-		if (isNoteFinished && note.mTimeOff > note.mTimeOn) {
-			note.mActive = false;
+void SynthEngine::assignVoices(const GraphPlan& aPlan) {
+	const int voices = (int)mNotes.size();
+	const int sources = aPlan.sources();
+	auto sourceOf = [&](const Note& aNote) {
+		// Same fallback to channel 1 as instrumentFor()
+		const int channel = (aNote.mChannel < 0 || aNote.mChannel >= INSTRUMENT_CHANNELS) ? 1 : aNote.mChannel;
+		return aPlan.sourceFor(channel);
+	};
+
+	std::fill(mSourceCount.begin(), mSourceCount.end(), 0);
+	for (int i = 0; i < voices; i++) {
+		const int source = sourceOf(mNotes[i]);
+		if (source < 0) {
+			mNotes[i].mActive = false;
+		} else {
+			mSourceCount[source]++;
 		}
 	}
 
-	safe_remove<std::vector<Note>>(mNotes, [](Note const& item) { return item.mActive; });
+	int cursor[GRAPH_CHANNELS];
+	int start = 0;
+	int task = 0;
+	for (int s = 0; s < sources; s++) {
+		mSourceStart[s] = start;
+		mSourceTask[s] = task;
+		cursor[s] = start;
+		start += mSourceCount[s];
+		task += (mSourceCount[s] + VOICES_PER_TASK - 1) / VOICES_PER_TASK;
+	}
+	for (int i = 0; i < voices; i++) {
+		if (mNotes[i].mActive) {
+			mSourceVoices[cursor[sourceOf(mNotes[i])]++] = i;
+		}
+	}
+}
 
-	double threshold = 1.0;
-	return std::max(std::min(mixedOutput, threshold), -threshold) * 0.02;
+double SynthEngine::makeNoise(int aChannel, double aTime) {
+	// Every channel plays through the one mix
+	(void)aChannel;
+	float sample = 0.0f;
+	BlockTime time;
+	time.mTime = aTime;
+	time.mTimeStep = 1.0 / (double)mSampleRate;
+	time.mFrame = (long long)(aTime * mSampleRate);
+	time.mSampleRate = mSampleRate;
+	process(&sample, 1, 1, time);
+	return sample;
 }
 
+void SynthEngine::run(Sequencer* aSequencer) {
+#ifdef _WIN32
+	std::vector<std::wstring> devices = NoiseMaker<short>::Enumerate();
+	if (devices.empty()) {
+		std::cout << "No output devices found" << std::endl;
+		return;
+	}
+	NoiseMaker<short> sound(devices[0]);
+	BlockScheduler scheduler(sound, mSampleRate);
+	scheduler.setMonitor(&mMonitor);
+
+	std::cout << "Starting engine..." << std::endl;
+
+	for (std::wstring d : devices) {
+		std::wcout << "Found Output Device: " << d << std::endl;
+	}
+	std::wcout << std::endl <<
+		"|   |   |   |   |   | |   |   |   |   | |   | |   |   |   |"   << std::endl <<
+		"|   | S |   |   | F | | G |   |   | J | | K | | L |   |   |"   << std::endl <<
+		"|   |___|   |   |___| |___|   |   |___| |___| |___|   |   |__" << std::endl <<
+		"|     |     |     |     |     |     |     |     |     |     |" << std::endl <<
+		"|  Z  |  X  |  C  |  V  |  B  |  N  |  M  |  ,  |  .  |  /  |" << std::endl <<
+		"|_____|_____|_____|_____|_____|_____|_____|_____|_____|_____|" << std::endl << std::endl;
+
+	scheduler.setBlockFunction([this, aSequencer](float* aOut, int aFrames, int aChannels, const BlockTime& aTime) {
+		if (aSequencer != nullptr) {
+			aSequencer->process(*this, aOut, aFrames, aChannels, aTime);
+		} else {
+			process(aOut, aFrames, aChannels, aTime);
+		}
+	});
+	if (!scheduler.start()) {
+		std::wcout << L"Could not open " << devices[0] << std::endl;
+		return;
+	}
 
+	// Create keyboard piano of 2 octaves, only key transitions are sent to the audio thread
+	bool keyDown[16] = {};
+	while (1) {
+		for (int i = 0; i < 16; i++) {
+			short nKeyState = GetAsyncKeyState((unsigned char)("ZSXCFVGBNJMK\xbcL\xbe\xbf"[i]));
+			bool pressed = (nKeyState & 0x8000) != 0;
+			if (pressed == keyDown[i]) {
+				continue;
+			}
+
+			// If the queue is full try again on the next pass
+			double currTime = scheduler.time();
+			if (pressed ? noteOn(i, 1, currTime) : noteOff(i, 1, currTime)) {
+				keyDown[i] = pressed;
+			}
+		}
+		DeadlineSnapshot stats = mMonitor.snapshot();
+		std::wcout << "\rNotes: " << activeNotes() << "  Load: " << (int)(stats.mLoad * 100.0) << "%  Underruns: " << stats.mUnderruns << "    ";
+	}
+#else
+	(void)aSequencer;
+	std::cout << "Keyboard playback needs Windows, use --render to play a script through a sink" << std::endl;
+#endif
+}
 
 #endif
@@ -0,0 +1,287 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <pthread.h>
+#include <semaphore.h>
+#endif
+
+// Counting semaphore a worker parks on, so waking it is one post and never a lock
+class WorkerSemaphore {
+private:
+#ifdef _WIN32
+	HANDLE mHandle;
+#else
+	sem_t mSem;
+#endif
+
+public:
+	WorkerSemaphore() {
+#ifdef _WIN32
+		mHandle = CreateSemaphoreA(nullptr, 0, 0x7fffffff, nullptr);
+#else
+		sem_init(&mSem, 0, 0);
+#endif
+	}
+
+	~WorkerSemaphore() {
+#ifdef _WIN32
+		CloseHandle(mHandle);
+#else
+		sem_destroy(&mSem);
+#endif
+	}
+
+	WorkerSemaphore(const WorkerSemaphore&) = delete;
+	WorkerSemaphore& operator=(const WorkerSemaphore&) = delete;
+
+	void post() {
+#ifdef _WIN32
+		ReleaseSemaphore(mHandle, 1, nullptr);
+#else
+		sem_post(&mSem);
+#endif
+	}
+
+	void wait() {
+#ifdef _WIN32
+		WaitForSingleObject(mHandle, INFINITE);
+#else
+		while (sem_wait(&mSem) != 0 && errno == EINTR) {
+		}
+#endif
+	}
+};
+
+// Persistent worker threads for fork-join jobs issued from the audio thread.
+//
+// run() splits tasks 0..count into one contiguous span per thread (the caller counts as thread 0).
+// Each thread works through its own span and then steals from the others' spans, so a slow
+// voice on one core doesn't hold up the block. Which thread ran a task must not change its
+// result, callers write per task outputs and combine them in task order.
+//
+// Nothing locks. A job is published by bumping an atomic generation, workers spin on it for a
+// moment after each job and then park on their own semaphore, which run() only posts to if the
+// worker is parked. Each span is one atomic word of (generation, next, end), so a worker that
+// wakes late for an old job can't claim a task of a newer one, and a claimed task's job can't
+// change until it is done. Nothing is allocated once the pool is built.
+class ThreadPool {
+public:
+	typedef void (*TaskFn)(void* aContext, int aTask);
+
+	// aThreads includes the caller, so 1 means no workers. With aPin worker i is kept on core i
+	ThreadPool(int aThreads, bool aPin = false);
+	~ThreadPool();
+
+	int threads() const {
+		return (int)mQueues.size();
+	}
+
+	// Run aTask(aContext, i) for every i in 0..aCount, returns once all of them are done. From
+	// one thread at a time, and not from inside a task
+	void run(int aCount, TaskFn aTask, void* aContext);
+
+	// run() over a functor or lambda taking the task index
+	template<class F>
+	void parallelFor(int aCount, F& aFunc) {
+		run(aCount, [](void* aContext, int aTask) { (*(F*)aContext)(aTask); }, &aFunc);
+	}
+
+private:
+	// Tasks one job can hold, the span word has 16 bits each for next and end
+	static constexpr int MAX_JOB_TASKS = 0xffff;
+	// Looks at the generation a worker makes before parking
+	static constexpr int SPIN_COUNT = 64;
+
+	// Span of task indices a thread starts on, on its own cache line
+	struct alignas(64) Queue {
+		std::atomic<uint64_t> mSpan;
+	};
+
+	struct alignas(64) Worker {
+		std::atomic<bool> mParked;
+		WorkerSemaphore mWake;
+	};
+
+	// What a generation runs, alternating between two so the next job can be set up while a
+	// late worker still reads the last one
+	struct Job {
+		TaskFn mTask;
+		void* mContext;
+		int mBase;
+	};
+
+	std::vector<Queue> mQueues;
+	std::unique_ptr<Worker[]> mWorkerState;
+	std::vector<std::thread> mWorkers;
+	Job mJobs[2];
+
+	alignas(64) std::atomic<uint32_t> mGeneration;
+	// Tasks of the current job not yet finished
+	alignas(64) std::atomic<int> mRemaining;
+	std::atomic<bool> mStop;
+
+	static uint64_t span(uint32_t aGeneration, int aNext, int aEnd) {
+		return ((uint64_t)aGeneration << 32) | ((uint64_t)aNext << 16) | (uint64_t)aEnd;
+	}
+
+	void publish(int aCount, int aBase, TaskFn aTask, void* aContext);
+	void wakeAll();
+	void workerLoop(int aIndex);
+	void runQueues(int aSelf, uint32_t aGeneration);
+	static void pin(std::thread& aThread, int aCore);
+};
+
+ThreadPool::ThreadPool(int aThreads, bool aPin) : mQueues(aThreads < 1 ? 1 : aThreads) {
+	mJobs[0] = { nullptr, nullptr, 0 };
+	mJobs[1] = { nullptr, nullptr, 0 };
+	mGeneration = 0;
+	mRemaining = 0;
+	mStop = false;
+
+	for (Queue& q : mQueues) {
+		q.mSpan = span(0, 0, 0);
+	}
+	mWorkerState.reset(new Worker[threads()]);
+	for (int i = 0; i < threads(); i++) {
+		mWorkerState[i].mParked = false;
+	}
+
+	unsigned int cores = std::thread::hardware_concurrency();
+	for (int i = 1; i < threads(); i++) {
+		mWorkers.emplace_back(&ThreadPool::workerLoop, this, i);
+		if (aPin && cores > 0) {
+			pin(mWorkers.back(), i % cores);
+		}
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	mStop.store(true, std::memory_order_seq_cst);
+	mGeneration.fetch_add(1, std::memory_order_seq_cst);
+	wakeAll();
+	for (std::thread& t : mWorkers) {
+		t.join();
+	}
+}
+
+void ThreadPool::run(int aCount, TaskFn aTask, void* aContext) {
+	if (aCount <= 0) {
+		return;
+	}
+	if (mWorkers.empty()) {
+		for (int i = 0; i < aCount; i++) {
+			aTask(aContext, i);
+		}
+		return;
+	}
+
+	for (int base = 0; base < aCount; base += MAX_JOB_TASKS) {
+		publish(std::min(aCount - base, MAX_JOB_TASKS), base, aTask, aContext);
+		runQueues(0, mGeneration.load(std::memory_order_relaxed));
+		while (mRemaining.load(std::memory_order_acquire) != 0) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+void ThreadPool::publish(int aCount, int aBase, TaskFn aTask, void* aContext) {
+	const uint32_t generation = mGeneration.load(std::memory_order_relaxed) + 1;
+	mJobs[generation & 1] = { aTask, aContext, aBase };
+	mRemaining.store(aCount, std::memory_order_relaxed);
+	int n = threads();
+	for (int i = 0; i < n; i++) {
+		mQueues[i].mSpan.store(span(generation, (int)((long long)aCount * i / n), (int)((long long)aCount * (i + 1) / n)), std::memory_order_relaxed);
+	}
+	mGeneration.store(generation, std::memory_order_seq_cst);
+	wakeAll();
+}
+
+void ThreadPool::wakeAll() {
+	// Only parked workers need a post, the rest see the generation change as they spin
+	for (int i = 1; i < threads(); i++) {
+		if (mWorkerState[i].mParked.exchange(false, std::memory_order_seq_cst)) {
+			mWorkerState[i].mWake.post();
+		}
+	}
+}
+
+void ThreadPool::workerLoop(int aIndex) {
+	Worker& self = mWorkerState[aIndex];
+	uint32_t seen = 0;
+	while (true) {
+		uint32_t generation = mGeneration.load(std::memory_order_acquire);
+		for (int spin = 0; spin < SPIN_COUNT && generation == seen; spin++) {
+			std::this_thread::yield();
+			generation = mGeneration.load(std::memory_order_acquire);
+		}
+		if (generation == seen) {
+			self.mParked.store(true, std::memory_order_seq_cst);
+			if (mGeneration.load(std::memory_order_seq_cst) == seen) {
+				self.mWake.wait();
+			} else if (!self.mParked.exchange(false, std::memory_order_seq_cst)) {
+				// run() saw us parked and has posted, take the post so the count stays at 0
+				self.mWake.wait();
+			}
+			continue;
+		}
+
+		if (mStop.load(std::memory_order_acquire)) {
+			return;
+		}
+		seen = generation;
+		runQueues(aIndex, generation);
+	}
+}
+
+void ThreadPool::runQueues(int aSelf, uint32_t aGeneration) {
+	int n = threads();
+	// Own span first, then walk round the others
+	for (int k = 0; k < n; k++) {
+		Queue& q = mQueues[(aSelf + k) % n];
+		uint64_t value = q.mSpan.load(std::memory_order_acquire);
+		while (true) {
+			const int next = (int)((value >> 16) & 0xffff);
+			const int end = (int)(value & 0xffff);
+			if ((uint32_t)(value >> 32) != aGeneration || next >= end) {
+				break;
+			}
+			if (!q.mSpan.compare_exchange_weak(value, value + ((uint64_t)1 << 16), std::memory_order_acq_rel)) {
+				continue;
+			}
+			// The job can't move on until this task is counted off, so its slot is still ours
+			const Job& job = mJobs[aGeneration & 1];
+			job.mTask(job.mContext, job.mBase + next);
+			mRemaining.fetch_sub(1, std::memory_order_release);
+			value = q.mSpan.load(std::memory_order_acquire);
+		}
+	}
+}
+
+void ThreadPool::pin(std::thread& aThread, int aCore) {
+#ifdef _WIN32
+	SetThreadAffinityMask((HANDLE)aThread.native_handle(), (DWORD_PTR)1 << aCore);
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(aCore, &set);
+	pthread_setaffinity_np(aThread.native_handle(), sizeof(set), &set);
+#else
+	(void)aThread;
+	(void)aCore;
+#endif
+}
+
+#endif
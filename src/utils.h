@@ -83,6 +83,13 @@ namespace Utility {
 		return aHertz * 2.0 * pi;
 	}
 
+	// Constant power pan, aPan from -1 (left) to 1 (right). Centre is -3dB on each side
+	void panGains(double aPan, float& aLeft, float& aRight) {
+		double angle = (clamp(aPan, -1.0, 1.0) + 1.0) * pi * 0.25;
+		aLeft = (float)std::cos(angle);
+		aRight = (float)std::sin(angle);
+	}
+
 	// Scale to freq convert
 	const int SCALE_DEFAULT = 0;
 	double scale(const int aNoteId, const int aScaleId = SCALE_DEFAULT) {
@@ -102,6 +109,11 @@ namespace Synth {
 		OSC_SAW_LIM,
 		OSC_SAW,
 		OSC_NOISE,
+		OSC_PULSE,
+		OSC_NOISE_PINK,
+		OSC_NOISE_BROWN,
+		// Fractal value noise pitched at the note, see FbmNoise
+		OSC_FBM,
 	};
 
 	double osc(double aTime,
@@ -110,6 +122,7 @@ namespace Synth {
 		double aLFOHertz = 0.0,
 		double aLFOAmp = 0.0,
 		double aCustom = 50.0) {
+		// aCustom is the pulse width in percent for OSC_PULSE
 		// Avoid large amplitudes with low frequencies
 		// LFO
 		double freq = Utility::freqToVel(aHertz) * aTime + aLFOAmp * aHertz * sin(Utility::freqToVel(aLFOHertz) * aTime);
@@ -138,8 +151,17 @@ namespace Synth {
 			return (2.0 / Utility::pi) * (aHertz * Utility::pi * std::fmod(aTime, 1.0 / aHertz) - (Utility::pi / 2.0));
 
 		case OSC_NOISE:
+		case OSC_NOISE_PINK:
+		case OSC_NOISE_BROWN:
+		case OSC_FBM:
+			// Coloured noise needs state, only Oscillator plays it. This is white
 			return Utility::randomDouble(); // freq does not affect... so plays constantly
 
+		case OSC_PULSE: {
+			double cycle = freq / (2.0 * Utility::pi);
+			return ((cycle - std::floor(cycle)) < aCustom / 100.0) ? 1.0 : -1.0;
+		}
+
 		default:
 			return 0.0;
 		}
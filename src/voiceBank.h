@@ -0,0 +1,525 @@
+#ifndef VOICEBANK_H
+#define VOICEBANK_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "utils.h"
+#include "envelope.h"
+#include "instrument.h"
+#include "cpuFeatures.h"
+#include "simdOps.h"
+
+// Waveform families the lane kernels render, one lane array each
+enum LaneShape {
+	LANE_SINE = 0,
+	LANE_SQUARE,
+	LANE_SAW,
+	LANE_TRIANGLE,
+	LANE_SHAPES,
+};
+
+// Frames rendered between envelope stage checks
+const int BANK_SUB_BLOCK = 16;
+// Lane arrays are padded to this many lanes so the widest kernel never reads past the end
+const int BANK_LANE_ALIGN = 16;
+
+// Structure of arrays for every oscillator layer of one shape. Each lane is one layer of one voice
+// and carries its own copy of the voice's envelope so a kernel can run it without gathers.
+struct VoiceLanes {
+	int mCount;
+	int mCapacity;
+
+	float* mPhase;
+	float* mIncrement;
+	float* mInvIncrement;
+	float* mLfoDepth;
+	float* mLfoSin;
+	float* mLfoCos;
+	float* mLfoRotSin;
+	float* mLfoRotCos;
+	float* mGain;
+	float* mLevel;
+	float* mEnvIncrement;
+	float* mEnvLow;
+	float* mEnvHigh;
+	float* mPanLeft;
+	float* mPanRight;
+
+	// Owning voice and which of its layers each lane is
+	std::vector<int> mVoice;
+	std::vector<int> mLayer;
+	std::vector<float> mStorage;
+
+	static const int kFields = 15;
+
+	VoiceLanes() {
+		mCount = 0;
+		mCapacity = 0;
+		float** fields[kFields] = { &mPhase, &mIncrement, &mInvIncrement, &mLfoDepth, &mLfoSin, &mLfoCos, &mLfoRotSin,
+			&mLfoRotCos, &mGain, &mLevel, &mEnvIncrement, &mEnvLow, &mEnvHigh, &mPanLeft, &mPanRight };
+		for (int f = 0; f < kFields; f++) {
+			*fields[f] = nullptr;
+		}
+	}
+
+	VoiceLanes(const VoiceLanes&) = delete;
+	VoiceLanes& operator=(const VoiceLanes&) = delete;
+
+	void allocate(int aLanes) {
+		mCapacity = (aLanes + BANK_LANE_ALIGN - 1) / BANK_LANE_ALIGN * BANK_LANE_ALIGN;
+		mCount = 0;
+		// One zeroed allocation, each field 64 byte aligned
+		mStorage.assign((size_t)kFields * mCapacity + 16, 0.0f);
+		float* base = mStorage.data();
+		while (((size_t)base & 63) != 0) {
+			base++;
+		}
+		float** fields[kFields] = { &mPhase, &mIncrement, &mInvIncrement, &mLfoDepth, &mLfoSin, &mLfoCos, &mLfoRotSin,
+			&mLfoRotCos, &mGain, &mLevel, &mEnvIncrement, &mEnvLow, &mEnvHigh, &mPanLeft, &mPanRight };
+		for (int f = 0; f < kFields; f++) {
+			*fields[f] = base + (size_t)f * mCapacity;
+		}
+		mVoice.assign(mCapacity, -1);
+		mLayer.assign(mCapacity, 0);
+	}
+
+	// Field f of lane l, in the order of the member list above
+	float& field(int f, int l) {
+		return mPhase[(size_t)f * mCapacity + l];
+	}
+};
+
+// Lane kernels, one copy per instruction set
+namespace SimdScalar {
+#include "voiceKernel.inl"
+}
+#if defined(SYNTH_X86)
+namespace SimdSse2 {
+#include "voiceKernel.inl"
+}
+SYNTH_TARGET_AVX2_BEGIN
+namespace SimdAvx2 {
+#include "voiceKernel.inl"
+}
+SYNTH_TARGET_END
+SYNTH_TARGET_AVX512_BEGIN
+namespace SimdAvx512 {
+#include "voiceKernel.inl"
+}
+SYNTH_TARGET_END
+#endif
+
+// Polyphonic renderer that keeps voice state as structure of arrays and renders 4/8/16 layers in lockstep.
+// The kernel is picked from the widest instruction set the CPU supports. All of them, including the
+// scalar fallback, produce bit-identical output.
+// Plays instruments of sine, square, saw and triangle layers with no voice filter, see canPlay().
+class VoiceBank {
+private:
+	enum Stage {
+		STAGE_IDLE = 0,
+		STAGE_ATTACK,
+		STAGE_DECAY,
+		STAGE_SUSTAIN,
+		STAGE_RELEASE,
+	};
+
+	struct BankVoice {
+		int mId;
+		int mChannel;
+		bool mActive;
+		Stage mStage;
+		long long mAge;
+		int mLayerCount;
+		int mShape[NOTE_OSCILLATORS];
+		int mLane[NOTE_OSCILLATORS];
+
+		// Envelope in samples and levels, from the instrument's EnvelopeADSR
+		float mStartAmp;
+		float mSustainAmp;
+		double mAttackSamples;
+		double mDecaySamples;
+		double mReleaseSamples;
+	};
+
+	typedef void(*LaneKernel)(VoiceLanes&, int, float*, float*, int);
+
+	unsigned int mSampleRate;
+	VoiceLanes mLanes[LANE_SHAPES];
+	std::vector<BankVoice> mVoices;
+	std::vector<int> mFree;
+	std::vector<int> mActive;
+	int mActiveCount;
+	long long mNextAge;
+	SimdLevel mLevel;
+	LaneKernel mKernel;
+
+	static int shapeFor(Synth::WaveForm aWaveForm) {
+		switch (aWaveForm) {
+		case Synth::OSC_SINE: return LANE_SINE;
+		case Synth::OSC_SQUARE: return LANE_SQUARE;
+		case Synth::OSC_SAW: case Synth::OSC_SAW_LIM: return LANE_SAW;
+		case Synth::OSC_TRIANGLE: return LANE_TRIANGLE;
+		default: return -1;
+		}
+	}
+
+	float level(const BankVoice& aVoice) {
+		return mLanes[aVoice.mShape[0]].mLevel[aVoice.mLane[0]];
+	}
+
+	void setEnvelope(BankVoice& aVoice, float aIncrement, float aLow, float aHigh) {
+		for (int k = 0; k < aVoice.mLayerCount; k++) {
+			VoiceLanes& lanes = mLanes[aVoice.mShape[k]];
+			int l = aVoice.mLane[k];
+			lanes.mEnvIncrement[l] = aIncrement;
+			lanes.mEnvLow[l] = aLow;
+			lanes.mEnvHigh[l] = aHigh;
+		}
+	}
+
+	void setLevel(BankVoice& aVoice, float aLevel) {
+		for (int k = 0; k < aVoice.mLayerCount; k++) {
+			mLanes[aVoice.mShape[k]].mLevel[aVoice.mLane[k]] = aLevel;
+		}
+	}
+
+	// Hold at the sustain level, or stop if it is silent, as VoiceEnvelope does
+	void enterSustain(BankVoice& aVoice) {
+		const float level = aVoice.mSustainAmp;
+		aVoice.mStage = (level <= 0.0f) ? STAGE_IDLE : STAGE_SUSTAIN;
+		setLevel(aVoice, level);
+		setEnvelope(aVoice, 0.0f, level, level);
+	}
+
+	void enterDecay(BankVoice& aVoice) {
+		float from = aVoice.mStartAmp;
+		float to = aVoice.mSustainAmp;
+		if (aVoice.mDecaySamples <= 0.0 || from == to) {
+			enterSustain(aVoice);
+			return;
+		}
+		aVoice.mStage = STAGE_DECAY;
+		setEnvelope(aVoice, (float)((to - from) / aVoice.mDecaySamples), std::min(from, to), std::max(from, to));
+	}
+
+	void enterAttack(BankVoice& aVoice) {
+		if (aVoice.mAttackSamples <= 0.0) {
+			setLevel(aVoice, aVoice.mStartAmp);
+			enterDecay(aVoice);
+			return;
+		}
+		// Same rate as a full attack from silence, so a retrigger from the current level is shorter
+		aVoice.mStage = STAGE_ATTACK;
+		setEnvelope(aVoice, (float)(aVoice.mStartAmp / aVoice.mAttackSamples), 0.0f, aVoice.mStartAmp);
+	}
+
+	void enterRelease(BankVoice& aVoice) {
+		float from = level(aVoice);
+		if (aVoice.mReleaseSamples <= 0.0 || from <= 0.0f) {
+			aVoice.mStage = STAGE_IDLE;
+			return;
+		}
+		aVoice.mStage = STAGE_RELEASE;
+		setEnvelope(aVoice, (float)(-from / aVoice.mReleaseSamples), 0.0f, from);
+	}
+
+	void removeLane(int aShape, int aLane) {
+		VoiceLanes& lanes = mLanes[aShape];
+		int last = --lanes.mCount;
+		if (aLane != last) {
+			for (int f = 0; f < VoiceLanes::kFields; f++) {
+				lanes.field(f, aLane) = lanes.field(f, last);
+			}
+			lanes.mVoice[aLane] = lanes.mVoice[last];
+			lanes.mLayer[aLane] = lanes.mLayer[last];
+			mVoices[lanes.mVoice[aLane]].mLane[lanes.mLayer[aLane]] = aLane;
+		}
+		// Padding lanes must stay silent
+		for (int f = 0; f < VoiceLanes::kFields; f++) {
+			lanes.field(f, last) = 0.0f;
+		}
+		lanes.mVoice[last] = -1;
+	}
+
+	void freeVoice(int aActiveSlot) {
+		int index = mActive[aActiveSlot];
+		BankVoice& v = mVoices[index];
+		for (int k = 0; k < v.mLayerCount; k++) {
+			removeLane(v.mShape[k], v.mLane[k]);
+		}
+		v.mActive = false;
+		v.mLayerCount = 0;
+		mFree.push_back(index);
+		mActive[aActiveSlot] = mActive[--mActiveCount];
+	}
+
+	int findSlot(int aId, int aChannel) {
+		for (int i = 0; i < mActiveCount; i++) {
+			const BankVoice& v = mVoices[mActive[i]];
+			if (v.mId == aId && v.mChannel == aChannel) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	// Oldest released voice, or the oldest voice if none are releasing
+	int stealSlot() {
+		int victim = -1;
+		for (int i = 0; i < mActiveCount; i++) {
+			const BankVoice& v = mVoices[mActive[i]];
+			if (victim < 0) {
+				victim = i;
+				continue;
+			}
+			const BankVoice& best = mVoices[mActive[victim]];
+			bool released = v.mStage == STAGE_RELEASE;
+			bool bestReleased = best.mStage == STAGE_RELEASE;
+			if ((released != bestReleased) ? released : v.mAge < best.mAge) {
+				victim = i;
+			}
+		}
+		return victim;
+	}
+
+	// Move every voice whose envelope reached its target on to the next stage
+	void updateStages() {
+		int i = 0;
+		while (i < mActiveCount) {
+			BankVoice& v = mVoices[mActive[i]];
+			float current = level(v);
+			switch (v.mStage) {
+			case STAGE_ATTACK:
+				if (current >= v.mStartAmp) {
+					enterDecay(v);
+				}
+				break;
+			case STAGE_DECAY:
+				if (current == v.mSustainAmp) {
+					enterSustain(v);
+				}
+				break;
+			case STAGE_RELEASE:
+				if (current <= 0.0f) {
+					v.mStage = STAGE_IDLE;
+				}
+				break;
+			default:
+				break;
+			}
+
+			if (v.mStage == STAGE_IDLE) {
+				freeVoice(i);
+			} else {
+				i++;
+			}
+		}
+	}
+
+	static void sumColumns(const float* aAcc, float* aOut, int aFrames) {
+		for (int i = 0; i < aFrames; i++) {
+			float sum = 0.0f;
+			for (int c = 0; c < 16; c++) {
+				sum += aAcc[i * 16 + c];
+			}
+			aOut[i] += sum;
+		}
+	}
+
+	static LaneKernel kernelFor(SimdLevel aLevel) {
+		switch (aLevel) {
+#if defined(SYNTH_X86)
+		case SIMD_AVX512: return SimdAvx512::renderLanes;
+		case SIMD_AVX2: return SimdAvx2::renderLanes;
+		case SIMD_SSE2: return SimdSse2::renderLanes;
+#endif
+		default: return SimdScalar::renderLanes;
+		}
+	}
+
+public:
+	VoiceBank(int aMaxVoices = 256, unsigned int aSampleRate = 44100) {
+		mSampleRate = aSampleRate;
+		mActiveCount = 0;
+		mNextAge = 0;
+		for (int s = 0; s < LANE_SHAPES; s++) {
+			mLanes[s].allocate(aMaxVoices * NOTE_OSCILLATORS);
+		}
+		mVoices.assign(aMaxVoices, BankVoice());
+		mActive.assign(aMaxVoices, 0);
+		for (int i = aMaxVoices - 1; i >= 0; i--) {
+			mFree.push_back(i);
+			mVoices[i].mActive = false;
+			mVoices[i].mLayerCount = 0;
+		}
+		setSimdLevel(CpuFeatures::detect());
+	}
+
+	// Pick a kernel, clamped to what this CPU supports
+	void setSimdLevel(SimdLevel aLevel) {
+		mLevel = std::min(aLevel, CpuFeatures::detect());
+		mKernel = kernelFor(mLevel);
+	}
+
+	SimdLevel simdLevel() const {
+		return mLevel;
+	}
+
+	int size() const {
+		return mActiveCount;
+	}
+
+	// True if every layer of aInstrument has a lane kernel and it has no voice filter. Plucked
+	// strings, filtered patches and noise layers are for Instrument::render
+	static bool canPlay(const Instrument& aInstrument) {
+		if (aInstrument.mLayerCount == 0 || aInstrument.mFilter.mMode != FILTER_OFF) {
+			return false;
+		}
+		for (int k = 0; k < aInstrument.mLayerCount; k++) {
+			if (shapeFor(aInstrument.mLayers[k].mWaveForm) < 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	int capacity() const {
+		return (int)mVoices.size();
+	}
+
+	bool playing(int aId, int aChannel) {
+		return findSlot(aId, aChannel) >= 0;
+	}
+
+	// Start aInstrument's layers for note aId, stealing a voice if the bank is full. False if the
+	// bank can't play aInstrument. aPanLeft and aPanRight are the voice's gains for stereo output
+	bool noteOn(int aId, int aChannel, const Instrument& aInstrument, float aPanLeft = 1.0f, float aPanRight = 1.0f) {
+		if (!canPlay(aInstrument)) {
+			return false;
+		}
+		int existing = findSlot(aId, aChannel);
+		if (existing >= 0) {
+			// Retrigger from the current level so there is no click
+			BankVoice& v = mVoices[mActive[existing]];
+			if (v.mStage == STAGE_RELEASE || v.mStage == STAGE_IDLE) {
+				enterAttack(v);
+			}
+			return true;
+		}
+
+		if (mFree.empty()) {
+			int victim = stealSlot();
+			if (victim < 0) {
+				return false;
+			}
+			freeVoice(victim);
+		}
+
+		int index = mFree.back();
+		mFree.pop_back();
+		mActive[mActiveCount++] = index;
+
+		BankVoice& v = mVoices[index];
+		v.mId = aId;
+		v.mChannel = aChannel;
+		v.mActive = true;
+		v.mAge = mNextAge++;
+		v.mLayerCount = 0;
+		v.mStartAmp = (float)aInstrument.mEnvelope.mStartAmp;
+		v.mSustainAmp = (float)aInstrument.mEnvelope.mSustainAmp;
+		v.mAttackSamples = aInstrument.mEnvelope.mAttackTime * mSampleRate;
+		v.mDecaySamples = aInstrument.mEnvelope.mDecayTime * mSampleRate;
+		v.mReleaseSamples = aInstrument.mEnvelope.mReleaseTime * mSampleRate;
+
+		for (int k = 0; k < aInstrument.mLayerCount; k++) {
+			const OscLayer& layer = aInstrument.mLayers[k];
+			int shape = shapeFor(layer.mWaveForm);
+			VoiceLanes& lanes = mLanes[shape];
+			int l = lanes.mCount++;
+			double hertz = Utility::scale(aId + layer.mNoteOffset);
+			double increment = hertz / mSampleRate;
+			double lfoStep = Utility::freqToVel(layer.mLfoHertz) / mSampleRate;
+
+			lanes.mPhase[l] = 0.0f;
+			lanes.mIncrement[l] = (float)increment;
+			lanes.mInvIncrement[l] = (increment > 0.0) ? (float)(1.0 / increment) : 0.0f;
+			lanes.mLfoDepth[l] = (float)(layer.mLfoAmp * hertz / (2.0 * Utility::pi));
+			lanes.mLfoSin[l] = 0.0f;
+			lanes.mLfoCos[l] = 1.0f;
+			lanes.mLfoRotSin[l] = (float)std::sin(lfoStep);
+			lanes.mLfoRotCos[l] = (float)std::cos(lfoStep);
+			lanes.mGain[l] = (float)(layer.mGain * aInstrument.mVolume);
+			lanes.mLevel[l] = 0.0f;
+			lanes.mPanLeft[l] = aPanLeft;
+			lanes.mPanRight[l] = aPanRight;
+			lanes.mVoice[l] = index;
+			lanes.mLayer[l] = v.mLayerCount;
+
+			v.mShape[v.mLayerCount] = shape;
+			v.mLane[v.mLayerCount] = l;
+			v.mLayerCount++;
+		}
+
+		enterAttack(v);
+		return true;
+	}
+
+	void noteOff(int aId, int aChannel) {
+		int slot = findSlot(aId, aChannel);
+		if (slot < 0) {
+			return;
+		}
+		BankVoice& v = mVoices[mActive[slot]];
+		if (v.mStage != STAGE_RELEASE) {
+			enterRelease(v);
+			if (v.mStage == STAGE_IDLE) {
+				freeVoice(slot);
+			}
+		}
+	}
+
+	// Add aFrames of every voice into aLeft and, panned, into aRight. Without aRight voices are
+	// mixed into aLeft unpanned
+	void render(float* aLeft, float* aRight, int aFrames) {
+		alignas(64) float acc[BANK_SUB_BLOCK * 16];
+		alignas(64) float accRight[BANK_SUB_BLOCK * 16];
+		float* right = (aRight != nullptr) ? accRight : nullptr;
+
+		for (int start = 0; start < aFrames; start += BANK_SUB_BLOCK) {
+			int n = std::min(BANK_SUB_BLOCK, aFrames - start);
+			std::memset(acc, 0, sizeof(float) * n * 16);
+			if (right != nullptr) {
+				std::memset(right, 0, sizeof(float) * n * 16);
+			}
+
+			for (int s = 0; s < LANE_SHAPES; s++) {
+				if (mLanes[s].mCount > 0) {
+					mKernel(mLanes[s], s, acc, right, n);
+				}
+			}
+
+			// Fixed summation order so every kernel gives the same result
+			sumColumns(acc, aLeft + start, n);
+			if (right != nullptr) {
+				sumColumns(right, aRight + start, n);
+			}
+
+			updateStages();
+		}
+
+		// Pull LFO phasors back onto the unit circle once per block
+		for (int s = 0; s < LANE_SHAPES; s++) {
+			VoiceLanes& lanes = mLanes[s];
+			for (int l = 0; l < lanes.mCount; l++) {
+				float norm = 1.5f - 0.5f * (lanes.mLfoSin[l] * lanes.mLfoSin[l] + lanes.mLfoCos[l] * lanes.mLfoCos[l]);
+				lanes.mLfoSin[l] *= norm;
+				lanes.mLfoCos[l] *= norm;
+			}
+		}
+	}
+};
+
+#endif
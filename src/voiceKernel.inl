@@ -0,0 +1,149 @@
+// Voice lane kernel, included by voiceBank.h once per instruction set inside a namespace that
+// provides Ops (see simdOps.h). Don't include this anywhere else.
+
+// sin(2 pi p) for p in 0..1, odd polynomial after folding to a quarter cycle
+static Ops::V laneSine(Ops::V p) {
+	const Ops::V quarter = Ops::set(0.25f);
+	const Ops::V half = Ops::set(0.5f);
+	Ops::V x = Ops::sub(p, half);
+	x = Ops::select(Ops::lt(quarter, x), Ops::sub(half, x), x);
+	x = Ops::select(Ops::lt(x, Ops::set(-0.25f)), Ops::sub(Ops::set(-0.5f), x), x);
+
+	Ops::V s = Ops::mul(x, x);
+	Ops::V y = Ops::set(42.058693944897634f);
+	y = Ops::add(Ops::set(-76.70585975306136f), Ops::mul(s, y));
+	y = Ops::add(Ops::set(81.60524927607504f), Ops::mul(s, y));
+	y = Ops::add(Ops::set(-41.341702240399755f), Ops::mul(s, y));
+	y = Ops::add(Ops::set(6.283185307179586f), Ops::mul(s, y));
+	// sin(2 pi p) = -sin(2 pi (p - 0.5))
+	return Ops::sub(Ops::set(0.0f), Ops::mul(x, y));
+}
+
+// Same residual as Oscillator::polyBlep
+static Ops::V lanePolyBlep(Ops::V t, Ops::V dt, Ops::V invDt) {
+	const Ops::V one = Ops::set(1.0f);
+	Ops::V a = Ops::mul(t, invDt);
+	Ops::V early = Ops::sub(Ops::sub(Ops::add(a, a), Ops::mul(a, a)), one);
+	Ops::V b = Ops::mul(Ops::sub(t, one), invDt);
+	Ops::V late = Ops::add(Ops::add(Ops::mul(b, b), Ops::add(b, b)), one);
+	Ops::V r = Ops::select(Ops::lt(Ops::sub(one, dt), t), late, Ops::set(0.0f));
+	return Ops::select(Ops::lt(t, dt), early, r);
+}
+
+// Same residual as Oscillator::polyBlamp
+static Ops::V lanePolyBlamp(Ops::V t, Ops::V dt, Ops::V invDt) {
+	const Ops::V one = Ops::set(1.0f);
+	const Ops::V third = Ops::set(1.0f / 3.0f);
+	Ops::V a = Ops::sub(Ops::mul(t, invDt), one);
+	Ops::V early = Ops::sub(Ops::set(0.0f), Ops::mul(Ops::mul(Ops::mul(a, a), a), third));
+	Ops::V b = Ops::add(Ops::mul(Ops::sub(t, one), invDt), one);
+	Ops::V late = Ops::mul(Ops::mul(Ops::mul(b, b), b), third);
+	Ops::V r = Ops::select(Ops::lt(Ops::sub(one, dt), t), late, Ops::set(0.0f));
+	return Ops::select(Ops::lt(t, dt), early, r);
+}
+
+static Ops::V laneWrap(Ops::V p) {
+	const Ops::V one = Ops::set(1.0f);
+	return Ops::sub(p, Ops::select(Ops::ge(p, one), one, Ops::set(0.0f)));
+}
+
+template<int Shape>
+static Ops::V laneShape(Ops::V p, Ops::V dt, Ops::V invDt) {
+	const Ops::V one = Ops::set(1.0f);
+	switch (Shape) {
+	case LANE_SQUARE: {
+		Ops::V naive = Ops::select(Ops::lt(p, Ops::set(0.5f)), one, Ops::set(-1.0f));
+		Ops::V t = laneWrap(Ops::add(p, Ops::set(0.5f)));
+		return Ops::sub(Ops::add(naive, lanePolyBlep(p, dt, invDt)), lanePolyBlep(t, dt, invDt));
+	}
+	case LANE_SAW:
+		return Ops::sub(Ops::sub(Ops::add(p, p), one), lanePolyBlep(p, dt, invDt));
+	case LANE_TRIANGLE: {
+		Ops::V four = Ops::set(4.0f);
+		Ops::V up = Ops::mul(four, p);
+		Ops::V naive = Ops::select(Ops::lt(p, Ops::set(0.25f)), up,
+			Ops::select(Ops::lt(p, Ops::set(0.75f)), Ops::sub(Ops::set(2.0f), up), Ops::sub(up, four)));
+		Ops::V scale = Ops::mul(four, dt);
+		Ops::V peak = lanePolyBlamp(laneWrap(Ops::add(p, Ops::set(0.75f))), dt, invDt);
+		Ops::V trough = lanePolyBlamp(laneWrap(Ops::add(p, Ops::set(0.25f))), dt, invDt);
+		return Ops::add(Ops::sub(naive, Ops::mul(scale, peak)), Ops::mul(scale, trough));
+	}
+	case LANE_SINE: default:
+		return laneSine(p);
+	}
+}
+
+// Render aFrames of every lane in aLanes, lane l accumulating into column (l % 16) of the
+// aFrames x 16 block aAcc. Columns are always summed in lane order, whatever the width.
+// Stereo lanes go through their pan gains into aAcc and aAccRight.
+template<int Shape, bool Stereo>
+static void renderLanesShape(VoiceLanes& aLanes, float* aAcc, float* aAccRight, int aFrames) {
+	const Ops::V zero = Ops::set(0.0f);
+	const Ops::V one = Ops::set(1.0f);
+	const int lanes = (aLanes.mCount + Ops::W - 1) / Ops::W * Ops::W;
+
+	for (int l = 0; l < lanes; l += Ops::W) {
+		Ops::V phase = Ops::load(aLanes.mPhase + l);
+		Ops::V inc = Ops::load(aLanes.mIncrement + l);
+		Ops::V invInc = Ops::load(aLanes.mInvIncrement + l);
+		Ops::V depth = Ops::load(aLanes.mLfoDepth + l);
+		Ops::V lfoSin = Ops::load(aLanes.mLfoSin + l);
+		Ops::V lfoCos = Ops::load(aLanes.mLfoCos + l);
+		Ops::V rotSin = Ops::load(aLanes.mLfoRotSin + l);
+		Ops::V rotCos = Ops::load(aLanes.mLfoRotCos + l);
+		Ops::V gain = Ops::load(aLanes.mGain + l);
+		Ops::V level = Ops::load(aLanes.mLevel + l);
+		Ops::V envInc = Ops::load(aLanes.mEnvIncrement + l);
+		Ops::V envLo = Ops::load(aLanes.mEnvLow + l);
+		Ops::V envHi = Ops::load(aLanes.mEnvHigh + l);
+		Ops::V panLeft = Ops::load(aLanes.mPanLeft + l);
+		Ops::V panRight = Ops::load(aLanes.mPanRight + l);
+		float* acc = aAcc + (l & 15);
+		float* accRight = Stereo ? aAccRight + (l & 15) : nullptr;
+
+		for (int i = 0; i < aFrames; i++) {
+			// LFO phase modulation, the result stays within -1..2 so one wrap each way is enough
+			Ops::V p = Ops::add(phase, Ops::mul(depth, lfoSin));
+			p = Ops::add(p, Ops::select(Ops::lt(p, zero), one, zero));
+			p = Ops::sub(p, Ops::select(Ops::ge(p, one), one, zero));
+
+			Ops::V v = Ops::mul(Ops::mul(laneShape<Shape>(p, inc, invInc), level), gain);
+			if (Stereo) {
+				Ops::store(acc + i * 16, Ops::add(Ops::load(acc + i * 16), Ops::mul(v, panLeft)));
+				Ops::store(accRight + i * 16, Ops::add(Ops::load(accRight + i * 16), Ops::mul(v, panRight)));
+			} else {
+				Ops::store(acc + i * 16, Ops::add(Ops::load(acc + i * 16), v));
+			}
+
+			phase = laneWrap(Ops::add(phase, inc));
+			level = Ops::min(Ops::max(Ops::add(level, envInc), envLo), envHi);
+			Ops::V nextSin = Ops::add(Ops::mul(lfoSin, rotCos), Ops::mul(lfoCos, rotSin));
+			lfoCos = Ops::sub(Ops::mul(lfoCos, rotCos), Ops::mul(lfoSin, rotSin));
+			lfoSin = nextSin;
+		}
+
+		Ops::store(aLanes.mPhase + l, phase);
+		Ops::store(aLanes.mLfoSin + l, lfoSin);
+		Ops::store(aLanes.mLfoCos + l, lfoCos);
+		Ops::store(aLanes.mLevel + l, level);
+	}
+}
+
+template<bool Stereo>
+static void renderLanesStereo(VoiceLanes& aLanes, int aShape, float* aAcc, float* aAccRight, int aFrames) {
+	switch (aShape) {
+	case LANE_SQUARE: renderLanesShape<LANE_SQUARE, Stereo>(aLanes, aAcc, aAccRight, aFrames); break;
+	case LANE_SAW: renderLanesShape<LANE_SAW, Stereo>(aLanes, aAcc, aAccRight, aFrames); break;
+	case LANE_TRIANGLE: renderLanesShape<LANE_TRIANGLE, Stereo>(aLanes, aAcc, aAccRight, aFrames); break;
+	case LANE_SINE: default: renderLanesShape<LANE_SINE, Stereo>(aLanes, aAcc, aAccRight, aFrames); break;
+	}
+}
+
+// Mono without aAccRight
+static void renderLanes(VoiceLanes& aLanes, int aShape, float* aAcc, float* aAccRight, int aFrames) {
+	if (aAccRight == nullptr) {
+		renderLanesStereo<false>(aLanes, aShape, aAcc, aAccRight, aFrames);
+	} else {
+		renderLanesStereo<true>(aLanes, aShape, aAcc, aAccRight, aFrames);
+	}
+}
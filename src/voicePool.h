@@ -0,0 +1,154 @@
+#ifndef VOICEPOOL_H
+#define VOICEPOOL_H
+
+#include <vector>
+
+// Which voice to take over when a note starts and the pool is full
+enum StealPolicy {
+	// Voice with the earliest note on time
+	STEAL_OLDEST = 0,
+	// Voice with the lowest envelope level at the end of the last block
+	STEAL_QUIETEST,
+	// Oldest voice already in its release phase, falling back to the oldest voice
+	STEAL_RELEASED,
+};
+
+// Preallocated voices with O(1) allocate/free. Active voices are kept as a dense index list so
+// the render loop walks them without gaps, finished voices are swapped out in compact() once per block.
+// T needs mActive, mTimeOn, mTimeOff and mLevel (see Note).
+template<class T>
+class VoicePool {
+private:
+	std::vector<T> mVoices;
+	// Stack of unused voice indices
+	std::vector<int> mFree;
+	// Dense list of indices in use, the first mActiveCount entries are valid
+	std::vector<int> mActive;
+	int mActiveCount;
+	StealPolicy mPolicy;
+
+	int pickVictim() const {
+		int victim = -1;
+		for (int i = 0; i < mActiveCount; i++) {
+			const T& v = mVoices[mActive[i]];
+			if (victim < 0) {
+				victim = i;
+				continue;
+			}
+			const T& best = mVoices[mActive[victim]];
+			bool better = false;
+
+			switch (mPolicy) {
+			case STEAL_QUIETEST:
+				better = v.mLevel < best.mLevel;
+				break;
+			case STEAL_RELEASED: {
+				bool vReleased = v.mTimeOff > v.mTimeOn;
+				bool bestReleased = best.mTimeOff > best.mTimeOn;
+				better = (vReleased != bestReleased) ? vReleased : v.mTimeOn < best.mTimeOn;
+				break;
+			}
+			case STEAL_OLDEST: default:
+				better = v.mTimeOn < best.mTimeOn;
+				break;
+			}
+
+			if (better) {
+				victim = i;
+			}
+		}
+		return victim;
+	}
+
+public:
+	VoicePool(int aCapacity = 64, StealPolicy aPolicy = STEAL_RELEASED) {
+		mActiveCount = 0;
+		mPolicy = aPolicy;
+		resize(aCapacity);
+	}
+
+	// Reallocates, so only call while audio is stopped
+	void resize(int aCapacity) {
+		mVoices.assign(aCapacity, T());
+		mActive.assign(aCapacity, 0);
+		mFree.clear();
+		mFree.reserve(aCapacity);
+		for (int i = aCapacity - 1; i >= 0; i--) {
+			mFree.push_back(i);
+		}
+		mActiveCount = 0;
+	}
+
+	void setPolicy(StealPolicy aPolicy) {
+		mPolicy = aPolicy;
+	}
+
+	// Hand out a reset voice, stealing one if the pool is full. Never allocates
+	T* allocate() {
+		if (mFree.empty()) {
+			int victim = pickVictim();
+			if (victim < 0) {
+				return nullptr;
+			}
+			T& stolen = mVoices[mActive[victim]];
+			stolen = T();
+			return &stolen;
+		}
+
+		int index = mFree.back();
+		mFree.pop_back();
+		mActive[mActiveCount++] = index;
+		mVoices[index] = T();
+		return &mVoices[index];
+	}
+
+	// Return voices that are no longer mActive to the free list, swapping the last active voice into each gap
+	void compact() {
+		int i = 0;
+		while (i < mActiveCount) {
+			int index = mActive[i];
+			if (!mVoices[index].mActive) {
+				mFree.push_back(index);
+				mActive[i] = mActive[--mActiveCount];
+			} else {
+				i++;
+			}
+		}
+	}
+
+	int size() const {
+		return mActiveCount;
+	}
+
+	int capacity() const {
+		return (int)mVoices.size();
+	}
+
+	// Slot of a voice handed out by allocate(), stays the same for as long as the pool lives
+	int slotOf(const T* aVoice) const {
+		return (int)(aVoice - mVoices.data());
+	}
+
+	// i-th active voice, 0 <= i < size()
+	T& operator[](int i) {
+		return mVoices[mActive[i]];
+	}
+
+	const T& operator[](int i) const {
+		return mVoices[mActive[i]];
+	}
+
+	// Active voice matching aPred, or nullptr
+	template<class Pred>
+	T* find(Pred aPred) {
+		for (int i = 0; i < mActiveCount; i++) {
+			T& v = mVoices[mActive[i]];
+			if (aPred(v)) {
+				return &v;
+			}
+		}
+		return nullptr;
+	}
+};
+
+#endif
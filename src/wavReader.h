@@ -0,0 +1,111 @@
+#ifndef WAVREADER_H
+#define WAVREADER_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Decoded WAV file, samples interleaved in -1.0 .. 1.0
+struct WavData {
+	unsigned int mSampleRate;
+	unsigned int mChannels;
+	std::vector<float> mSamples;
+
+	WavData() {
+		mSampleRate = 0;
+		mChannels = 0;
+	}
+
+	size_t frames() const {
+		return (mChannels > 0) ? mSamples.size() / mChannels : 0;
+	}
+};
+
+// Reads 16, 24 and 32 bit PCM and 32 bit float WAV files (plain or WAVE_FORMAT_EXTENSIBLE),
+// e.g. impulse responses. Unknown chunks are skipped.
+class WavReader {
+private:
+	static uint32_t u32(const unsigned char* p) {
+		return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+	static uint16_t u16(const unsigned char* p) {
+		return (uint16_t)(p[0] | (p[1] << 8));
+	}
+
+public:
+	// Returns false if the file can't be read or isn't a format we know
+	static bool load(const std::string& aPath, WavData& aData) {
+		std::ifstream file(aPath, std::ios::binary);
+		if (!file.is_open()) {
+			return false;
+		}
+
+		unsigned char riff[12];
+		if (!file.read((char*)riff, 12) || std::string((char*)riff, 4) != "RIFF" || std::string((char*)riff + 8, 4) != "WAVE") {
+			return false;
+		}
+
+		uint16_t format = 0;
+		uint16_t bits = 0;
+		aData = WavData();
+		unsigned char header[8];
+		while (file.read((char*)header, 8)) {
+			std::string id((char*)header, 4);
+			uint32_t size = u32(header + 4);
+
+			if (id == "fmt ") {
+				std::vector<unsigned char> fmt(size);
+				if (size < 16 || !file.read((char*)fmt.data(), size)) {
+					return false;
+				}
+				format = u16(&fmt[0]);
+				aData.mChannels = u16(&fmt[2]);
+				aData.mSampleRate = u32(&fmt[4]);
+				bits = u16(&fmt[14]);
+				// WAVE_FORMAT_EXTENSIBLE keeps the real format at the start of the sub format GUID
+				if (format == 0xfffe && size >= 26) {
+					format = u16(&fmt[24]);
+				}
+			} else if (id == "data") {
+				const unsigned int bytes = bits / 8;
+				const bool pcm = (format == 1 && (bits == 16 || bits == 24 || bits == 32));
+				const bool ieee = (format == 3 && bits == 32);
+				if (aData.mChannels == 0 || (!pcm && !ieee)) {
+					return false;
+				}
+
+				std::vector<unsigned char> raw(size);
+				file.read((char*)raw.data(), size);
+				size_t count = (size_t)file.gcount() / bytes;
+				count -= count % aData.mChannels;
+				aData.mSamples.resize(count);
+				for (size_t i = 0; i < count; i++) {
+					const unsigned char* p = &raw[i * bytes];
+					float sample;
+					if (ieee) {
+						uint32_t word = u32(p);
+						std::memcpy(&sample, &word, 4);
+					} else if (bits == 16) {
+						sample = (float)(int16_t)u16(p) * (1.0f / 32768.0f);
+					} else if (bits == 24) {
+						int32_t word = (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24));
+						sample = (float)(word >> 8) * (1.0f / 8388608.0f);
+					} else {
+						sample = (float)((double)(int32_t)u32(p) * (1.0 / 2147483648.0));
+					}
+					aData.mSamples[i] = sample;
+				}
+				return true;
+			} else {
+				// Chunks are padded to an even size
+				file.seekg(size + (size & 1), std::ios::cur);
+			}
+		}
+		return false;
+	}
+};
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef WAVWRITER_H
+#define WAVWRITER_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "sampleConverter.h"
+
+class WavWriter {
+private:
+	std::ofstream mFile;
+	unsigned int mSampleRate;
+	unsigned int mChannels;
+	WavFormat mFormat;
+	uint32_t mDataBytes;
+	SampleConverter mConverter;
+	std::vector<char> mScratch;
+
+	void writeU16(uint16_t aValue) {
+		char bytes[2] = { (char)(aValue & 0xff), (char)((aValue >> 8) & 0xff) };
+		mFile.write(bytes, 2);
+	}
+
+	void writeU32(uint32_t aValue) {
+		char bytes[4] = {
+			(char)(aValue & 0xff), (char)((aValue >> 8) & 0xff),
+			(char)((aValue >> 16) & 0xff), (char)((aValue >> 24) & 0xff)
+		};
+		mFile.write(bytes, 4);
+	}
+
+	unsigned int bytesPerSample() const {
+		return SampleConverter::bytesPerSample(mFormat);
+	}
+
+	void writeHeader() {
+		// RIFF / fmt / data, sizes are patched in close()
+		mFile.write("RIFF", 4);
+		writeU32(36 + mDataBytes);
+		mFile.write("WAVE", 4);
+
+		mFile.write("fmt ", 4);
+		writeU32(16);
+		writeU16((mFormat == WAV_FLOAT32) ? 3 : 1);
+		writeU16((uint16_t)mChannels);
+		writeU32(mSampleRate);
+		writeU32(mSampleRate * mChannels * bytesPerSample());
+		writeU16((uint16_t)(mChannels * bytesPerSample()));
+		writeU16((uint16_t)(bytesPerSample() * 8));
+
+		mFile.write("data", 4);
+		writeU32(mDataBytes);
+	}
+
+public:
+	WavWriter() {
+		mSampleRate = 44100;
+		mChannels = 1;
+		mFormat = WAV_PCM16;
+		mDataBytes = 0;
+	}
+
+	~WavWriter() {
+		close();
+	}
+
+	// aDither adds triangular dither to 16 and 24 bit output
+	bool open(const std::string& aPath, unsigned int aSampleRate, unsigned int aChannels, WavFormat aFormat, bool aDither = false) {
+		close();
+		mFile.open(aPath, std::ios::binary | std::ios::trunc);
+		if (!mFile.is_open()) {
+			return false;
+		}
+		mSampleRate = aSampleRate;
+		mChannels = aChannels;
+		mFormat = aFormat;
+		mConverter = SampleConverter(aFormat, aDither);
+		mDataBytes = 0;
+		writeHeader();
+		return mFile.good();
+	}
+
+	bool isOpen() const {
+		return mFile.is_open();
+	}
+
+	// Write interleaved samples in -1.0 .. 1.0, clipped for integer output
+	void write(const float* aSamples, size_t aCount) {
+		if (!mFile.is_open()) {
+			return;
+		}
+
+		mConverter.convert(aSamples, aCount, mScratch);
+		mFile.write(mScratch.data(), mScratch.size());
+		mDataBytes += (uint32_t)mScratch.size();
+	}
+
+	void close() {
+		if (!mFile.is_open()) {
+			return;
+		}
+		mFile.seekp(0, std::ios::beg);
+		writeHeader();
+		mFile.close();
+	}
+};
+
+#endif